@@ -74,6 +74,18 @@ struct FGMRESContext : public GMRESContext<T>
     : GMRESContext<T>(N,R), Z(N,R+1) {};
 };
 
+/** Switch a kernel providing set_single_precision() between single and
+ * double precision evaluation. Other kernels always evaluate in double.
+ */
+template <typename Kernel>
+auto set_precision(Kernel& K, bool single, int)
+    -> decltype(K.set_single_precision(single)) {
+  return K.set_single_precision(single);
+}
+template <typename Kernel>
+void set_precision(Kernel&, bool, long) {
+}
+
 /** GMRES implementation
  * requires Matvec object with execute(std::vector<T>&, unsigned) signature
  * Matvec must also define charge and result types
@@ -170,7 +182,8 @@ void GMRES(Matvec& MV,
 
   // outer (restart) loop
   do {
-    // dot product of A*x -- FMM call
+    // dot product of A*x -- FMM call, in double for the true residual
+    set_precision(K, false, 0);
     std::fill(context.w.begin(),context.w.end(),0);
     context.w = MV.execute(x); // V(0) = A*x
     // V(0) = V(0) - b
@@ -194,6 +207,7 @@ void GMRES(Matvec& MV,
       // set p for this iteration
       int p = std::max(1u,opts.predict_p(fabs(resid)));
       K.set_p(p);
+      set_precision(K, opts.predict_single(fabs(resid)), 0);
 
       // perform w = A*x
       std::fill(context.V0.begin(),context.V0.end(),0.);
@@ -246,6 +260,7 @@ void GMRES(Matvec& MV,
 
   } while (fabs(resid) > opts.residual && iter < opts.max_iters);
   // } while (iter < opts.max_iters);
+  set_precision(K, false, 0);
 
   if (context.output)
     printf("Final residual: %.4e, after %d iterations\n",fabs(resid),iter);
@@ -299,7 +314,8 @@ void FGMRES(Matvec& MV,
 
   // outer (restart) loop
   do {
-    // dot product of A*x -- FMM call
+    // dot product of A*x -- FMM call, in double for the true residual
+    set_precision(K, false, 0);
     context.w = MV.execute(x); // V(0) = A*x
     // V(0) = V(0) - b
     blas::axpy(b,context.w,-1.);
@@ -322,6 +338,7 @@ void FGMRES(Matvec& MV,
       // set p for this iteration
       int p = opts.predict_p(fabs(resid));
       K.set_p(p);
+      set_precision(K, opts.predict_single(fabs(resid)), 0);
 
       // perform w = A*x
       std::fill(context.V0.begin(),context.V0.end(),0.);
@@ -374,6 +391,7 @@ void FGMRES(Matvec& MV,
       if (iter % 10 == 0) printf("it: %04d, residual: %.3e\n",iter,(double)fabs(resid));
 
   } while (fabs(resid) > opts.residual && iter < opts.max_iters);
+  set_precision(K, false, 0);
 
   if (context.output)
     printf("Final residual: %.4e, after %d iterations\n",fabs(resid),iter);
@@ -14,27 +14,43 @@ struct SolverOptions
   int max_iters, restart;
   unsigned max_p, p_min;
   bool variable_p;
+  //! Evaluate in single precision once the accuracy requested from the
+  //! matvec is above single_precision_tol (requires variable_p)
+  bool mixed_precision;
+  double single_precision_tol;
 
   enum relaxation_type { SIMONCINI, BOURAS };
 
   relaxation_type relax_type;
 
-  SolverOptions(double r, int m_iters, unsigned p) : residual(r), max_iters(m_iters), restart(50), max_p(p), variable_p(false), relax_type(BOURAS) {};
-  SolverOptions() : residual(1e-5), max_iters(500), restart(500), max_p(16), p_min(5), variable_p(true), relax_type(BOURAS) {};
+  SolverOptions(double r, int m_iters, unsigned p) : residual(r), max_iters(m_iters), restart(50), max_p(p), variable_p(false), mixed_precision(false), single_precision_tol(1e-5), relax_type(BOURAS) {};
+  SolverOptions() : residual(1e-5), max_iters(500), restart(500), max_p(16), p_min(5), variable_p(true), mixed_precision(false), single_precision_tol(1e-5), relax_type(BOURAS) {};
 
-  unsigned predict_p(double eps) const {
-    // if no relaxation, return default p
-    if (!this->variable_p) return max_p;
+  /** The accuracy requested from the matvec at the current residual eps */
+  double relaxed_accuracy(double eps) const {
     // relaxation from Bouras & Fraysse
     if (this->relax_type == BOURAS) {
       double alpha = 1. / std::min(eps, 1.);
-      double nu = std::min(alpha*this->residual,1.);
-      // predict p for Spherical Laplace kernel -- abstract out
-      return std::min((unsigned)ceil(-log2(nu)),max_p);
+      return std::min(alpha*this->residual,1.);
     } else if (this->relax_type == SIMONCINI) {
-      return std::min((unsigned)ceil(-log2(eps)),max_p);
+      return eps;
     }
-    return max_p;
+    return 0.;
+  }
+
+  unsigned predict_p(double eps) const {
+    // if no relaxation, return default p
+    if (!this->variable_p) return max_p;
+    double nu = relaxed_accuracy(eps);
+    if (nu <= 0.) return max_p;
+    // predict p for Spherical Laplace kernel -- abstract out
+    return std::min((unsigned)ceil(-log2(nu)),max_p);
+  }
+
+  /** Whether the matvec can run in single precision at the residual eps */
+  bool predict_single(double eps) const {
+    if (!this->mixed_precision || !this->variable_p) return false;
+    return relaxed_accuracy(eps) >= single_precision_tol;
   }
 };
 
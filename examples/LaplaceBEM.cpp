@@ -52,6 +52,16 @@ void printHelpAndExit()
   printf("-theta <double> : Set MAC theta for treecode evaluators\n");
   printf("-eval {FMM,TREE} : Choose either FMM or treecode evaluator\n"); 
   printf("-ncrit <int> : Maximum # of particles per Octree box\n");
+  printf("-sparse_format {CSR,BLOCK} : Storage of the near-field matrix\n");
+  printf("-sparse_budget <double> : Memory budget of the near-field matrix in MB\n");
+  printf("-sparse_symmetric : Store the near-field of symmetric kernels once\n");
+  printf("-expansion_arena : Store all expansions in one contiguous buffer\n");
+  printf("-huge_pages : Back the expansion storage with huge pages\n");
+  printf("-rotate : Translate expansions by rotation onto the z-axis\n");
+  printf("-m2l_batched : Apply M2L per distinct translation as a matrix product\n");
+  printf("-m2m_batched : Apply M2M and L2L per child octant as a matrix product\n");
+  printf("-leaf_matrices : Precompute the P2M and L2P of every leaf as matrices\n");
+  printf("-p2p_packed : Evaluate P2P over the sources of every leaf packed as arrays\n");
   printf("\n");
   printf("Problem & Solver Options:\n");
   printf("-p <double> : Number of terms in the Multipole / Local expansions\n");
@@ -59,6 +69,7 @@ void printHelpAndExit()
   printf("-recursions <int> : number of recursive subdivisions to create a sphere - # panels = 2*4^recursions, default = 4\n");
   printf("-second_kind : enable 'second-kind' option to solve second-kind integral equations\n");
   printf("-fixed_p : enable 'non-relaxed' option\n");
+  printf("-mixed_precision : evaluate in single precision in late (relaxed) iterations\n");
   printf("-solver_tol <double> : Set the solver tolerance, default = 1e-5\n"); 
   printf("-help : print this message\n");
 
@@ -108,6 +119,18 @@ int main(int argc, char **argv)
 	printf("N = %i\n", 2* (int) pow(4, recursions));
     } else if (strcmp(argv[i],"-eval") == 0) {
       i++;
+    } else if (strcmp(argv[i],"-sparse_format") == 0) {
+      i++;
+    } else if (strcmp(argv[i],"-sparse_budget") == 0) {
+      i++;
+    } else if (strcmp(argv[i],"-sparse_symmetric") == 0) {
+    } else if (strcmp(argv[i],"-expansion_arena") == 0) {
+    } else if (strcmp(argv[i],"-huge_pages") == 0) {
+    } else if (strcmp(argv[i],"-rotate") == 0) {
+    } else if (strcmp(argv[i],"-m2l_batched") == 0) {
+    } else if (strcmp(argv[i],"-m2m_batched") == 0) {
+    } else if (strcmp(argv[i],"-leaf_matrices") == 0) {
+    } else if (strcmp(argv[i],"-p2p_packed") == 0) {
     } else if (strcmp(argv[i], "-ncrit") == 0) {
       i++;
       printf("ncrit = %s\n", argv[i]);
@@ -127,6 +150,9 @@ int main(int argc, char **argv)
     } else if (strcmp(argv[i],"-fixed_p") == 0) {
       solver_options.variable_p = false;
 	printf("relaxed = False\n");
+    } else if (strcmp(argv[i],"-mixed_precision") == 0) {
+      solver_options.mixed_precision = true;
+	printf("mixed precision = True\n");
     } else if (strcmp(argv[i],"-solver_tol") == 0) {
       i++;
       solver_options.residual = (double)atof(argv[i]);
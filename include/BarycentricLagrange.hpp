@@ -0,0 +1,257 @@
+#pragma once
+/** @file BarycentricLagrange.hpp
+ * @brief Treecode expansions of any kernel with a pointwise operator(), by
+ * barycentric Lagrange interpolation on Chebyshev points
+ *
+ * The sources of a box are replaced by proxy charges at the tensor grid of
+ * the (n+1)^3 Chebyshev points of the box, the charges of the sources times
+ * the Lagrange polynomials of degree n of the grid at the sources:
+ *   P2M: q_k += L_k(y) q for every source y of charge q
+ *   M2M: the same with the proxies of a child as sources, applied one
+ *        dimension at a time
+ *   M2P: r += sum_k K(t, x_k) q_k at every target t
+ * Only evaluations of the kernel are needed, and there are no local
+ * expansions, so the boxes only store their proxy charges. The M2P is a sum
+ * over the proxies independent for every target.
+ *
+ * The Lagrange polynomials are evaluated in the barycentric form
+ *   L_i(x) = (w_i / (x - s_i)) / sum_j (w_j / (x - s_j))
+ * on the Chebyshev points of the second kind s_i = cos(i pi / n), with
+ * weights w_i = (-1)^i, halved for i = 0 and i = n.
+ *
+ * The interpolation of the kernel only converges for targets well outside
+ * the box. The radii of the default MAC are half the sides of the boxes, so
+ * theta should be at most 0.5: with theta = 0.7 targets can reach the
+ * corners of the source box.
+ *
+ * Reference:
+ *   L. Wang, R. Krasny, S. Tlupova, "A kernel-independent treecode based on
+ *   barycentric Lagrange interpolation", Commun. Comput. Phys. 2020
+ */
+
+#include "Vec.hpp"
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+
+template <typename Kernel>
+class BarycentricLagrange : public Kernel
+{
+ public:
+  //! The pointwise kernel
+  typedef Kernel base_kernel_type;
+
+  //! The dimension of the Kernel
+  static constexpr unsigned dimension = 3;
+  static_assert(Kernel::dimension == dimension,
+                "BarycentricLagrange is three-dimensional");
+  //! Point type
+  typedef typename Kernel::point_type point_type;
+  //! Source type
+  typedef typename Kernel::source_type source_type;
+  //! Target type
+  typedef typename Kernel::target_type target_type;
+  //! Charge type
+  typedef typename Kernel::charge_type charge_type;
+  //! The return type of a kernel evaluation
+  typedef typename Kernel::kernel_value_type kernel_value_type;
+  //! The product of the kernel_value_type and the charge_type
+  typedef typename Kernel::result_type result_type;
+
+  /** Proxy charges of a box */
+  struct multipole_type {
+    //! Side of the box
+    double side;
+    //! Charges of the Chebyshev grid, (i,j,k) at (i*(n+1) + j)*(n+1) + k
+    std::vector<charge_type> charges;
+  };
+  //! No local expansions are formed by the treecode
+  typedef multipole_type local_type;
+
+ private:
+  //! Degree of the interpolation
+  unsigned n_;
+  //! Chebyshev points of the second kind on [-1,1]
+  std::vector<double> s_;
+  //! Barycentric weights of s_
+  std::vector<double> w_;
+
+ public:
+  //! Constructor
+  BarycentricLagrange(const Kernel& K = Kernel(), unsigned n = 6)
+      : Kernel(K) {
+    set_degree(n);
+  }
+
+  /** Set the degree of the interpolation, at least 1
+   * The boxes have (n+1)^3 proxy charges.
+   */
+  void set_degree(unsigned n) {
+    if (n < 1) {
+      printf("[W]: Interpolation degree %u too low -- using 1\n", n);
+      n = 1;
+    }
+    n_ = n;
+    s_.resize(n + 1);
+    w_.resize(n + 1);
+    for (unsigned i = 0; i <= n; ++i) {
+      s_[i] = std::cos(i * M_PI / n);
+      w_[i] = (i % 2 ? -1 : 1) * (i == 0 || i == n ? 0.5 : 1);
+    }
+  }
+  /** The degree of the interpolation */
+  unsigned get_degree() const {
+    return n_;
+  }
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M,
+                      const point_type& extents, unsigned) const {
+    M.side = extents[0];
+    M.charges.assign((n_+1) * (n_+1) * (n_+1), charge_type(0));
+  }
+
+  /** Kernel evaluation
+   * K(t,s)
+   *
+   * @param[in] t,s The target and source points to evaluate the kernel
+   */
+  kernel_value_type operator()(const target_type& t,
+                               const source_type& s) const {
+    return Kernel::operator()(t, s);
+  }
+
+  /** Kernel P2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] s_begin,s_end Iterator pair to the sources of the box
+   * @param[in] c_begin Iterator to the sources' corresponding charges
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  template <typename SourceIter, typename ChargeIter>
+  void P2M(SourceIter s_begin, SourceIter s_end, ChargeIter c_begin,
+           const point_type& center, multipole_type& M) const {
+    const unsigned m = n_ + 1;
+    std::vector<double> Lx(m), Ly(m), Lz(m);
+    for ( ; s_begin != s_end; ++s_begin, ++c_begin) {
+      const point_type y = (2 / M.side) * (*s_begin - center);
+      lagrange(y[0], Lx);
+      lagrange(y[1], Ly);
+      lagrange(y[2], Lz);
+      for (unsigned i = 0; i < m; ++i)
+        for (unsigned j = 0; j < m; ++j) {
+          const double Lxy = Lx[i] * Ly[j];
+          charge_type* q = &M.charges[(i*m + j)*m];
+          for (unsigned k = 0; k < m; ++k)
+            q[k] += (*c_begin) * (Lxy * Lz[k]);
+        }
+    }
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    const unsigned m = n_ + 1;
+    // T[d][a*m + i]: Lagrange polynomial a of the parent at the child's
+    // point i in dimension d
+    std::vector<double> T[dimension];
+    std::vector<double> L(m);
+    for (unsigned d = 0; d < dimension; ++d) {
+      T[d].resize(m * m);
+      const double offset = -2 * translation[d] / Mtarget.side;
+      const double scale = Msource.side / Mtarget.side;
+      for (unsigned i = 0; i < m; ++i) {
+        lagrange(offset + scale * s_[i], L);
+        for (unsigned a = 0; a < m; ++a)
+          T[d][a*m + i] = L[a];
+      }
+    }
+
+    // Contract the child's grid (i,j,k) one dimension at a time
+    std::vector<charge_type> Q1(m*m*m, charge_type(0));
+    std::vector<charge_type> Q2(m*m*m, charge_type(0));
+    const std::vector<charge_type>& Q0 = Msource.charges;
+    for (unsigned i = 0; i < m; ++i)
+      for (unsigned j = 0; j < m; ++j)
+        for (unsigned c = 0; c < m; ++c) {
+          charge_type q = charge_type(0);
+          for (unsigned k = 0; k < m; ++k)
+            q += Q0[(i*m + j)*m + k] * T[2][c*m + k];
+          Q1[(i*m + j)*m + c] = q;
+        }
+    for (unsigned i = 0; i < m; ++i)
+      for (unsigned b = 0; b < m; ++b)
+        for (unsigned j = 0; j < m; ++j) {
+          const double t = T[1][b*m + j];
+          for (unsigned c = 0; c < m; ++c)
+            Q2[(i*m + b)*m + c] += Q1[(i*m + j)*m + c] * t;
+        }
+    for (unsigned a = 0; a < m; ++a)
+      for (unsigned i = 0; i < m; ++i) {
+        const double t = T[0][a*m + i];
+        for (unsigned bc = 0; bc < m*m; ++bc)
+          Mtarget.charges[a*m*m + bc] += Q2[i*m*m + bc] * t;
+      }
+  }
+
+  /** Kernel M2P operation
+   * r += Op(M, t) where M is the multipole and r is the result
+   *
+   * @param[in] M The multpole expansion
+   * @param[in] center The center of the box with the multipole expansion
+   * @param[in] t_begin,t_end Iterator pair to the targets
+   * @param[in] r_begin Iterator to the targets' corresponding results
+   * @pre M includes the influence of all sources within its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void M2P(const multipole_type& M, const point_type& center,
+           TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    const unsigned m = n_ + 1;
+    const double h = M.side / 2;
+    std::vector<point_type> proxies;
+    proxies.reserve(m*m*m);
+    for (unsigned i = 0; i < m; ++i)
+      for (unsigned j = 0; j < m; ++j)
+        for (unsigned k = 0; k < m; ++k)
+          proxies.push_back(center + point_type(h*s_[i], h*s_[j], h*s_[k]));
+
+    for ( ; t_begin != t_end; ++t_begin, ++r_begin) {
+      result_type r = result_type(0);
+      for (unsigned p = 0; p < proxies.size(); ++p)
+        r += (*this)(*t_begin, proxies[p]) * M.charges[p];
+      *r_begin += r;
+    }
+  }
+
+ private:
+
+  /** The Lagrange polynomials of the Chebyshev points at x in [-1,1] */
+  void lagrange(double x, std::vector<double>& L) const {
+    double sum = 0;
+    for (unsigned i = 0; i <= n_; ++i) {
+      const double dx = x - s_[i];
+      if (std::abs(dx) < 1e-14) {
+        // x is a Chebyshev point
+        std::fill(L.begin(), L.end(), 0);
+        L[i] = 1;
+        return;
+      }
+      L[i] = w_[i] / dx;
+      sum += L[i];
+    }
+    for (unsigned i = 0; i <= n_; ++i)
+      L[i] /= sum;
+  }
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+/**
+ * Block sparse matrix of dense leaf-to-leaf blocks
+ *
+ * Every block couples a contiguous range of rows (the targets of a leaf) with
+ * a contiguous range of columns (the sources of a leaf) and is stored dense
+ * and row-major, so no column index is stored per entry.
+ * Blocks are grouped by their row range: the blocks of group g are
+ * blocks[group_offsets[g]] to blocks[group_offsets[g+1]].
+ */
+
+#include <vector>
+#include <cstddef>
+
+template <typename T>
+struct BlockSparseMatrix
+{
+  typedef T value_type;
+
+  struct block {
+    unsigned row_begin, rows;
+    unsigned col_begin, cols;
+    //! Offset of the first value of this block
+    std::size_t offset;
+  };
+
+  // data
+  unsigned rows, cols;
+  std::vector<unsigned> group_offsets;
+  std::vector<block> blocks;
+  std::vector<T> vals;
+
+  // default constructor
+  BlockSparseMatrix() : rows(0), cols(0), group_offsets(1, 0) {};
+  // copy with the values converted to T, e.g. to single precision
+  template <typename U>
+  explicit BlockSparseMatrix(const BlockSparseMatrix<U>& m)
+      : rows(m.rows), cols(m.cols), group_offsets(m.group_offsets),
+        vals(m.vals.begin(), m.vals.end()) {
+    blocks.resize(m.blocks.size());
+    for (unsigned k = 0; k < blocks.size(); ++k) {
+      blocks[k].row_begin = m.blocks[k].row_begin;
+      blocks[k].rows      = m.blocks[k].rows;
+      blocks[k].col_begin = m.blocks[k].col_begin;
+      blocks[k].cols      = m.blocks[k].cols;
+      blocks[k].offset    = m.blocks[k].offset;
+    }
+  }
+
+  // number of stored values
+  std::size_t nnz() const {
+    return vals.size();
+  }
+
+  // number of groups of blocks with the same rows
+  unsigned groups() const {
+    return group_offsets.size() - 1;
+  }
+
+  // return storage size in bytes
+  std::size_t storage_size() const
+  {
+    auto index_storage = group_offsets.size()*sizeof(unsigned)
+                       + blocks.size()*sizeof(block);
+    auto value_storage = vals.size() * sizeof(T);
+    return index_storage + value_storage;
+  }
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+/**
+ * Contiguous, aligned storage for the expansion coefficients of all boxes
+ *
+ * Every box gets a slot of a fixed number of bytes (the stride) at offset
+ * box.index() * stride. Boxes are numbered level by level, so the slots of a
+ * level are contiguous as well and a level-wise pass (M2M, L2L) streams
+ * through one range of memory.
+ * The buffer is only reallocated when it has to grow, so changing the
+ * expansion order (and with it the stride) between evaluations does not
+ * allocate. Large buffers can optionally be backed by transparent huge pages.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+class ExpansionArena
+{
+  //! Alignment of the buffer and of every slot (a cache line)
+  static constexpr std::size_t alignment = 64;
+  //! Size of a transparent huge page
+  static constexpr std::size_t huge_page = std::size_t(2) << 20;
+
+  char* data_;
+  std::size_t capacity_;
+  std::size_t stride_;
+  std::size_t slots_;
+  bool huge_pages_;
+
+ public:
+  ExpansionArena()
+      : data_(nullptr), capacity_(0), stride_(0), slots_(0),
+        huge_pages_(false) {
+  }
+
+  ~ExpansionArena() {
+    std::free(data_);
+  }
+
+  // Slots are referenced by the expansions bound to them
+  ExpansionArena(const ExpansionArena&) = delete;
+  ExpansionArena& operator=(const ExpansionArena&) = delete;
+
+  /** Lay out slots of (at least) stride bytes
+   * Newly allocated memory is zeroed; existing contents are not preserved.
+   * @returns false if the buffer could not be allocated, the old buffer and
+   *          layout are then unchanged
+   */
+  bool reserve(std::size_t slots, std::size_t stride, bool huge_pages = false) {
+    stride = (stride + alignment - 1) / alignment * alignment;
+    std::size_t size = slots * stride;
+    if (size > capacity_ || huge_pages != huge_pages_) {
+      if (!allocate(size, huge_pages))
+        return false;
+    }
+    stride_ = stride;
+    slots_ = slots;
+    return true;
+  }
+
+  /** The i-th slot, viewed as coefficients of type T */
+  template <typename T>
+  T* slot(std::size_t i) const {
+    return reinterpret_cast<T*>(data_ + i * stride_);
+  }
+
+  std::size_t stride() const {
+    return stride_;
+  }
+  std::size_t slots() const {
+    return slots_;
+  }
+
+  // return storage size in bytes
+  std::size_t storage_size() const {
+    return capacity_;
+  }
+
+ private:
+
+  /** Replace the buffer by a zeroed one of size bytes
+   * If the allocation fails the old buffer and layout are kept, as
+   * expansions may still be bound to them.
+   */
+  bool allocate(std::size_t size, bool huge_pages) {
+    std::size_t align = alignment;
+    if (huge_pages && size >= huge_page) {
+      align = huge_page;
+      size = (size + huge_page - 1) / huge_page * huge_page;
+    }
+
+    void* p = nullptr;
+    if (size != 0 && posix_memalign(&p, align, size) != 0) {
+      printf("[E]: Cannot allocate expansion arena of %lu bytes\n",
+             (unsigned long) size);
+      return false;
+    }
+    if (size != 0) {
+#if defined(MADV_HUGEPAGE)
+      if (align == huge_page)
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+      // First touch, also zeroes expansions that are never initialised
+      std::memset(p, 0, size);
+    }
+
+    std::free(data_);
+    data_ = static_cast<char*>(p);
+    capacity_ = size;
+    huge_pages_ = huge_pages;
+    return true;
+  }
+};
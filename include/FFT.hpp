@@ -0,0 +1,85 @@
+#pragma once
+
+/**
+ * In-place radix-2 complex FFT of the N values a[0], a[stride], ...
+ * for the FFT-based M2L, where:
+ *   N is a power of two,
+ *   sign = -1 is the forward and sign = +1 the (unnormalized) inverse
+ *   transform.
+ */
+
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+template <typename T>
+void fft(std::complex<T>* a, unsigned N, unsigned stride, int sign)
+{
+  // Bit reversal permutation
+  for (unsigned i = 1, j = 0; i < N; ++i) {
+    unsigned bit = N >> 1;
+    for ( ; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap(a[i*stride], a[j*stride]);
+  }
+
+  // Butterflies
+  for (unsigned len = 2; len <= N; len <<= 1) {
+    const T angle = sign * 2 * M_PI / len;
+    const std::complex<T> wlen(std::cos(angle), std::sin(angle));
+    for (unsigned i = 0; i < N; i += len) {
+      std::complex<T> w(1);
+      for (unsigned k = 0; k < len/2; ++k) {
+        std::complex<T>& u = a[(i+k)*stride];
+        std::complex<T>& v = a[(i+k+len/2)*stride];
+        const std::complex<T> t = w * v;
+        v = u - t;
+        u = u + t;
+        w *= wlen;
+      }
+    }
+  }
+}
+
+/**
+ * In-place radix-2 complex FFTs of the count lines a[l], a[stride + l], ...
+ * for l < count, transformed together so that the innermost loop runs
+ * over the lines, contiguous in memory.
+ */
+template <typename T>
+void fft_lines(std::complex<T>* a, unsigned N, unsigned stride,
+               unsigned count, int sign)
+{
+  // Bit reversal permutation of the rows
+  for (unsigned i = 1, j = 0; i < N; ++i) {
+    unsigned bit = N >> 1;
+    for ( ; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap_ranges(a + i*stride, a + i*stride + count, a + j*stride);
+  }
+
+  // Butterflies, with the products spelled out: std::complex products
+  // check for inf and nan
+  for (unsigned len = 2; len <= N; len <<= 1) {
+    const T angle = sign * 2 * M_PI / len;
+    for (unsigned k = 0; k < len/2; ++k) {
+      const T wr = std::cos(angle * k), wi = std::sin(angle * k);
+      for (unsigned i = 0; i < N; i += len) {
+        T* u = reinterpret_cast<T*>(a + (i+k)*stride);
+        T* v = reinterpret_cast<T*>(a + (i+k+len/2)*stride);
+        for (unsigned l = 0; l < 2*count; l += 2) {
+          const T tr = wr * v[l]   - wi * v[l+1];
+          const T ti = wr * v[l+1] + wi * v[l];
+          v[l]   = u[l]   - tr;
+          v[l+1] = u[l+1] - ti;
+          u[l]   += tr;
+          u[l+1] += ti;
+        }
+      }
+    }
+  }
+}
@@ -5,6 +5,8 @@
 
 #include "Vec.hpp"
 
+#include <cstddef>
+
 /** Class to define compile-time and run-time FMM options */
 class FMMOptions
 {
@@ -18,6 +20,32 @@ public:
 	enum EvalType {FMM, TREECODE};
 	EvalType evaluator;
 
+	//! Storage of the sparse near-field matrix
+	enum SparseFormat {CSR, BLOCK};
+	SparseFormat sparse_format;
+	//! Memory budget of the sparse near-field matrix in bytes (0 = unlimited)
+	std::size_t sparse_memory_budget;
+	//! Store the near-field of symmetric kernels once per pair of leaves
+	bool sparse_symmetric;
+	//! Store the expansions of all boxes in one contiguous buffer
+	bool expansion_arena;
+	//! Back the expansion buffer with transparent huge pages
+	bool huge_pages;
+	//! Translate by rotation onto the z-axis (LaplaceSpherical::set_rotation)
+	bool rotated_translations;
+	//! Apply M2L per distinct translation as one dense matrix product
+	bool m2l_batched;
+	//! Apply the M2L of KIFMM.hpp kernels in Fourier space, see EvalM2L_FFT.hpp
+	bool kifmm_fft;
+	//! Apply M2L through plane waves in six directional lists
+	bool m2l_exp;
+	//! Apply M2M and L2L per child octant and level as one matrix product
+	bool m2m_batched;
+	//! Precompute the P2M and L2P of every leaf as dense matrices
+	bool leaf_matrices;
+	//! Evaluate P2P over the sources of every leaf packed as arrays
+	bool p2p_packed;
+
 	struct DefaultMAC {
 		double theta_;
 		DefaultMAC(double theta) : theta_(theta) {}
@@ -43,6 +71,18 @@ public:
       sparse_local(false),
       block_diagonal(false),
 		  evaluator(FMM),
+		  sparse_format(CSR),
+		  sparse_memory_budget(0),
+		  sparse_symmetric(false),
+		  expansion_arena(false),
+		  huge_pages(false),
+		  rotated_translations(false),
+		  m2l_batched(false),
+		  kifmm_fft(true),
+		  m2l_exp(false),
+		  m2m_batched(false),
+		  leaf_matrices(false),
+		  p2p_packed(false),
 		  MAC_(DefaultMAC(0.5)),
 		  NCRIT_(64),
 		  printTree(false) {
@@ -94,6 +134,38 @@ FMMOptions get_options(int argc, char** argv) {
 			}
 		} else if (strcmp(argv[i],"-lazy_eval") == 0) {
 			opts.lazy_evaluation = true;
+		} else if (strcmp(argv[i],"-sparse_format") == 0) {
+			i++;
+			if (strcmp(argv[i],"CSR") == 0) {
+				opts.sparse_format = FMMOptions::CSR;
+			} else if (strcmp(argv[i],"BLOCK") == 0) {
+				opts.sparse_format = FMMOptions::BLOCK;
+			} else {
+				printf("[W]: Unknown sparse format: \"%s\"\n",argv[i]);
+			}
+		} else if (strcmp(argv[i],"-sparse_budget") == 0) {
+			i++;
+			opts.sparse_memory_budget = (std::size_t)(atof(argv[i]) * 1024 * 1024);
+		} else if (strcmp(argv[i],"-sparse_symmetric") == 0) {
+			opts.sparse_symmetric = true;
+		} else if (strcmp(argv[i],"-expansion_arena") == 0) {
+			opts.expansion_arena = true;
+		} else if (strcmp(argv[i],"-huge_pages") == 0) {
+			opts.huge_pages = true;
+		} else if (strcmp(argv[i],"-rotate") == 0) {
+			opts.rotated_translations = true;
+		} else if (strcmp(argv[i],"-m2l_batched") == 0) {
+			opts.m2l_batched = true;
+		} else if (strcmp(argv[i],"-kifmm_direct") == 0) {
+			opts.kifmm_fft = false;
+		} else if (strcmp(argv[i],"-m2l_exp") == 0) {
+			opts.m2l_exp = true;
+		} else if (strcmp(argv[i],"-m2m_batched") == 0) {
+			opts.m2m_batched = true;
+		} else if (strcmp(argv[i],"-leaf_matrices") == 0) {
+			opts.leaf_matrices = true;
+		} else if (strcmp(argv[i],"-p2p_packed") == 0) {
+			opts.p2p_packed = true;
 		} else if (strcmp(argv[i],"-ncrit") == 0) {
 			i++;
 			opts.set_max_per_box((unsigned)atoi(argv[i]));
@@ -5,9 +5,12 @@
 
 #include "FMMOptions.hpp"
 #include "KernelTraits.hpp"
+#include "KIFMM.hpp"
 #include "Logger.hpp"
 
 #include "executor/make_executor.hpp"
+#include "executor/ExecutorStreaming.hpp"
+#include "executor/ExecutorMovingTargets.hpp"
 
 //! global logging
 Logger Log;
@@ -16,7 +19,9 @@ template <class Kernel>
 class FMM_plan
 {
  public:
-	typedef Kernel kernel_type;
+	// Kernels with only a pointwise operator() get kernel-independent
+	// expansions, see KIFMM.hpp
+	typedef typename ExpansionKernel<Kernel>::type kernel_type;
 
   typedef typename kernel_type::point_type point_type;
 	typedef typename kernel_type::source_type source_type;
@@ -31,11 +36,12 @@ class FMM_plan
 
 	// CONSTRUCTOR
 
-	FMM_plan(const kernel_type& k,
+	FMM_plan(const Kernel& k,
 	         const std::vector<source_type>& source,
 	         FMMOptions& opts)
-      : K(k), opts_(opts) {
+      : subset_eval_(nullptr), moving_(nullptr), K(k), opts_(opts) {
 		check_kernel();
+		set_rotation(K, opts_.rotated_translations, 0);
 
 		executor_ = make_executor(K,
 		                          source.begin(), source.end(),
@@ -46,8 +52,9 @@ class FMM_plan
 	         const std::vector<source_type>& source,
 	         const std::vector<target_type>& target,
 	         FMMOptions& opts)
-      : K(k), opts_(opts) {
+      : subset_eval_(nullptr), moving_(nullptr), K(k), opts_(opts) {
 		check_kernel();
+		set_rotation(K, opts_.rotated_translations, 0);
 
 		executor_ = make_executor(K,
 		                          source.begin(), source.end(),
@@ -58,6 +65,8 @@ class FMM_plan
 	// DESTRUCTOR
 
 	~FMM_plan() {
+		delete subset_eval_;
+		delete moving_;
 		delete executor_;
 	}
 
@@ -89,6 +98,141 @@ class FMM_plan
 		return results;
 	}
 
+  /** Execute the plan for a subset of the targets only
+   * @param[in] target_mask true for every target (in original order) whose
+   *                        result is requested
+   * Only leaves containing requested targets are evaluated, results of all
+   * other targets in the returned vector are left at zero.
+   * The interaction lists for the subset are cached until the mask changes.
+   */
+  std::vector<result_type> execute(const std::vector<charge_type>& charges,
+                                   const std::vector<bool>& target_mask)
+  {
+		if (!executor_) {
+			printf("[E]: Executor not initialised -- returning..\n");
+			return std::vector<result_type>(0);
+		}
+    if (target_mask.size() != charges.size()) {
+      printf("[E]: Target mask has %zu entries for %zu charges -- returning..\n",
+             target_mask.size(), charges.size());
+      return std::vector<result_type>(0);
+    }
+
+    if (!subset_eval_ || target_mask != subset_mask_) {
+      delete subset_eval_;
+      subset_mask_ = target_mask;
+      subset_eval_ = make_subset_eval(*executor_, opts_, subset_mask_);
+    }
+
+		std::vector<result_type> results(charges.size());
+    if (subset_eval_)
+      executor_->execute(charges, results, *subset_eval_);
+
+		return results;
+  }
+
+  /** Execute the plan for the targets with the given (original) indices only
+   */
+  std::vector<result_type> execute(const std::vector<charge_type>& charges,
+                                   const std::vector<unsigned>& target_ids)
+  {
+    std::vector<bool> target_mask(charges.size(), false);
+    for (auto it = target_ids.begin(); it != target_ids.end(); ++it) {
+      if (*it >= target_mask.size()) {
+        printf("[E]: Target id %u out of range [0,%zu) -- returning..\n",
+               *it, target_mask.size());
+        return std::vector<result_type>(0);
+      }
+      target_mask[*it] = true;
+    }
+
+    return execute(charges, target_mask);
+  }
+
+  /** Evaluate the field of the sources at an arbitrary set of targets
+   * @param[in] first,last Forward iterators over the targets
+   * @param[out] out Output iterator the results are written to, in order
+   * @param[in] chunk_size Number of targets held in memory at once
+   *
+   * The source tree and its multipole expansions are formed once and reused
+   * for all chunks. Each chunk of targets is binned into its own target tree,
+   * evaluated with M2L/M2P and P2P, and written out before the next chunk is
+   * read, so the memory used is bounded by the chunk size.
+   */
+  template <typename TargetIter, typename ResultIter>
+  ResultIter evaluate(const std::vector<charge_type>& charges,
+                      TargetIter first, TargetIter last, ResultIter out,
+                      unsigned chunk_size = 1 << 20)
+  {
+		if (!executor_) {
+			printf("[E]: Executor not initialised -- returning..\n");
+			return out;
+		}
+
+    // Form all multipole expansions of the source tree
+    std::vector<result_type> no_results;
+    EvalUpward<executor_type, false> upward;
+    executor_->execute(charges, no_results, upward);
+
+    ExecutorStreaming<executor_type> stream(*executor_, opts_);
+    while (first != last) {
+      TargetIter chunk_last = first;
+      for (unsigned n = 0; n < chunk_size && chunk_last != last; ++n)
+        ++chunk_last;
+
+      out = stream.execute(first, chunk_last, out);
+      first = chunk_last;
+    }
+    return out;
+  }
+
+  /** Start tracking a set of moving targets in the field of the sources
+   * @param[in] charges The charges of the sources, kept until the next call
+   * @param[in] first,last Forward iterators over the initial targets
+   * @returns The results at the initial targets
+   *
+   * The local expansions of the targets' tree are kept, so that following
+   * calls to move_targets only need L2P and P2P at the new positions.
+   */
+  template <typename TargetIter>
+  std::vector<result_type> track_targets(const std::vector<charge_type>& charges,
+                                         TargetIter first, TargetIter last)
+  {
+		if (!executor_) {
+			printf("[E]: Executor not initialised -- returning..\n");
+			return std::vector<result_type>(0);
+		}
+
+    // Form all multipole expansions of the source tree
+    tracked_charges_ = charges;
+    std::vector<result_type> no_results;
+    EvalUpward<executor_type, false> upward;
+    executor_->execute(tracked_charges_, no_results, upward);
+
+    delete moving_;
+    moving_ = new ExecutorMovingTargets<executor_type>(*executor_, opts_);
+
+    std::vector<result_type> results(std::distance(first, last));
+    moving_->execute(first, last, results.begin());
+    return results;
+  }
+
+  /** Evaluate the field at the new positions of the tracked targets
+   * @param[in] first,last The moved targets, in the order given to track_targets
+   */
+  template <typename TargetIter>
+  std::vector<result_type> move_targets(TargetIter first, TargetIter last)
+  {
+    if (!moving_) {
+      printf("[E]: No targets tracked -- returning..\n");
+      return std::vector<result_type>(0);
+    }
+
+    std::vector<result_type> results(std::distance(first, last));
+    moving_->move(first, last, results.begin());
+    return results;
+  }
+
   /** Access to the Options this plan is operating with
    */
   FMMOptions& options() {
@@ -109,9 +253,27 @@ class FMM_plan
  private:
 	// ExecutorBase<kernel_type>* executor_;
   executor_type *executor_;
+  //! Cached evaluator and mask of the last target-subset execution
+  EvaluatorBase<executor_type> *subset_eval_;
+  std::vector<bool> subset_mask_;
+  //! Tracked moving targets and the charges of their field
+  ExecutorMovingTargets<executor_type> *moving_;
+  std::vector<charge_type> tracked_charges_;
 	kernel_type K;
 	FMMOptions opts_;
 
+	/** Switch a kernel with set_rotation to rotated translations */
+	template <typename Kern>
+	static auto set_rotation(Kern& k, bool rotate, int)
+	    -> decltype(k.set_rotation(rotate)) {
+		return k.set_rotation(rotate);
+	}
+	template <typename Kern>
+	static void set_rotation(Kern&, bool rotate, long) {
+		if (rotate)
+			printf("[W]: Kernel has no rotated translations -- ignoring\n");
+	}
+
 	void check_kernel() {
 		if (opts_.evaluator == FMMOptions::FMM &&
 		    !ExpansionTraits<kernel_type>::is_valid_fmm) {
@@ -0,0 +1,57 @@
+#pragma once
+
+/**
+ * Multithreaded dense matrix-matrix product for the batched translations:
+ *   A is an m x k matrix, B is k x n and C is m x n,
+ *   all column-major and contiguous.
+ * C += A * B
+ *
+ * The columns of C are split into blocks over the threads. Within a block,
+ * a panel of columns of A is reused for four columns of C at a time.
+ */
+
+#include <algorithm>
+
+template <typename T>
+void Gemm(unsigned m, unsigned n, unsigned k,
+          const T* A, const T* B, T* C)
+{
+  // Columns of C per block and columns of A per panel
+  const unsigned NB = 16, KB = 64;
+  const int blocks = (n + NB - 1) / NB;
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < blocks; ++blk) {
+    const unsigned j0 = blk * NB, j1 = std::min(n, j0 + NB);
+    for (unsigned p0 = 0; p0 < k; p0 += KB) {
+      const unsigned p1 = std::min(k, p0 + KB);
+      unsigned j = j0;
+      for ( ; j + 4 <= j1; j += 4) {
+        T* c0 = C + j*m;
+        T* c1 = c0 + m;
+        T* c2 = c1 + m;
+        T* c3 = c2 + m;
+        for (unsigned p = p0; p < p1; ++p) {
+          const T* a = A + p*m;
+          const T b0 = B[p + j*k],     b1 = B[p + (j+1)*k];
+          const T b2 = B[p + (j+2)*k], b3 = B[p + (j+3)*k];
+          for (unsigned i = 0; i < m; ++i) {
+            const T ai = a[i];
+            c0[i] += ai * b0;
+            c1[i] += ai * b1;
+            c2[i] += ai * b2;
+            c3[i] += ai * b3;
+          }
+        }
+      }
+      for ( ; j < j1; ++j) {
+        T* c = C + j*m;
+        for (unsigned p = p0; p < p1; ++p) {
+          const T* a = A + p*m;
+          const T b = B[p + j*k];
+          for (unsigned i = 0; i < m; ++i)
+            c[i] += a[i] * b;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,805 @@
+#pragma once
+/** @file KIFMM.hpp
+ * @brief Kernel-independent expansions of any kernel with a pointwise
+ * operator()
+ *
+ * The field of the sources of a box is represented by densities at points
+ * on a cube surface around the box, the equivalent surface, that reproduce
+ * the field of the sources at points on a larger or smaller cube surface,
+ * the check surface. Only evaluations of the kernel are needed:
+ *   P2M: field of the sources on the upward check surface (radius 2.95),
+ *        then the upward check-to-equivalent solve to the upward
+ *        equivalent densities (radius 1.05)
+ *   M2M: the same from the child equivalent densities, as a matrix per
+ *        octant and level
+ *   M2L: field of the equivalent densities on the downward check surface
+ *        of the target (radius 1.05), then the downward check-to-equivalent
+ *        solve to the downward equivalent densities (radius 2.95); between
+ *        boxes of one side a convolution, applied in Fourier space by
+ *        the lazy evaluators unless -kifmm_direct (see M2L_fft_size and
+ *        EvalM2L_FFT.hpp)
+ *   L2L: the same from the parent downward densities, as a matrix per octant
+ *        and level
+ *   M2P, L2P: field of the equivalent densities at the targets
+ * where the radii are relative to half the side of the box. The
+ * check-to-equivalent solves are least squares, applied as the pseudo-inverse
+ * of the kernel matrices between the surfaces, computed once per level.
+ *
+ * The kernel is assumed to be translation-invariant and smooth away from the
+ * origin (a Green's function of an elliptic PDE, like Laplace, Yukawa or
+ * Stokes). Charges and results are reals or Vecs of reals; the product of a
+ * kernel value and a charge is the result.
+ *
+ * Reference:
+ *   L. Ying, G. Biros, D. Zorin, "A kernel-independent adaptive fast
+ *   multipole algorithm in two and three dimensions", J. Comput. Phys. 2004
+ */
+
+#include "Vec.hpp"
+#include "Gemm.hpp"
+#include "FFT.hpp"
+
+#include <map>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <complex>
+#include <algorithm>
+#include <type_traits>
+
+
+/** Access to the real components of the charges and results */
+template <typename T>
+struct KIFMMComponents {
+  static constexpr unsigned size = 1;
+  static double get(const T& t, unsigned) {
+    return t;
+  }
+  static void add(T& t, unsigned, double v) {
+    t += v;
+  }
+};
+template <std::size_t N, typename T>
+struct KIFMMComponents<Vec<N,T>> {
+  static constexpr unsigned size = N;
+  static double get(const Vec<N,T>& t, unsigned k) {
+    return t[k];
+  }
+  static void add(Vec<N,T>& t, unsigned k, double v) {
+    t[k] += v;
+  }
+};
+
+
+template <typename Kernel>
+class KIFMM : public Kernel
+{
+ public:
+  //! The pointwise kernel
+  typedef Kernel base_kernel_type;
+
+  //! The dimension of the Kernel
+  static constexpr unsigned dimension = 3;
+  static_assert(Kernel::dimension == dimension, "KIFMM is three-dimensional");
+  //! Point type
+  typedef typename Kernel::point_type point_type;
+  //! Source type
+  typedef typename Kernel::source_type source_type;
+  //! Target type
+  typedef typename Kernel::target_type target_type;
+  //! Charge type
+  typedef typename Kernel::charge_type charge_type;
+  //! The return type of a kernel evaluation
+  typedef typename Kernel::kernel_value_type kernel_value_type;
+  //! The product of the kernel_value_type and the charge_type
+  typedef typename Kernel::result_type result_type;
+
+  /** Equivalent densities of a box */
+  struct expansion_type {
+    //! Side of the box
+    double side;
+    //! C components per point of the equivalent surface
+    std::vector<double> density;
+  };
+  //! Multipole expansion type, the upward equivalent densities
+  typedef expansion_type multipole_type;
+  //! Local expansion type, the downward equivalent densities
+  typedef expansion_type local_type;
+  //! Fourier coefficient type of the FFT-based M2L
+  typedef std::complex<double> fft_type;
+
+ private:
+  typedef KIFMMComponents<charge_type> charge_components;
+  typedef KIFMMComponents<result_type> result_components;
+  //! Components of a charge and of a result
+  static constexpr unsigned C = charge_components::size;
+  static constexpr unsigned R = result_components::size;
+
+  //! Radii of the surfaces, relative to half the side of the box
+  static constexpr double UPWARD_EQUIVALENT   = 1.05;
+  static constexpr double UPWARD_CHECK        = 2.95;
+  static constexpr double DOWNWARD_EQUIVALENT = 2.95;
+  static constexpr double DOWNWARD_CHECK      = 1.05;
+  //! Singular values below EPS * the largest are dropped by the solves
+  static constexpr double EPS = 1e-12;
+
+  //! Points per edge of the surfaces
+  unsigned n_;
+  //! Points of the surface of [-1,1]^3, n_ per edge
+  std::vector<point_type> surface_;
+  //! Lattice coordinates of the surface points, (i*n_ + j)*n_ + k
+  std::vector<unsigned> lattice_;
+
+  /** The operators of the boxes of one side
+   * Matrices are row-major, densities are (point, component).
+   */
+  struct level_operators {
+    //! Upward check potentials to upward equivalent densities
+    std::vector<double> UC2E;
+    //! Downward check potentials to downward equivalent densities
+    std::vector<double> DC2E;
+    //! Child to parent upward densities, by octant of the child
+    std::vector<double> M2M[8];
+    //! Parent to child downward densities, by octant of the child
+    std::vector<double> L2L[8];
+    bool shifts;
+    level_operators() : shifts(false) {}
+  };
+  //! The operators by side of the box
+  mutable std::map<double, level_operators> operators_;
+
+ public:
+  //! Constructor
+  KIFMM(const Kernel& K = Kernel(), unsigned n = 6)
+      : Kernel(K) {
+    set_order(n);
+  }
+
+  /** Set the number of points per edge of the surfaces, at least 2
+   * The surfaces have 6(n-1)^2+2 points.
+   */
+  void set_order(unsigned n) {
+    if (n < 2) {
+      printf("[W]: KIFMM order %u too low -- using 2\n", n);
+      n = 2;
+    }
+    n_ = n;
+    surface_.clear();
+    lattice_.clear();
+    for (unsigned i = 0; i < n; ++i)
+      for (unsigned j = 0; j < n; ++j)
+        for (unsigned k = 0; k < n; ++k)
+          if (i == 0 || i == n-1 || j == 0 || j == n-1 || k == 0 || k == n-1) {
+            surface_.push_back(point_type(-1 + 2.0*i/(n-1),
+                                          -1 + 2.0*j/(n-1),
+                                          -1 + 2.0*k/(n-1)));
+            lattice_.push_back((i*n + j)*n + k);
+          }
+    operators_.clear();
+  }
+  /** The number of points per edge of the surfaces */
+  unsigned get_order() const {
+    return n_;
+  }
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M,
+                      const point_type& extents, unsigned) const {
+    M.side = extents[0];
+    M.density.assign(surface_.size() * C, 0);
+  }
+  /** Initialize a local expansion with the size of a box at this level */
+  void init_local(local_type& L,
+                  const point_type& extents, unsigned) const {
+    L.side = extents[0];
+    L.density.assign(surface_.size() * C, 0);
+  }
+
+  /** Kernel evaluation
+   * K(t,s)
+   *
+   * @param[in] t,s The target and source points to evaluate the kernel
+   */
+  kernel_value_type operator()(const target_type& t,
+                               const source_type& s) const {
+    return Kernel::operator()(t, s);
+  }
+
+  /** Kernel P2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] s_begin,s_end Iterator pair to the sources of the box
+   * @param[in] c_begin Iterator to the sources' corresponding charges
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  template <typename SourceIter, typename ChargeIter>
+  void P2M(SourceIter s_begin, SourceIter s_end, ChargeIter c_begin,
+           const point_type& center, multipole_type& M) const {
+    const std::vector<point_type> check =
+        surface(center, M.side, UPWARD_CHECK);
+    std::vector<double> potential(check.size() * R, 0);
+    for ( ; s_begin != s_end; ++s_begin, ++c_begin)
+      for (unsigned i = 0; i < check.size(); ++i)
+        add_result(potential, i, (*this)(check[i], *s_begin) * (*c_begin));
+
+    const level_operators& ops = operators(M.side);
+    multiply(ops.UC2E, potential, M.density);
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    const level_operators& ops = operators(Msource.side, true);
+    multiply(ops.M2M[octant(-translation)], Msource.density, Mtarget.density);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] M The multpole expansion source
+   * @param[in,out] L The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2L(const multipole_type& M,
+           local_type& L,
+           const point_type& translation) const {
+    const std::vector<point_type> equivalent =
+        surface(point_type(0), M.side, UPWARD_EQUIVALENT);
+    const std::vector<point_type> check =
+        surface(translation, L.side, DOWNWARD_CHECK);
+    std::vector<double> potential(check.size() * R, 0);
+    field(equivalent, M.density, check.begin(), check.end(),
+          potential_iterator(potential));
+
+    const level_operators& ops = operators(L.side);
+    multiply(ops.DC2E, potential, L.density);
+  }
+
+  /** FFT-based M2L, see EvalM2L_FFT.hpp
+   * The upward equivalent points of the source and the downward check points
+   * of the target lie on one lattice of spacing h = 1.05 side / (n-1), for
+   * the smaller side, if the sides are equal or one is twice the other. The
+   * points of the larger box are every other lattice point. With s and t the
+   * strides of the source and the target points in the lattice, the field at
+   * check point i of the densities q_j is then the convolution
+   *   sum_j K(t' + h (t i - s j)) q_j
+   * where t' is the translation between the corners of the surfaces. It is a
+   * pointwise product over an N^3 grid, N >= (s + t)(n-1) + 1 so that the
+   * differences do not wrap around. Only the half spectrum of the real grids
+   * is kept. The transforms are C x R matrices from the C components of the
+   * charges to the R of the results.
+   */
+  unsigned M2L_fft_size(double source_side, double target_side) const {
+    const unsigned N = fft_grid(source_side, target_side);
+    return N * N * (N/2 + 1);
+  }
+  unsigned M2L_fft_charges() const {
+    return C;
+  }
+  unsigned M2L_fft_results() const {
+    return R;
+  }
+  /** Transform of the upward equivalent densities, q_j at s j */
+  void M2L_fft_multipole(const multipole_type& M, double source_side,
+                         double target_side, fft_type* Mhat) const {
+    const unsigned N = fft_grid(source_side, target_side);
+    const unsigned s = stride(source_side, target_side);
+    const unsigned end = s * (n_-1);
+    std::vector<double> grid(N*N*N);
+    for (unsigned c = 0; c < C; ++c) {
+      std::fill(grid.begin(), grid.end(), 0);
+      for (unsigned i = 0; i < surface_.size(); ++i)
+        grid[grid_index(i, s, N)] = M.density[i*C + c];
+      fft_forward(grid.data(), N, [end](unsigned i) { return i <= end; },
+                  Mhat + c * N*N*(N/2 + 1));
+    }
+  }
+  /** Transform of the kernel at the translation, K(t' + h d) at d mod N */
+  void M2L_fft_translation(const point_type& translation, double source_side,
+                           double target_side, fft_type* That) const {
+    static_assert(UPWARD_EQUIVALENT == DOWNWARD_CHECK,
+                  "The FFT-based M2L needs one lattice for both surfaces");
+    const unsigned N = fft_grid(source_side, target_side);
+    const int s = stride(source_side, target_side);
+    const int t = stride(target_side, source_side);
+    const int m = n_ - 1;
+    const double h = UPWARD_EQUIVALENT * std::min(source_side, target_side) / m;
+    const point_type corner = translation - (UPWARD_EQUIVALENT / 2) *
+        (target_side - source_side) * point_type(1, 1, 1);
+    // Normalize the inverse transform here, once per translation
+    const double scale = 1.0 / (N*N*N);
+    std::vector<double> grid(R * C * N*N*N, 0);
+    for (int i = -s*m; i <= t*m; ++i)
+      for (int j = -s*m; j <= t*m; ++j)
+        for (int k = -s*m; k <= t*m; ++k) {
+          const point_type d(i, j, k);
+          const kernel_value_type v = (*this)(corner + h * d, point_type(0));
+          const unsigned g = (((i+N)%N)*N + (j+N)%N)*N + (k+N)%N;
+          for (unsigned c = 0; c < C; ++c) {
+            charge_type e = charge_type(0);
+            charge_components::add(e, c, scale);
+            const result_type r = v * e;
+            for (unsigned q = 0; q < R; ++q)
+              grid[(q*C + c)*N*N*N + g] = result_components::get(r, q);
+          }
+        }
+    const int lo = N - s*m, hi = t*m;
+    for (unsigned qc = 0; qc < R*C; ++qc)
+      fft_forward(&grid[qc*N*N*N], N,
+                  [lo, hi](int i) { return i <= hi || i >= lo; },
+                  That + qc * N*N*(N/2 + 1));
+  }
+  /** Accumulate the local expansion of the field Lhat at the check points,
+   * at t i in the grid
+   */
+  void M2L_fft_local(const fft_type* Lhat, double source_side,
+                     double target_side, local_type& L) const {
+    const unsigned N = fft_grid(source_side, target_side), H = N/2 + 1;
+    const unsigned t = stride(target_side, source_side);
+    const unsigned end = t * (n_-1);
+    std::vector<double> potential(surface_.size() * R);
+    std::vector<fft_type> half(N*N*H), line(N);
+    std::vector<double> grid(N*N*N);
+    for (unsigned q = 0; q < R; ++q) {
+      // Inverse transform, only along the lines through the check points
+      std::copy(Lhat + q*N*N*H, Lhat + (q+1)*N*N*H, half.begin());
+      fft_lines(half.data(), N, N*H, N*H, 1);
+      for (unsigned i = 0; i <= end; i += t)
+        fft_lines(&half[i*N*H], N, H, H, 1);
+      for (unsigned i = 0; i <= end; i += t)
+        for (unsigned j = 0; j <= end; j += t) {
+          // The lines of a real grid are Hermitian
+          const fft_type* h = &half[(i*N + j)*H];
+          std::copy(h, h + H, line.begin());
+          for (unsigned k = H; k < N; ++k)
+            line[k] = std::conj(h[N-k]);
+          fft(line.data(), N, 1, 1);
+          for (unsigned k = 0; k <= end; k += t)
+            grid[(i*N + j)*N + k] = line[k].real();
+        }
+      for (unsigned i = 0; i < surface_.size(); ++i)
+        potential[i*R + q] = grid[grid_index(i, t, N)];
+    }
+
+    const level_operators& ops = operators(L.side);
+    multiply(ops.DC2E, potential, L.density);
+  }
+
+  /** Kernel M2P operation
+   * r += Op(M, t) where M is the multipole and r is the result
+   *
+   * @param[in] M The multpole expansion
+   * @param[in] center The center of the box with the multipole expansion
+   * @param[in] t_begin,t_end Iterator pair to the targets
+   * @param[in] r_begin Iterator to the targets' corresponding results
+   * @pre M includes the influence of all sources within its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void M2P(const multipole_type& M, const point_type& center,
+           TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    field(surface(center, M.side, UPWARD_EQUIVALENT), M.density,
+          t_begin, t_end, r_begin);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    const level_operators& ops = operators(Ltarget.side, true);
+    multiply(ops.L2L[octant(translation)], Lsource.density, Ltarget.density);
+  }
+
+  /** Kernel L2P operation
+   * r += Op(L, t) where L is the local expansion and r is the result
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_begin,t_end Iterator pair to the targets
+   * @param[in] r_begin Iterator to the targets' corresponding results
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2P(const local_type& L, const point_type& center,
+           TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    field(surface(center, L.side, DOWNWARD_EQUIVALENT), L.density,
+          t_begin, t_end, r_begin);
+  }
+
+ private:
+
+  /** The surface points of a box of the given center and side */
+  std::vector<point_type> surface(const point_type& center, double side,
+                                  double radius) const {
+    std::vector<point_type> points(surface_.size());
+    for (unsigned i = 0; i < surface_.size(); ++i)
+      points[i] = center + (radius * side / 2) * surface_[i];
+    return points;
+  }
+
+  /** Whether a side is twice another, or equal to it */
+  static bool twice(double a, double b) {
+    return std::abs(a - 2*b) <= 1e-12 * a;
+  }
+  static bool equal(double a, double b) {
+    return std::abs(a - b) <= 1e-12 * a;
+  }
+  /** Stride of the points of a box of side a in the lattice of the pair */
+  static unsigned stride(double a, double b) {
+    return twice(a, b) ? 2 : 1;
+  }
+  /** Side of the grids of the FFT-based M2L between boxes of the sides,
+   * 0 if the sides are neither equal nor one twice the other
+   */
+  unsigned fft_grid(double source_side, double target_side) const {
+    if (!equal(source_side, target_side) &&
+        !twice(source_side, target_side) && !twice(target_side, source_side))
+      return 0;
+    const unsigned span = (stride(source_side, target_side) +
+                           stride(target_side, source_side)) * (n_-1) + 1;
+    unsigned N = 2;
+    while (N < span)
+      N *= 2;
+    return N;
+  }
+  /** Index in the N^3 grid of the i-th surface point at the stride */
+  unsigned grid_index(unsigned i, unsigned stride, unsigned N) const {
+    const unsigned n = n_, l = lattice_[i];
+    return ((stride*(l/(n*n)))*N + stride*(l/n%n))*N + stride*(l%n);
+  }
+
+  /** The half spectrum of the real N^3 grid, with the last frequency in
+   * [0, N/2], where only the indices i in_support of the first two
+   * dimensions can be nonzero
+   */
+  template <typename Support>
+  static void fft_forward(const double* grid, unsigned N, Support in_support,
+                          fft_type* half) {
+    const unsigned H = N/2 + 1;
+    std::fill(half, half + N*N*H, fft_type(0));
+    std::vector<fft_type> line(N);
+    for (unsigned i = 0; i < N; ++i) {
+      if (!in_support(i)) continue;
+      for (unsigned j = 0; j < N; ++j) {
+        if (!in_support(j)) continue;
+        std::copy(grid + (i*N + j)*N, grid + (i*N + j)*N + N, line.begin());
+        fft(line.data(), N, 1, -1);
+        std::copy(line.begin(), line.begin() + H, half + (i*N + j)*H);
+      }
+      fft_lines(half + i*N*H, N, H, H, -1);
+    }
+    fft_lines(half, N, N*H, N*H, -1);
+  }
+
+  /** The octant of a child box at offset from the center of its parent */
+  static unsigned octant(const point_type& offset) {
+    return (offset[0] > 0) | ((offset[1] > 0) << 1) | ((offset[2] > 0) << 2);
+  }
+
+  /** The charge of the i-th point of the densities */
+  static charge_type charge(const std::vector<double>& density, unsigned i) {
+    charge_type c = charge_type(0);
+    for (unsigned k = 0; k < C; ++k)
+      charge_components::add(c, k, density[i*C + k]);
+    return c;
+  }
+
+  /** Accumulate a result into the i-th point of the potentials */
+  static void add_result(std::vector<double>& potential, unsigned i,
+                         const result_type& r) {
+    for (unsigned k = 0; k < R; ++k)
+      potential[i*R + k] += result_components::get(r, k);
+  }
+
+  /** Writes results into the potentials of the check points, in order */
+  struct potential_iterator {
+    std::vector<double>* potential;
+    unsigned i;
+    result_type r;
+    potential_iterator(std::vector<double>& p)
+        : potential(&p), i(0), r(0) {
+    }
+    result_type& operator*() {
+      return r;
+    }
+    potential_iterator& operator++() {
+      add_result(*potential, i++, r);
+      r = result_type(0);
+      return *this;
+    }
+  };
+
+  /** Accumulate the field of densities on the points of a surface into the
+   * results of the targets
+   */
+  template <typename TargetIter, typename ResultIter>
+  void field(const std::vector<point_type>& points,
+             const std::vector<double>& density,
+             TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    std::vector<charge_type> charges(points.size());
+    for (unsigned j = 0; j < points.size(); ++j)
+      charges[j] = charge(density, j);
+    for ( ; t_begin != t_end; ++t_begin, ++r_begin) {
+      result_type r = result_type(0);
+      for (unsigned j = 0; j < points.size(); ++j)
+        r += (*this)(*t_begin, points[j]) * charges[j];
+      *r_begin += r;
+    }
+  }
+
+  /** y += A x for the row-major matrix A */
+  static void multiply(const std::vector<double>& A,
+                       const std::vector<double>& x, std::vector<double>& y) {
+    const unsigned n = x.size();
+    for (unsigned i = 0; i < y.size(); ++i) {
+      const double* a = &A[i * n];
+      double s = 0;
+      for (unsigned j = 0; j < n; ++j)
+        s += a[j] * x[j];
+      y[i] += s;
+    }
+  }
+
+  /** The (#targets R) x (#sources C) matrix of the kernel between points */
+  std::vector<double> kernel_matrix(const std::vector<point_type>& targets,
+                                    const std::vector<point_type>& sources) const {
+    const unsigned cols = sources.size() * C;
+    std::vector<double> A(targets.size() * R * cols);
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      for (unsigned j = 0; j < sources.size(); ++j) {
+        const kernel_value_type k = (*this)(targets[i], sources[j]);
+        for (unsigned c = 0; c < C; ++c) {
+          charge_type e = charge_type(0);
+          charge_components::add(e, c, 1);
+          const result_type r = k * e;
+          for (unsigned q = 0; q < R; ++q)
+            A[(i*R + q) * cols + j*C + c] = result_components::get(r, q);
+        }
+      }
+    }
+    return A;
+  }
+
+  /** The m x n row-major product A B of A (m x k) and B (k x n) */
+  static std::vector<double> product(const std::vector<double>& A,
+                                     const std::vector<double>& B,
+                                     unsigned m, unsigned k, unsigned n) {
+    // Row-major matrices are their column-major transposes: (AB)^T = B^T A^T
+    std::vector<double> AB(m * n, 0);
+    Gemm(n, m, k, B.data(), A.data(), AB.data());
+    return AB;
+  }
+
+  /** The n x m pseudo-inverse of the row-major m x n matrix A
+   * A tall A is first reduced to its triangular factor, A = Q R and
+   * pinv(A) = pinv(R) Q^T. A square A is decomposed by the one-sided Jacobi
+   * SVD A = U S V^T, orthogonalizing the columns of A by rotations
+   * accumulated into V, and pinv(A) = V S^+ U^T.
+   */
+  static std::vector<double> pseudo_inverse(const std::vector<double>& A,
+                                            unsigned m, unsigned n) {
+    if (m < n) {
+      // pinv(A) = pinv(A^T)^T
+      std::vector<double> P = pseudo_inverse(transpose(A, m, n), n, m);
+      return transpose(P, m, n);
+    }
+    if (m > n) {
+      std::vector<double> Q, R;
+      householder_qr(A, m, n, Q, R);
+      // Q is column-major m x n, so row-major Q^T
+      return product(pseudo_inverse(R, n, n), Q, n, n, m);
+    }
+
+    // Columns of U S and of V, contiguous
+    std::vector<double> U = transpose(A, n, n), V(n * n, 0);
+    for (unsigned j = 0; j < n; ++j)
+      V[j*n + j] = 1;
+
+    for (unsigned sweep = 0; sweep < 60; ++sweep) {
+      bool rotated = false;
+      for (unsigned p = 0; p + 1 < n; ++p) {
+        for (unsigned q = p + 1; q < n; ++q) {
+          double* up = &U[p*n];
+          double* uq = &U[q*n];
+          double alpha = 0, beta = 0, gamma = 0;
+          for (unsigned i = 0; i < n; ++i) {
+            alpha += up[i] * up[i];
+            beta  += uq[i] * uq[i];
+            gamma += up[i] * uq[i];
+          }
+          if (std::abs(gamma) <= 1e-15 * std::sqrt(alpha * beta))
+            continue;
+          rotated = true;
+          const double zeta = (beta - alpha) / (2 * gamma);
+          const double t = (zeta >= 0 ? 1 : -1)
+              / (std::abs(zeta) + std::sqrt(1 + zeta * zeta));
+          const double c = 1 / std::sqrt(1 + t * t);
+          const double s = c * t;
+          rotate(up, uq, n, c, s);
+          rotate(&V[p*n], &V[q*n], n, c, s);
+        }
+      }
+      if (!rotated)
+        break;
+    }
+
+    // The norms of the columns of U S are the singular values
+    std::vector<double> sigma2(n, 0);
+    for (unsigned j = 0; j < n; ++j)
+      for (unsigned i = 0; i < n; ++i)
+        sigma2[j] += U[j*n + i] * U[j*n + i];
+    const double max2 = *std::max_element(sigma2.begin(), sigma2.end());
+
+    std::vector<double> P(n * n, 0);
+    for (unsigned j = 0; j < n; ++j) {
+      if (sigma2[j] <= EPS * EPS * max2)
+        continue;
+      for (unsigned r = 0; r < n; ++r) {
+        const double v = V[j*n + r] / sigma2[j];
+        for (unsigned i = 0; i < n; ++i)
+          P[r*n + i] += v * U[j*n + i];
+      }
+    }
+    return P;
+  }
+
+  /** The n x m transpose of the row-major m x n matrix A */
+  static std::vector<double> transpose(const std::vector<double>& A,
+                                       unsigned m, unsigned n) {
+    std::vector<double> At(n * m);
+    for (unsigned i = 0; i < m; ++i)
+      for (unsigned j = 0; j < n; ++j)
+        At[j*m + i] = A[i*n + j];
+    return At;
+  }
+
+  /** (x,y) = (c x - s y, s x + c y) */
+  static void rotate(double* x, double* y, unsigned n, double c, double s) {
+    for (unsigned i = 0; i < n; ++i) {
+      const double a = x[i], b = y[i];
+      x[i] = c * a - s * b;
+      y[i] = s * a + c * b;
+    }
+  }
+
+  /** Householder QR of the row-major m x n matrix A, m >= n
+   * @param[out] Q The column-major m x n orthonormal factor
+   * @param[out] R The row-major n x n upper triangular factor
+   */
+  static void householder_qr(const std::vector<double>& A,
+                             unsigned m, unsigned n,
+                             std::vector<double>& Q, std::vector<double>& R) {
+    // Column-major copy reduced in place, and the unit reflectors
+    std::vector<double> H = transpose(A, m, n);
+    std::vector<double> V(m * n, 0);
+    for (unsigned j = 0; j < n; ++j) {
+      double* x = &H[j*m];
+      double* v = &V[j*m];
+      double norm = 0;
+      for (unsigned i = j; i < m; ++i)
+        norm += x[i] * x[i];
+      norm = std::sqrt(norm);
+      if (norm == 0)
+        continue;
+      const double alpha = x[j] > 0 ? -norm : norm;
+      double vnorm = 0;
+      for (unsigned i = j; i < m; ++i) {
+        v[i] = x[i] - (i == j ? alpha : 0);
+        vnorm += v[i] * v[i];
+      }
+      vnorm = std::sqrt(vnorm);
+      if (vnorm == 0)
+        continue;
+      for (unsigned i = j; i < m; ++i)
+        v[i] /= vnorm;
+      for (unsigned k = j; k < n; ++k)
+        reflect(v, &H[k*m], j, m);
+    }
+
+    R.assign(n * n, 0);
+    for (unsigned i = 0; i < n; ++i)
+      for (unsigned j = i; j < n; ++j)
+        R[i*n + j] = H[j*m + i];
+
+    // Q = H_0 ... H_{n-1} [I 0]^T
+    Q.assign(m * n, 0);
+    for (unsigned k = 0; k < n; ++k) {
+      double* q = &Q[k*m];
+      q[k] = 1;
+      for (unsigned j = std::min(k + 1, n); j-- > 0; )
+        reflect(&V[j*m], q, j, m);
+    }
+  }
+
+  /** x -= 2 v (v . x) over the entries begin..m-1 */
+  static void reflect(const double* v, double* x, unsigned begin, unsigned m) {
+    double d = 0;
+    for (unsigned i = begin; i < m; ++i)
+      d += v[i] * x[i];
+    d *= 2;
+    for (unsigned i = begin; i < m; ++i)
+      x[i] -= d * v[i];
+  }
+
+  /** The check-to-equivalent solves of the boxes of a side, unsynchronized */
+  level_operators& check_to_equivalent(double side) const {
+    level_operators& ops = operators_[side];
+    if (!ops.UC2E.empty())
+      return ops;
+
+    const unsigned n = surface_.size();
+    const point_type center(0);
+    ops.UC2E = pseudo_inverse(
+        kernel_matrix(surface(center, side, UPWARD_CHECK),
+                      surface(center, side, UPWARD_EQUIVALENT)), n*R, n*C);
+    ops.DC2E = pseudo_inverse(
+        kernel_matrix(surface(center, side, DOWNWARD_CHECK),
+                      surface(center, side, DOWNWARD_EQUIVALENT)), n*R, n*C);
+    return ops;
+  }
+
+  /** The operators of the boxes of a side, computed on first use
+   * @param[in] shifts Whether the M2M and L2L of the boxes are needed
+   */
+  const level_operators& operators(double side, bool shifts = false) const {
+    level_operators* ops;
+#pragma omp critical(KIFMMOperators)
+    {
+      ops = &check_to_equivalent(side);
+      if (shifts && !ops->shifts) {
+        const level_operators& parent = check_to_equivalent(2 * side);
+        const unsigned n = surface_.size();
+        const point_type center(0);
+        for (unsigned o = 0; o < 8; ++o) {
+          // The child of side side in octant o of the parent at the origin
+          const point_type child((o & 1 ? 1 : -1) * side / 2,
+                                 (o & 2 ? 1 : -1) * side / 2,
+                                 (o & 4 ? 1 : -1) * side / 2);
+          ops->M2M[o] = product(parent.UC2E,
+              kernel_matrix(surface(center, 2 * side, UPWARD_CHECK),
+                            surface(child, side, UPWARD_EQUIVALENT)),
+              n*C, n*R, n*C);
+          ops->L2L[o] = product(ops->DC2E,
+              kernel_matrix(surface(child, side, DOWNWARD_CHECK),
+                            surface(center, 2 * side, DOWNWARD_EQUIVALENT)),
+              n*C, n*R, n*C);
+        }
+        ops->shifts = true;
+      }
+    }
+    return *ops;
+  }
+};
+
+
+/** The kernel to use for expansions: Kernel itself if it has expansions,
+ * KIFMM<Kernel> if it only has a pointwise operator()
+ */
+template <typename Kernel>
+struct ExpansionKernel {
+  template <typename K>
+  static std::true_type test(typename K::multipole_type*);
+  template <typename K>
+  static std::false_type test(...);
+  static constexpr bool has_expansions = decltype(test<Kernel>(0))::value;
+
+  typedef typename std::conditional<has_expansions,
+                                    Kernel, KIFMM<Kernel>>::type type;
+};
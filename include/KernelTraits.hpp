@@ -75,6 +75,17 @@ struct KernelTraits {
              source_iterator, source_iterator, charge_iterator,
              target_iterator, target_iterator, result_iterator>::value;
 
+
+  // Packed P2P over the sources of a leaf, see SourcePack.hpp
+  struct no_source_pack {};
+  template <class A> static typename A::source_pack_type source_pack_of(int);
+  template <class A> static no_source_pack source_pack_of(...);
+  typedef decltype(source_pack_of<Kernel>(0)) source_pack_type;
+  static constexpr bool has_pack_op =
+      HasEvalOp<void,
+                const target_type&, const source_pack_type&,
+                result_type&>::value;
+
   static constexpr bool is_valid_kernel = has_eval_op || has_vector_P2P_asymm;
 
   friend std::ostream& operator<<(std::ostream& s, const self_type& traits) {
@@ -82,6 +93,7 @@ struct KernelTraits {
     s << "has_transpose: " << traits.has_transpose << std::endl;
     s << "has_vector_P2P_symm: " << traits.has_vector_P2P_symm << std::endl;
     s << "has_vector_P2P_asymm: " << traits.has_vector_P2P_asymm << std::endl;
+    s << "has_pack_op: " << traits.has_pack_op << std::endl;
     return s;
   }
 };
@@ -125,11 +137,20 @@ struct ExpansionTraits : public KernelTraits<Kernel>
       HasInitLocal<void,
                    local_type&, const point_type&, unsigned>::value;
 
+  // Contiguous expansion storage
+  SFINAE_TEMPLATE(HasMultipoleStride,multipole_stride);
+  static constexpr bool has_multipole_stride =
+      HasMultipoleStride<unsigned>::value;
+  SFINAE_TEMPLATE(HasLocalStride,local_stride);
+  static constexpr bool has_local_stride =
+      HasLocalStride<unsigned>::value;
+
   // Kernel Evaluations and P2P
   static constexpr bool has_eval_op          = super_type::has_eval_op;
   static constexpr bool has_transpose        = super_type::has_transpose;
   static constexpr bool has_vector_P2P_symm  = super_type::has_vector_P2P_symm;
   static constexpr bool has_vector_P2P_asymm = super_type::has_vector_P2P_asymm;
+  static constexpr bool has_pack_op          = super_type::has_pack_op;
 
   // P2M
   SFINAE_TEMPLATE(HasP2M,P2M);
@@ -141,12 +162,22 @@ struct ExpansionTraits : public KernelTraits<Kernel>
       HasP2M<void,
              source_iterator, source_iterator, charge_iterator,
              const point_type&, multipole_type&>::value;
+  // P2M as a dense matrix, see EvalLeafMatrices.hpp
+  SFINAE_TEMPLATE(HasP2MMatrix,P2M_matrix);
+  static constexpr bool has_P2M_matrix =
+      HasP2MMatrix<void,
+                   source_iterator, source_iterator,
+                   const point_type&, double*>::value;
 
   // M2M
   SFINAE_TEMPLATE(HasM2M,M2M);
   static constexpr bool has_M2M =
       HasM2M<void,
              const multipole_type&, multipole_type&, const point_type&>::value;
+  // M2M as a dense matrix, see EvalBatched.hpp
+  SFINAE_TEMPLATE(HasM2MMatrix,M2M_matrix);
+  static constexpr bool has_M2M_matrix =
+      HasM2MMatrix<void, const point_type&, double*>::value;
 
   // M2P
   SFINAE_TEMPLATE(HasM2P,M2P);
@@ -164,12 +195,28 @@ struct ExpansionTraits : public KernelTraits<Kernel>
   static constexpr bool has_M2L =
       HasM2L<void,
              const multipole_type&, local_type&, const point_type&>::value;
+  // M2L as a dense matrix, see EvalBatched.hpp
+  SFINAE_TEMPLATE(HasM2LMatrix,M2L_matrix);
+  static constexpr bool has_M2L_matrix =
+      HasM2LMatrix<void, const point_type&, double*>::value;
+  // M2L as a product in Fourier space, see EvalM2L_FFT.hpp
+  SFINAE_TEMPLATE(HasM2LFFT,M2L_fft_size);
+  static constexpr bool has_M2L_fft =
+      HasM2LFFT<unsigned,double,double>::value;
+  // M2L through directional plane waves, see EvalM2L_Exp.hpp
+  SFINAE_TEMPLATE(HasM2LExp,M2L_exp_size);
+  static constexpr bool has_M2L_exp =
+      HasM2LExp<unsigned, double>::value;
 
   // L2L
   SFINAE_TEMPLATE(HasL2L,L2L);
   static constexpr bool has_L2L =
       HasL2L<void,
              const local_type&, local_type&, const point_type&>::value;
+  // L2L as a dense matrix, see EvalBatched.hpp
+  SFINAE_TEMPLATE(HasL2LMatrix,L2L_matrix);
+  static constexpr bool has_L2L_matrix =
+      HasL2LMatrix<void, const point_type&, double*>::value;
 
   // L2P
   SFINAE_TEMPLATE(HasL2P,L2P);
@@ -181,6 +228,12 @@ struct ExpansionTraits : public KernelTraits<Kernel>
       HasL2P<void,
              const local_type&, const point_type&,
              target_iterator, target_iterator, result_iterator>::value;
+  // L2P as a dense matrix, see EvalLeafMatrices.hpp
+  SFINAE_TEMPLATE(HasL2PMatrix,L2P_matrix);
+  static constexpr bool has_L2P_matrix =
+      HasL2PMatrix<void,
+                   const point_type&, target_iterator, target_iterator,
+                   double*>::value;
 
   static constexpr bool is_valid_treecode =
       (has_eval_op || has_vector_P2P_asymm) &&
@@ -199,16 +252,25 @@ struct ExpansionTraits : public KernelTraits<Kernel>
     s << static_cast<super_type>(traits);
     s << "has_init_multipole: " << traits.has_init_multipole << std::endl;
     s << "has_init_local: " << traits.has_init_local << std::endl;
+    s << "has_multipole_stride: " << traits.has_multipole_stride << std::endl;
+    s << "has_local_stride: " << traits.has_local_stride << std::endl;
     s << "has_vector_P2M: " << traits.has_vector_P2M << std::endl;
     s << "has_P2M: " << traits.has_P2M << std::endl;
     s << "has_vector_P2M: " << traits.has_vector_P2M << std::endl;
+    s << "has_P2M_matrix: " << traits.has_P2M_matrix << std::endl;
     s << "has_M2M: " << traits.has_M2M << std::endl;
+    s << "has_M2M_matrix: " << traits.has_M2M_matrix << std::endl;
     s << "has_M2P: " << traits.has_M2P << std::endl;
     s << "has_vector_M2P: " << traits.has_vector_M2P << std::endl;
     s << "has_M2L: " << traits.has_M2L << std::endl;
+    s << "has_M2L_matrix: " << traits.has_M2L_matrix << std::endl;
+    s << "has_M2L_fft: " << traits.has_M2L_fft << std::endl;
+    s << "has_M2L_exp: " << traits.has_M2L_exp << std::endl;
     s << "has_L2L: " << traits.has_L2L << std::endl;
+    s << "has_L2L_matrix: " << traits.has_L2L_matrix << std::endl;
     s << "has_L2P: " << traits.has_L2P << std::endl;
     s << "has_vector_L2P: " << traits.has_vector_L2P << std::endl;
+    s << "has_L2P_matrix: " << traits.has_L2P_matrix << std::endl;
     return s;
   }
 };
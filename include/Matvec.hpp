@@ -1,35 +1,301 @@
 #pragma once
 
 /**
- * matvec for ublas, where:
- * matrix elements are Mat3<double>
- * vector elements are Vec<3,double>
+ * Multithreaded sparse matvec for the precomputed near-field, where:
+ * matrix elements are kernel values (e.g. double or Mat3<double>)
+ * vector elements are charges / results (e.g. double or Vec<3,double>)
+ *
+ * Matrices of 3x3 blocks (Mat3, e.g. the Stokeslet) are stored as 9 contiguous
+ * values per entry and have their own fused, unrolled matvecs.
  */
 
+#include <cassert>
+#include <iterator>
 #include <vector>
-#include <boost/numeric/ublas/matrix_sparse.hpp>
-#include "Mat3.hpp"
+#include <map>
+#include <algorithm>
+#include "SparseMatrix.hpp"
+#include "BlockSparseMatrix.hpp"
 #include "Vec.hpp"
+#include "Mat3.hpp"
 
-template <typename Matrix, typename Vector, typename ResultVector>
-ResultVector Matvec(const Matrix& A, const Vector& x)
+/** Accumulate y += A*x for a CSR matrix A
+ * x and y are random access iterators, e.g. over the charges and results of
+ * a context in tree order. x is gathered once into a contiguous vector, so
+ * the inner loop reads it through a plain pointer and vectorizes.
+ * Rows are independent: each thread accumulates its rows in a register and
+ * writes every result once.
+ */
+template <typename I, typename T, typename ChargeIter, typename ResultIter>
+void Matvec(const SparseMatrix<I,T>& A, ChargeIter x, ResultIter y)
 {
-  ResultVector r(x.size(),typename ResultVector::value_type(0));
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  std::vector<charge_type> xc(A.cols);
+#pragma omp parallel for
+  for (I j = 0; j < A.cols; ++j)
+    xc[j] = x[j];
 
-  // get internal details from A
-  auto& offsets = A.index1_data();
-  auto& indices = A.index2_data();
-  auto& values  = A.value_data();
+  const std::size_t* offsets = A.offsets.data();
+  const I* indices = A.indices.data();
+  const T* values  = A.vals.data();
+  const charge_type* xp = xc.data();
 
   // loop over rows
-  for (unsigned i=0; i<A.size1(); i++) {
-    // loop over columns
-    for (unsigned j=offsets[i]; j<offsets[i+1]; j++) {
-      auto col = indices[j];
-      auto temp = values[j]*x[col];
-      r[i] = r[i]+temp;
+#pragma omp parallel for schedule(dynamic, 64)
+  for (I i = 0; i < A.rows; i++) {
+    if (offsets[i] == offsets[i+1]) continue;
+
+    // accumulate into register
+    result_type yi = y[i];
+    for (std::size_t jj = offsets[i]; jj < offsets[i+1]; jj++)
+      yi += values[jj] * xp[indices[jj]];
+    // write out
+    y[i] = yi;
+  }
+}
+
+/** Accumulate y += A*x for a block sparse matrix A
+ * x is gathered once into a contiguous vector (in the column order of A), so
+ * every dense block reads a contiguous range of x and its inner loop
+ * vectorizes. Groups of blocks sharing rows are independent: each thread
+ * accumulates its rows in a register and writes every result once.
+ */
+template <typename T, typename ChargeIter, typename ResultIter>
+void Matvec(const BlockSparseMatrix<T>& A, ChargeIter x, ResultIter y)
+{
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+  typedef typename BlockSparseMatrix<T>::block block;
+
+  std::vector<charge_type> xc(A.cols);
+#pragma omp parallel for
+  for (unsigned j = 0; j < A.cols; ++j)
+    xc[j] = x[j];
+
+  const block* blocks = A.blocks.data();
+  const T* values = A.vals.data();
+
+#pragma omp parallel for schedule(dynamic)
+  for (unsigned g = 0; g < A.groups(); ++g) {
+    const block* b_begin = blocks + A.group_offsets[g];
+    const block* b_end   = blocks + A.group_offsets[g+1];
+    if (b_begin == b_end) continue;
+
+    const unsigned row_begin = b_begin->row_begin;
+    const unsigned rows = b_begin->rows;
+    for (unsigned r = 0; r < rows; ++r) {
+      // accumulate into register
+      result_type yi = y[row_begin + r];
+      for (const block* b = b_begin; b != b_end; ++b) {
+        const T* v = values + b->offset + std::size_t(r) * b->cols;
+        const charge_type* xb = xc.data() + b->col_begin;
+        for (unsigned c = 0; c < b->cols; ++c)
+          yi += v[c] * xb[c];
+      }
+      // write out
+      y[row_begin + r] = yi;
+    }
+  }
+}
+
+/** Gather the charges x[0,n) of 3 components into n contiguous triples */
+template <typename T, typename ChargeIter>
+void gather3(ChargeIter x, unsigned n, std::vector<T>& xc)
+{
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+
+  xc.resize(3 * std::size_t(n));
+#pragma omp parallel for
+  for (unsigned j = 0; j < n; ++j) {
+    const charge_type xj = x[j];
+    xc[3*j+0] = xj[0];
+    xc[3*j+1] = xj[1];
+    xc[3*j+2] = xj[2];
+  }
+}
+
+/** Accumulate y += A*x for a CSR matrix A of 3x3 blocks
+ * x is gathered once into contiguous triples and every block is applied
+ * as nine multiply-adds into three registers, without Mat3/Vec temporaries.
+ */
+template <typename I, typename T, typename ChargeIter, typename ResultIter>
+void Matvec(const SparseMatrix<I,Mat3<T>>& A, ChargeIter x, ResultIter y)
+{
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+  static_assert(sizeof(Mat3<T>) == 9*sizeof(T), "Mat3 must be 9 contiguous values");
+
+  std::vector<T> xc;
+  gather3(x, A.cols, xc);
+
+  const std::size_t* offsets = A.offsets.data();
+  const I* indices = A.indices.data();
+  const T* values  = reinterpret_cast<const T*>(A.vals.data());
+
+  // loop over block rows
+#pragma omp parallel for schedule(dynamic, 64)
+  for (I i = 0; i < A.rows; i++) {
+    if (offsets[i] == offsets[i+1]) continue;
+
+    // accumulate into registers
+    T y0 = 0, y1 = 0, y2 = 0;
+    for (std::size_t jj = offsets[i]; jj < offsets[i+1]; jj++) {
+      const T* v = values + 9*jj;
+      const T* xj = xc.data() + 3*std::size_t(indices[jj]);
+      y0 += v[0]*xj[0] + v[1]*xj[1] + v[2]*xj[2];
+      y1 += v[3]*xj[0] + v[4]*xj[1] + v[5]*xj[2];
+      y2 += v[6]*xj[0] + v[7]*xj[1] + v[8]*xj[2];
     }
+    // write out
+    result_type yi = y[i];
+    yi[0] += y0;
+    yi[1] += y1;
+    yi[2] += y2;
+    y[i] = yi;
   }
-  return r;
 }
 
+/** Accumulate y += A*x for a block sparse matrix A of 3x3 blocks
+ * Every dense leaf-pair block reads a contiguous range of the gathered
+ * triples of x, and is applied without Mat3/Vec temporaries.
+ */
+template <typename T, typename ChargeIter, typename ResultIter>
+void Matvec(const BlockSparseMatrix<Mat3<T>>& A, ChargeIter x, ResultIter y)
+{
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+  typedef typename BlockSparseMatrix<Mat3<T>>::block block;
+  static_assert(sizeof(Mat3<T>) == 9*sizeof(T), "Mat3 must be 9 contiguous values");
+
+  std::vector<T> xc;
+  gather3(x, A.cols, xc);
+
+  const block* blocks = A.blocks.data();
+  const T* values = reinterpret_cast<const T*>(A.vals.data());
+
+#pragma omp parallel for schedule(dynamic)
+  for (unsigned g = 0; g < A.groups(); ++g) {
+    const block* b_begin = blocks + A.group_offsets[g];
+    const block* b_end   = blocks + A.group_offsets[g+1];
+    if (b_begin == b_end) continue;
+
+    const unsigned row_begin = b_begin->row_begin;
+    const unsigned rows = b_begin->rows;
+    for (unsigned r = 0; r < rows; ++r) {
+      // accumulate into registers
+      T y0 = 0, y1 = 0, y2 = 0;
+      for (const block* b = b_begin; b != b_end; ++b) {
+        const T* v = values + 9*(b->offset + std::size_t(r) * b->cols);
+        const T* xb = xc.data() + 3*std::size_t(b->col_begin);
+        for (unsigned c = 0; c < b->cols; ++c, v += 9, xb += 3) {
+          y0 += v[0]*xb[0] + v[1]*xb[1] + v[2]*xb[2];
+          y1 += v[3]*xb[0] + v[4]*xb[1] + v[5]*xb[2];
+          y2 += v[6]*xb[0] + v[7]*xb[1] + v[8]*xb[2];
+        }
+      }
+      // write out
+      result_type yi = y[row_begin + r];
+      yi[0] += y0;
+      yi[1] += y1;
+      yi[2] += y2;
+      y[row_begin + r] = yi;
+    }
+  }
+}
+
+/** Color the groups of the strictly upper blocks A of a symmetric block
+ * sparse matrix for MatvecSymmetric: the groups of a color write disjoint
+ * rows of y, their own rows and the columns of their blocks.
+ * The row and column ranges are the leaves of a single tree, equal or
+ * disjoint, so a leaf is identified by its first row.
+ * @returns the groups of every color
+ */
+template <typename T>
+std::vector<std::vector<unsigned>> color_groups(const BlockSparseMatrix<T>& A)
+{
+  typedef typename BlockSparseMatrix<T>::block block;
+
+  std::vector<std::vector<unsigned>> colors;
+  // Colors of the groups writing a leaf, by its first row
+  std::map<unsigned, std::vector<unsigned>> leaf_colors;
+  std::vector<std::vector<unsigned>*> leaves;
+  std::vector<char> used;
+  for (unsigned g = 0; g < A.groups(); ++g) {
+    const block* b_begin = A.blocks.data() + A.group_offsets[g];
+    const block* b_end   = A.blocks.data() + A.group_offsets[g+1];
+    if (b_begin == b_end) continue;
+
+    leaves.assign(1, &leaf_colors[b_begin->row_begin]);
+    for (const block* b = b_begin; b != b_end; ++b)
+      leaves.push_back(&leaf_colors[b->col_begin]);
+
+    // The first color not used by any of the leaves
+    used.assign(colors.size() + 1, 0);
+    for (const std::vector<unsigned>* l : leaves)
+      for (unsigned c : *l)
+        used[c] = 1;
+    const unsigned color = std::find(used.begin(), used.end(), 0) - used.begin();
+    if (color == colors.size())
+      colors.emplace_back();
+    colors[color].push_back(g);
+    for (std::vector<unsigned>* l : leaves)
+      l->push_back(color);
+  }
+  return colors;
+}
+
+/** Accumulate y += (A + A^T)*x for the strictly upper blocks A of a
+ * symmetric block sparse matrix (rows and columns are the same bodies).
+ * Every stored block is applied as is to its rows and transposed to its
+ * columns, with the transposed values given by transpose(a).
+ * The colors of the groups, from color_groups(A), are applied one after the
+ * other, and the groups of a color in parallel: they write disjoint rows, so
+ * the transposed products are accumulated directly into y.
+ */
+template <typename T, typename Transpose, typename ChargeIter, typename ResultIter>
+void MatvecSymmetric(const BlockSparseMatrix<T>& A,
+                     const std::vector<std::vector<unsigned>>& colors,
+                     const Transpose& transpose, ChargeIter x, ResultIter y)
+{
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+  typedef typename BlockSparseMatrix<T>::block block;
+
+  if (A.blocks.empty()) return;
+
+  std::vector<charge_type> xc(A.cols);
+#pragma omp parallel for
+  for (unsigned j = 0; j < A.cols; ++j)
+    xc[j] = x[j];
+
+  const block* blocks = A.blocks.data();
+  const T* values = A.vals.data();
+
+  for (const std::vector<unsigned>& color : colors) {
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned k = 0; k < color.size(); ++k) {
+      const unsigned g = color[k];
+      const block* b_begin = blocks + A.group_offsets[g];
+      const block* b_end   = blocks + A.group_offsets[g+1];
+
+      const unsigned row_begin = b_begin->row_begin;
+      const unsigned rows = b_begin->rows;
+      for (unsigned r = 0; r < rows; ++r) {
+        // accumulate into register
+        result_type yi = y[row_begin + r];
+        const charge_type& xi = xc[row_begin + r];
+        for (const block* b = b_begin; b != b_end; ++b) {
+          const T* v = values + b->offset + std::size_t(r) * b->cols;
+          const charge_type* xb = xc.data() + b->col_begin;
+          ResultIter yc = y + b->col_begin;
+          for (unsigned c = 0; c < b->cols; ++c, ++yc) {
+            yi += v[c] * xb[c];
+            *yc += transpose(v[c]) * xi;
+          }
+        }
+        // write out
+        y[row_begin + r] = yi;
+      }
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+/**
+ * Plane-wave quadrature of the Yukawa potential for the directional M2L:
+ *   e^{-kappa r}/r = 1/(2 pi) int_kappa^inf dmu e^{-mu z}
+ *                    int_0^{2 pi} dalpha e^{i lambda (x cos alpha + y sin alpha)}
+ * with lambda = sqrt(mu^2 - kappa^2) and z > 0, in units of a box side.
+ *
+ * The quadrature is accurate to about tol for the offsets between the
+ * points of two boxes of one side in the +z list of each other:
+ *   1 <= z <= zmax,  |x|, |y| <= z + 2.
+ * The nodes in mu are chosen from a fine composite Gauss-Legendre rule by a
+ * pivoted Gram-Schmidt on the samples of the integrand over these offsets,
+ * and their weights by least squares. The trapezoidal rule in alpha of
+ * every node uses as few angles as its Bessel tail allows. Since the
+ * expansions are real, only the angles in [0, pi) are kept.
+ */
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <tr1/cmath>
+
+struct PlaneWaveQuadrature {
+  //! Per node: lambda, mu and weight, divided by the number of angles
+  std::vector<double> lambda, mu, weight;
+  //! Per node: index of its first plane wave and number of angles in [0, pi)
+  std::vector<unsigned> offset, angles;
+  //! Per plane wave: cosine and sine of its angle
+  std::vector<double> cos_alpha, sin_alpha;
+
+  /** Number of plane waves */
+  unsigned size() const {
+    return cos_alpha.size();
+  }
+};
+
+/** Gauss-Legendre nodes and weights on [-1,1] */
+inline void gauss_legendre(unsigned n, double* x, double* w)
+{
+  for (unsigned i = 0; i < n; ++i) {
+    double z = std::cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 1;
+    for (int it = 0; it < 100; ++it) {
+      double p0 = 1, p1 = 0;
+      for (unsigned j = 1; j <= n; ++j) {
+        double p2 = p1;
+        p1 = p0;
+        p0 = ((2*j - 1) * z * p1 - (j - 1) * p2) / j;
+      }
+      dp = n * (z * p0 - p1) / (z * z - 1);
+      double dz = p0 / dp;
+      z -= dz;
+      if (std::fabs(dz) < 1e-15) break;
+    }
+    x[i] = z;
+    w[i] = 2 / ((1 - z * z) * dp * dp);
+  }
+}
+
+/** Plane-wave quadrature of e^{-kappa r}/r, with kappa in units of a box side
+ * @see PlaneWaveQuadrature
+ */
+inline PlaneWaveQuadrature
+yukawa_plane_waves(double kappa, double zmax, double tol)
+{
+  // Candidate nodes: panels of width 1/2 up to where e^{-mu} < tol/1000
+  const unsigned NG = 8;
+  double gx[NG], gw[NG];
+  gauss_legendre(NG, gx, gw);
+  std::vector<double> mu, w;
+  const double T = -std::log(tol * 1e-3);
+  for (double a = 0; a < T; a += 0.5)
+    for (unsigned i = 0; i < NG; ++i) {
+      mu.push_back(kappa + a + 0.25 * (gx[i] + 1));
+      w.push_back(0.25 * gw[i]);
+    }
+  const unsigned nc = mu.size();
+
+  // Samples of the offsets, Chebyshev spaced in z and rho
+  const unsigned NZ = 20, NR = 30;
+  std::vector<double> zs, rs;
+  for (unsigned i = 0; i < NZ; ++i) {
+    double z = 1 + (zmax - 1) * 0.5 * (1 - std::cos(M_PI * i / (NZ - 1)));
+    double rho_max = std::sqrt(2.) * (z + 2);
+    for (unsigned j = 0; j < NR; ++j) {
+      zs.push_back(z);
+      rs.push_back(rho_max * 0.5 * (1 - std::cos(M_PI * j / (NR - 1))));
+    }
+  }
+  const unsigned ns = zs.size();
+
+  // Integrand of every candidate at every sample, column-major
+  std::vector<double> A(ns * nc), b(ns);
+  for (unsigned s = 0; s < ns; ++s) {
+    double r = std::sqrt(zs[s] * zs[s] + rs[s] * rs[s]);
+    b[s] = std::exp(-kappa * r) / r;
+    for (unsigned k = 0; k < nc; ++k) {
+      double lambda = std::sqrt(mu[k] * mu[k] - kappa * kappa);
+      A[k*ns + s] = std::exp(-mu[k] * zs[s])
+          * std::tr1::cyl_bessel_j(0., lambda * rs[s]);
+    }
+  }
+
+  // Select the nodes by Gram-Schmidt with pivoting on the weighted columns
+  std::vector<double> Q(ns * nc), norm2(nc, 0);
+  for (unsigned k = 0; k < nc; ++k)
+    for (unsigned s = 0; s < ns; ++s) {
+      Q[k*ns + s] = w[k] * A[k*ns + s];
+      norm2[k] += Q[k*ns + s] * Q[k*ns + s];
+    }
+  const double stop = 1e-4 * tol * tol *
+      *std::max_element(norm2.begin(), norm2.end());
+  std::vector<unsigned> sel;
+  std::vector<double> q(ns);
+  while (sel.size() < nc) {
+    unsigned p = std::max_element(norm2.begin(), norm2.end()) - norm2.begin();
+    if (norm2[p] < stop) break;
+    sel.push_back(p);
+    const double np = std::sqrt(norm2[p]);
+    for (unsigned s = 0; s < ns; ++s)
+      q[s] = Q[p*ns + s] / np;
+    for (unsigned k = 0; k < nc; ++k) {
+      double d = 0;
+      for (unsigned s = 0; s < ns; ++s) d += q[s] * Q[k*ns + s];
+      norm2[k] = 0;
+      for (unsigned s = 0; s < ns; ++s) {
+        Q[k*ns + s] -= d * q[s];
+        norm2[k] += Q[k*ns + s] * Q[k*ns + s];
+      }
+    }
+    norm2[p] = 0;
+  }
+  const unsigned r = sel.size();
+
+  // Least squares weights of the selected nodes, by QR (twice Gram-Schmidt)
+  std::vector<double> V(ns * r), R(r * r, 0);
+  for (unsigned k = 0; k < r; ++k) {
+    double* v = &V[k*ns];
+    std::copy(&A[sel[k]*ns], &A[sel[k]*ns] + ns, v);
+    for (int pass = 0; pass < 2; ++pass)
+      for (unsigned j = 0; j < k; ++j) {
+        double d = 0;
+        for (unsigned s = 0; s < ns; ++s) d += V[j*ns + s] * v[s];
+        for (unsigned s = 0; s < ns; ++s) v[s] -= d * V[j*ns + s];
+        R[j*r + k] += d;
+      }
+    double nv = 0;
+    for (unsigned s = 0; s < ns; ++s) nv += v[s] * v[s];
+    nv = std::sqrt(nv);
+    R[k*r + k] = nv;
+    for (unsigned s = 0; s < ns; ++s) v[s] /= nv;
+  }
+  std::vector<double> c(r);
+  for (unsigned k = 0; k < r; ++k) {
+    double d = 0;
+    for (unsigned s = 0; s < ns; ++s) d += V[k*ns + s] * b[s];
+    c[k] = d;
+  }
+  for (int k = r - 1; k >= 0; --k) {
+    for (unsigned j = k + 1; j < r; ++j) c[k] -= R[k*r + j] * c[j];
+    c[k] /= R[k*r + k];
+  }
+
+  // Angles per node: even, such that the Bessel tail of the trapezoidal
+  // rule is below tol / r over all offsets
+  PlaneWaveQuadrature pw;
+  for (unsigned k = 0; k < r; ++k) {
+    const double m = mu[sel[k]];
+    const double lambda = std::sqrt(m * m - kappa * kappa);
+    unsigned n = 2;
+    for ( ; ; n += 2) {
+      double tail = 0;
+      for (unsigned i = 0; i < NZ; ++i) {
+        double z = zs[i * NR];
+        tail = std::max(tail, std::fabs(c[k]) * std::exp(-m * z) *
+                        std::fabs(std::tr1::cyl_bessel_j(double(n),
+                                  lambda * std::sqrt(2.) * (z + 2))));
+      }
+      if (tail < tol / r) break;
+    }
+    pw.lambda.push_back(lambda);
+    pw.mu.push_back(m);
+    pw.weight.push_back(c[k] / n);
+    pw.offset.push_back(pw.cos_alpha.size());
+    pw.angles.push_back(n / 2);
+    for (unsigned j = 0; j < n / 2; ++j) {
+      pw.cos_alpha.push_back(std::cos(2 * M_PI * j / n));
+      pw.sin_alpha.push_back(std::sin(2 * M_PI * j / n));
+    }
+  }
+  return pw;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+/**
+ * Sources in structure-of-arrays form for the packed P2P
+ *
+ * The coordinates and the C charge components of the sources of a leaf are
+ * stored in separate arrays, each aligned to a cache line and padded to a
+ * multiple of the pack width. The padding repeats the last source with zero
+ * charge, so a kernel can run its loop over the whole padded pack with
+ * #pragma omp simd and without a remainder.
+ *
+ * GCC keeps a std::sqrt in such a loop scalar, so that it can set errno,
+ * unless built with -fno-math-errno (make PACKED_P2P=1).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+
+#include <Vec.hpp>
+
+template <typename T, unsigned C>
+struct SourcePack {
+  typedef T value_type;
+
+  //! Sources per SIMD pack, the padded size is a multiple of it
+  static constexpr unsigned width = 64 / sizeof(T);
+  //! Alignment of the arrays in bytes
+  static constexpr std::size_t alignment = 64;
+  //! Number of charge components
+  static constexpr unsigned charges = C;
+
+  const T* x;
+  const T* y;
+  const T* z;
+  //! c[k][j] is the k-th charge component of the j-th source
+  const T* c[C];
+  //! Padded number of sources
+  unsigned size;
+};
+
+/** The k-th component of a charge */
+template <typename T>
+inline T charge_component(const T& c, unsigned) {
+  return c;
+}
+template <std::size_t N, typename T>
+inline T charge_component(const Vec<N,T>& c, unsigned k) {
+  return c[k];
+}
+
+/** Aligned storage of the SourcePacks of a list of leaves */
+template <typename Pack>
+class SourcePackBuffer
+{
+  typedef typename Pack::value_type real;
+  static constexpr unsigned width = Pack::width;
+  static constexpr unsigned arrays = 3 + Pack::charges;
+
+  real* data_;
+  //! Padded size of all packs
+  std::size_t size_;
+  //! Offset and number of sources of every pack
+  std::vector<std::size_t> offset_;
+  std::vector<unsigned> count_;
+
+ public:
+  SourcePackBuffer()
+      : data_(nullptr), size_(0) {
+  }
+  ~SourcePackBuffer() {
+    std::free(data_);
+  }
+
+  // Packs point into the buffer
+  SourcePackBuffer(const SourcePackBuffer&) = delete;
+  SourcePackBuffer& operator=(const SourcePackBuffer&) = delete;
+
+  /** Lay out packs of the given numbers of sources
+   * @returns false if the buffer could not be allocated
+   */
+  template <typename CountIter>
+  bool reserve(CountIter first, CountIter last) {
+    offset_.clear();
+    count_.clear();
+    size_ = 0;
+    for ( ; first != last; ++first) {
+      offset_.push_back(size_);
+      count_.push_back(*first);
+      size_ += (*first + width - 1) / width * width;
+    }
+
+    std::free(data_);
+    data_ = nullptr;
+    void* p = nullptr;
+    const std::size_t bytes = arrays * size_ * sizeof(real);
+    if (bytes != 0 && posix_memalign(&p, Pack::alignment, bytes) != 0) {
+      printf("[E]: Cannot allocate source packs of %lu bytes\n",
+             (unsigned long) bytes);
+      size_ = 0;
+      return false;
+    }
+    data_ = static_cast<real*>(p);
+    return true;
+  }
+
+  /** Number of packs */
+  unsigned packs() const {
+    return offset_.size();
+  }
+
+  /** Store the coordinates of the sources of the i-th pack */
+  template <typename SourceIter>
+  void set_sources(unsigned i, SourceIter s) {
+    real* x = array(0) + offset_[i];
+    real* y = array(1) + offset_[i];
+    real* z = array(2) + offset_[i];
+    unsigned j = 0;
+    for ( ; j < count_[i]; ++j, ++s) {
+      x[j] = (*s)[0];
+      y[j] = (*s)[1];
+      z[j] = (*s)[2];
+    }
+    for ( ; j < padded(i); ++j) {
+      x[j] = x[j-1];
+      y[j] = y[j-1];
+      z[j] = z[j-1];
+    }
+  }
+
+  /** Store the charges of the sources of the i-th pack */
+  template <typename ChargeIter>
+  void set_charges(unsigned i, ChargeIter c) {
+    unsigned j = 0;
+    for ( ; j < count_[i]; ++j, ++c)
+      for (unsigned k = 0; k < Pack::charges; ++k)
+        array(3 + k)[offset_[i] + j] = charge_component(*c, k);
+    for ( ; j < padded(i); ++j)
+      for (unsigned k = 0; k < Pack::charges; ++k)
+        array(3 + k)[offset_[i] + j] = 0;
+  }
+
+  /** The i-th pack */
+  Pack pack(unsigned i) const {
+    Pack p;
+    p.x = array(0) + offset_[i];
+    p.y = array(1) + offset_[i];
+    p.z = array(2) + offset_[i];
+    for (unsigned k = 0; k < Pack::charges; ++k)
+      p.c[k] = array(3 + k) + offset_[i];
+    p.size = padded(i);
+    return p;
+  }
+
+ private:
+  real* array(unsigned a) const {
+    return data_ + a * size_;
+  }
+  unsigned padded(unsigned i) const {
+    return (i + 1 < offset_.size() ? offset_[i+1] : size_) - offset_[i];
+  }
+};
@@ -2,9 +2,12 @@
 
 /**
  * Simple sparse matrix class (CSR)
+ * The row offsets and the number of nonzeros are std::size_t, so that a
+ * matrix may hold more than 2^32 entries with 32-bit column indices.
  */
 
 #include <vector>
+#include <cstddef>
 
 template <typename I, typename T>
 struct SparseMatrix
@@ -12,14 +15,16 @@ struct SparseMatrix
   typedef T value_type;
   typedef I index_type;
   // data
-  I rows, cols, nnz;
-  std::vector<I> offsets, indices;
+  I rows, cols;
+  std::size_t nnz;
+  std::vector<std::size_t> offsets;
+  std::vector<I> indices;
   std::vector<T> vals;
 
   // default constructor
   SparseMatrix() : rows(0), cols(0), nnz(0), offsets(0), indices(0), vals(0) {};
   // empty matrix
-  SparseMatrix(int r, int c, int nz)
+  SparseMatrix(I r, I c, std::size_t nz)
     : rows(r), cols(c), nnz(nz), offsets(r+1), indices(nz), vals(nz) {};
 
   // matvec
@@ -30,7 +35,8 @@ struct SparseMatrix
     std::vector<T> y(x.size(),T(0));
 
     // matvec
-    I jj, j;
+    I j;
+    std::size_t jj;
     T yy;
     #pragma omp parallel for private(j,jj,yy)
     for (I i=0; i<rows; i++) {
@@ -55,7 +61,8 @@ struct SparseMatrix
     std::vector<T> y(x.size(),T(0));
 
     // matvec
-    I j, jj;
+    I j;
+    std::size_t jj;
     T yy, v;
     #pragma omp parallel for private(j,jj,yy,v)
     for (I i=0; i<rows; i++) {
@@ -88,7 +95,7 @@ struct SparseMatrix
     return *this;
   }
 
-  void resize(int r, int c, int nz) {
+  void resize(I r, I c, std::size_t nz) {
     rows = r;
     cols = c;
     nnz = nz;
@@ -97,7 +104,10 @@ struct SparseMatrix
     vals.resize(nnz);
   }
   // copy constructor
-  SparseMatrix(const SparseMatrix& m) : rows(m.rows), cols(m.cols), nnz(m.nnz), offsets(m.offsets), indices(m.nnz), vals(m.vals) {};
+  SparseMatrix(const SparseMatrix& m) : rows(m.rows), cols(m.cols), nnz(m.nnz), offsets(m.offsets), indices(m.indices), vals(m.vals) {};
+  // copy with the values converted to T, e.g. to single precision
+  template <typename U>
+  explicit SparseMatrix(const SparseMatrix<I,U>& m) : rows(m.rows), cols(m.cols), nnz(m.nnz), offsets(m.offsets), indices(m.indices), vals(m.vals.begin(), m.vals.end()) {};
 
   // destructor
   ~SparseMatrix() {
@@ -107,9 +117,9 @@ struct SparseMatrix
   }
 
   // return storage size in bytes
-  auto storage_size() -> decltype(sizeof(T) + sizeof(I))
+  auto storage_size() const -> decltype(sizeof(T) + sizeof(I))
   {
-    auto index_storage = (rows+1 + nnz + 3)*sizeof(I);
+    auto index_storage = (std::size_t(rows)+1)*sizeof(std::size_t) + (nnz + 3)*sizeof(I);
     auto value_storage = nnz * sizeof(T);
     return index_storage + value_storage;
   }
@@ -0,0 +1,90 @@
+#pragma once
+/** @file BIND.hpp
+ * @brief Dispatch methods for binding the expansions of all boxes to
+ * contiguous storage
+ *
+ * A kernel opts in by providing
+ *   typedef ... coefficient_type;
+ *   unsigned multipole_stride() const;  // coefficients per multipole
+ *   unsigned local_stride() const;      // coefficients per local expansion
+ *   void bind_multipole(multipole_type&, coefficient_type*) const;
+ *   void bind_local(local_type&, coefficient_type*) const;
+ * where the bind methods make the expansion a view of stride coefficients.
+ */
+
+#include "KernelTraits.hpp"
+#include "ExpansionArena.hpp"
+#include <type_traits>
+#include <vector>
+
+struct BIND
+{
+  /** Bind the multipole expansions M (indexed by box) to slots of arena
+   * @returns Whether the expansions are bound. If the arena cannot be laid
+   * out, the expansions are replaced by ones that own their coefficients.
+   */
+  template <typename Kernel>
+  inline static bool multipoles(const Kernel& K,
+                                std::vector<typename Kernel::multipole_type>& M,
+                                ExpansionArena& arena, bool huge_pages) {
+    typedef std::integral_constant<bool,
+        ExpansionTraits<Kernel>::has_multipole_stride> has_stride;
+    return multipoles(K, M, arena, huge_pages, has_stride());
+  }
+
+  /** Bind the local expansions L (indexed by box) to slots of arena
+   * @returns Whether the expansions are bound, see multipoles()
+   */
+  template <typename Kernel>
+  inline static bool locals(const Kernel& K,
+                            std::vector<typename Kernel::local_type>& L,
+                            ExpansionArena& arena, bool huge_pages) {
+    typedef std::integral_constant<bool,
+        ExpansionTraits<Kernel>::has_local_stride> has_stride;
+    return locals(K, L, arena, huge_pages, has_stride());
+  }
+
+ private:
+
+  template <typename Kernel, typename Container>
+  inline static bool multipoles(const Kernel&, Container&, ExpansionArena&,
+                                bool, std::false_type) {
+    return false;
+  }
+
+  template <typename Kernel, typename Container>
+  inline static bool multipoles(const Kernel& K, Container& M,
+                                ExpansionArena& arena, bool huge_pages,
+                                std::true_type) {
+    typedef typename Kernel::coefficient_type coefficient_type;
+    if (!arena.reserve(M.size(), K.multipole_stride() * sizeof(coefficient_type),
+                       huge_pages)) {
+      M.assign(M.size(), typename Kernel::multipole_type());
+      return false;
+    }
+    for (unsigned i = 0; i < M.size(); ++i)
+      K.bind_multipole(M[i], arena.template slot<coefficient_type>(i));
+    return true;
+  }
+
+  template <typename Kernel, typename Container>
+  inline static bool locals(const Kernel&, Container&, ExpansionArena&,
+                            bool, std::false_type) {
+    return false;
+  }
+
+  template <typename Kernel, typename Container>
+  inline static bool locals(const Kernel& K, Container& L,
+                            ExpansionArena& arena, bool huge_pages,
+                            std::true_type) {
+    typedef typename Kernel::coefficient_type coefficient_type;
+    if (!arena.reserve(L.size(), K.local_stride() * sizeof(coefficient_type),
+                       huge_pages)) {
+      L.assign(L.size(), typename Kernel::local_type());
+      return false;
+    }
+    for (unsigned i = 0; i < L.size(); ++i)
+      K.bind_local(L[i], arena.template slot<coefficient_type>(i));
+    return true;
+  }
+};
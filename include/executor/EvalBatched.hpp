@@ -0,0 +1,272 @@
+#pragma once
+/** @file EvalBatched.hpp
+ * @brief M2M, M2L and L2L of a list of box pairs, batched by translation
+ *
+ * Within a level of a tree the translations only take a few distinct values:
+ * eight child octants for M2M and L2L, at most 316 offsets for M2L with
+ * theta = 0.5. The pairs are grouped by translation and the levels of the
+ * two boxes, and every group is applied as one dense matrix product
+ *   [E_t1 ... E_tn] += T [E_s1 ... E_sn]
+ * with the translation matrix T of the group.
+ *
+ * A kernel opts in by providing the matrices of the operators
+ *   void M2M_matrix(const point_type& translation, double* T) const;
+ *   void M2L_matrix(const point_type& translation, double* T) const;
+ *   void L2L_matrix(const point_type& translation, double* T) const;
+ * and the vector form of its expansions
+ *   unsigned expansion_size() const;  // reals in the vector form
+ *   void multipole_to_vector(const multipole_type& M, double* v) const;
+ *   void local_to_vector(const local_type& L, double* v) const;
+ *   void vector_to_multipole(const double* v, multipole_type& M) const;
+ *   void vector_to_local(const double* v, local_type& L) const;
+ * where T is column-major and vector_to_* accumulate into the expansion.
+ */
+
+#include "KernelTraits.hpp"
+#include "Gemm.hpp"
+
+#include <map>
+#include <array>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+
+/** The expansions and translation matrix of the batched operators */
+struct BatchedM2M {
+  static constexpr const char* name = "M2M";
+
+  template <typename Kernel>
+  struct supported {
+    static constexpr bool value = ExpansionTraits<Kernel>::has_M2M_matrix;
+  };
+  // Children before their parents
+  static long long order(unsigned source_level, unsigned) {
+    return -(long long) source_level;
+  }
+
+  template <typename Context>
+  static typename Context::box_type
+  source(Context& bc, unsigned i) { return bc.source_tree().box(i); }
+  template <typename Context>
+  static typename Context::box_type
+  target(Context& bc, unsigned i) { return bc.source_tree().box(i); }
+
+  template <typename Kernel>
+  static void matrix(const Kernel& K, const typename Kernel::point_type& r,
+                     double* T) {
+    K.M2M_matrix(r, T);
+  }
+  template <typename Context, typename Box>
+  static void gather(Context& bc, const Box& b, double* v) {
+    bc.kernel().multipole_to_vector(bc.multipole_expansion(b), v);
+  }
+  template <typename Context, typename Box>
+  static void scatter(Context& bc, const double* v, const Box& b) {
+    bc.kernel().vector_to_multipole(v, bc.multipole_expansion(b));
+  }
+};
+
+struct BatchedM2L {
+  static constexpr const char* name = "M2L";
+
+  template <typename Kernel>
+  struct supported {
+    static constexpr bool value = ExpansionTraits<Kernel>::has_M2L_matrix;
+  };
+  static long long order(unsigned, unsigned) {
+    return 0;
+  }
+
+  template <typename Context>
+  static typename Context::box_type
+  source(Context& bc, unsigned i) { return bc.source_tree().box(i); }
+  template <typename Context>
+  static typename Context::box_type
+  target(Context& bc, unsigned i) { return bc.target_tree().box(i); }
+
+  template <typename Kernel>
+  static void matrix(const Kernel& K, const typename Kernel::point_type& r,
+                     double* T) {
+    K.M2L_matrix(r, T);
+  }
+  template <typename Context, typename Box>
+  static void gather(Context& bc, const Box& b, double* v) {
+    bc.kernel().multipole_to_vector(bc.multipole_expansion(b), v);
+  }
+  template <typename Context, typename Box>
+  static void scatter(Context& bc, const double* v, const Box& b) {
+    bc.kernel().vector_to_local(v, bc.local_expansion(b));
+  }
+};
+
+struct BatchedL2L {
+  static constexpr const char* name = "L2L";
+
+  template <typename Kernel>
+  struct supported {
+    static constexpr bool value = ExpansionTraits<Kernel>::has_L2L_matrix;
+  };
+  // Parents before their children
+  static long long order(unsigned, unsigned target_level) {
+    return target_level;
+  }
+
+  template <typename Context>
+  static typename Context::box_type
+  source(Context& bc, unsigned i) { return bc.target_tree().box(i); }
+  template <typename Context>
+  static typename Context::box_type
+  target(Context& bc, unsigned i) { return bc.target_tree().box(i); }
+
+  template <typename Kernel>
+  static void matrix(const Kernel& K, const typename Kernel::point_type& r,
+                     double* T) {
+    K.L2L_matrix(r, T);
+  }
+  template <typename Context, typename Box>
+  static void gather(Context& bc, const Box& b, double* v) {
+    bc.kernel().local_to_vector(bc.local_expansion(b), v);
+  }
+  template <typename Context, typename Box>
+  static void scatter(Context& bc, const double* v, const Box& b) {
+    bc.kernel().vector_to_local(v, bc.local_expansion(b));
+  }
+};
+
+
+/** A list of (source, target) box index pairs of the operator Op, batched
+ * by translation
+ */
+template <typename Context, typename Op>
+class Batched
+{
+  typedef typename Context::kernel_type kernel_type;
+  typedef typename Context::box_type box_type;
+  typedef typename kernel_type::point_type point_type;
+
+  //! The pairs with the same translation
+  struct batch {
+    point_type translation;
+    std::vector<unsigned> sources;
+    std::vector<unsigned> targets;
+    //! Translation matrix, empty if it is built on every execute
+    std::vector<double> T;
+  };
+  mutable std::vector<batch> batches_;
+  //! Size of the vector form of the expansions the matrices were built for
+  mutable unsigned size_;
+
+  //! Largest total size of the kept translation matrices in bytes
+  static constexpr std::size_t max_matrix_storage = std::size_t(256) << 20;
+
+  typedef std::integral_constant<bool,
+      Op::template supported<kernel_type>::value> has_matrix;
+
+ public:
+  Batched()
+      : size_(0) {
+  }
+
+  /** Group the (source, target) box index pairs by translation
+   * The batches are ordered such that every expansion is complete before
+   * it is translated.
+   * @returns false if the kernel has no matrix for the operator
+   */
+  template <typename PairList>
+  bool assemble(Context& bc, const PairList& pairs) {
+    if (!has_matrix::value) {
+      printf("[W]: Kernel has no %s_matrix -- batched %s ignored\n",
+             Op::name, Op::name);
+      return false;
+    }
+
+    std::map<std::array<long long,6>, batch> grouped;
+    for (auto it = pairs.begin(); it != pairs.end(); ++it) {
+      box_type s = Op::source(bc, it->first);
+      box_type t = Op::target(bc, it->second);
+      point_type r = bc.center(t) - bc.center(s);
+      // In units of the smaller box, fine enough to separate the
+      // translations of a dual tree
+      point_type unit = (s.level() > t.level() ? s : t).extents();
+      std::array<long long,6> key = {{
+          Op::order(s.level(), t.level()),
+          (long long) s.level(), (long long) t.level(),
+          std::llround(std::ldexp(r[0] / unit[0], 32)),
+          std::llround(std::ldexp(r[1] / unit[1], 32)),
+          std::llround(std::ldexp(r[2] / unit[2], 32)) }};
+
+      batch& b = grouped[key];
+      if (b.sources.empty())
+        b.translation = r;
+      b.sources.push_back(s.index());
+      b.targets.push_back(t.index());
+    }
+
+    batches_.clear();
+    batches_.reserve(grouped.size());
+    for (auto& g : grouped)
+      batches_.push_back(g.second);
+    size_ = 0;
+    return true;
+  }
+
+  /** Number of distinct translations */
+  unsigned translations() const {
+    return batches_.size();
+  }
+
+  /** Accumulate the translations of all pairs into the target expansions */
+  void execute(Context& bc) const {
+    execute(bc, has_matrix());
+  }
+
+ private:
+
+  void execute(Context&, std::false_type) const {
+  }
+
+  void execute(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+    const unsigned s = K.expansion_size();
+
+    // (Re)build the translation matrices for the current expansion size
+    if (s != size_) {
+      size_ = s;
+      bool keep = batches_.size() * s * s * sizeof(double) <= max_matrix_storage;
+#pragma omp parallel for schedule(dynamic)
+      for (unsigned i = 0; i < batches_.size(); ++i) {
+        batch& b = batches_[i];
+        if (keep) {
+          b.T.resize(s * s);
+          Op::matrix(K, b.translation, b.T.data());
+        } else {
+          std::vector<double>().swap(b.T);
+        }
+      }
+    }
+
+    std::vector<double> T, X, Y;
+    for (const batch& b : batches_) {
+      const double* Tb = b.T.data();
+      if (b.T.empty()) {
+        T.resize(s * s);
+        Op::matrix(K, b.translation, T.data());
+        Tb = T.data();
+      }
+
+      // Gather the sources as columns, translate, scatter to the targets.
+      // The targets of a batch are distinct.
+      const int n = b.sources.size();
+      X.resize(s * n);
+      Y.assign(s * n, 0);
+#pragma omp parallel for
+      for (int j = 0; j < n; ++j)
+        Op::gather(bc, Op::source(bc, b.sources[j]), &X[j * s]);
+      Gemm(s, n, s, Tb, X.data(), Y.data());
+#pragma omp parallel for
+      for (int j = 0; j < n; ++j)
+        Op::scatter(bc, &Y[j * s], Op::target(bc, b.targets[j]));
+    }
+  }
+};
@@ -2,7 +2,6 @@
 
 #include "EvaluatorBase.hpp"
 #include "EvalP2P.hpp"
-#include "Matvec.hpp"
 
 #include <deque>
 
@@ -26,12 +25,13 @@ class EvalDiagonalSparse
 
   //! matrix pair
   typedef std::pair<int, kernel_value_type> matrix_pair;
-  //! sparse matrix
-  ublas::compressed_matrix<kernel_value_type> A;
+  //! sparse near-field matrix
+  P2P_Matrix<Context> A;
 
  public:
   // constructor -- create matrix
-  EvalDiagonalSparse(Context& bc) {
+  template <typename Options>
+  EvalDiagonalSparse(Context& bc, Options& opts) {
     // Local P2P evaluator to construct the interaction matrix
     P2P_Lazy<Context> p2p_lazy(bc);
 
@@ -46,27 +46,12 @@ class EvalDiagonalSparse
       }
     }
 
-    A = p2p_lazy.to_matrix();
+    A.assemble(p2p_lazy, opts);
   } // end constructor
 
   void execute(Context& bc) const {
-    auto root = bc.source_tree().root();
-    typedef typename Context::charge_type charge_type;
-    ublas::vector<charge_type> charges(bc.source_tree().bodies());
-    std::copy(bc.charge_begin(root), bc.charge_end(root), charges.begin());
-
-    // call the matvec
-    typedef typename Context::result_type result_type;
-    // ublas::vector<result_type> results = ublas::prod(A, charges);
-    // ublas::vector<result_type> results = Matvec(A, charges);
-    ublas::vector<result_type> results = Matvec<ublas::compressed_matrix<kernel_value_type>,
-                                                ublas::vector<charge_type>,
-                                                ublas::vector<result_type>>(A,charges);
-
-    // copy results back into iterator
-    std::transform(results.begin(), results.end(),
-                   bc.result_begin(root), bc.result_begin(root),
-                   std::plus<result_type>());
+    // Accumulate the near-field directly into the results, in tree order
+    A.apply(bc);
   }
 
   template <typename BOX, typename Q>
@@ -83,6 +68,5 @@ class EvalDiagonalSparse
 
 template <typename Context, typename Options>
 EvaluatorBase<Context>* make_sparse_diagonal_eval(Context& bc, Options& opts) {
-  (void) opts;
-  return new EvalDiagonalSparse<Context>(bc);
+  return new EvalDiagonalSparse<Context>(bc, opts);
 }
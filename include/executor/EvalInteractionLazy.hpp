@@ -9,6 +9,12 @@
 #include "P2P.hpp"
 #include "L2P.hpp"
 #include "L2L.hpp"
+#include "ROTATE.hpp"
+#include "EvalBatched.hpp"
+#include "EvalM2L_FFT.hpp"
+#include "EvalM2L_Exp.hpp"
+#include "EvalLeafMatrices.hpp"
+#include "EvalP2P_Packed.hpp"
 
 #include "timing.hpp"
 
@@ -26,7 +32,8 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
   //! Pair of boxees
   typedef std::pair<box_type, box_type> box_pair;
   typedef std::pair<int, int> int_pair;
-  //! List for P2P interactions    TODO: could further compress these...
+  //! List for P2P interactions, source boxes indexed by target box
+  //! TODO: could further compress these...
   mutable std::vector<std::vector<int>> P2P_lists;
   //! List for P2M calls
   mutable std::vector<int> P2M_list;
@@ -34,6 +41,10 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
   mutable std::vector<int_pair> M2M_list;
   //! List for Long-range (M2P / M2L) interactions
   mutable std::vector<int_pair> LR_list;
+  //! LR_list as source boxes indexed by target box, with the M2P of a
+  //! treecode moved down to the target leaves, so every target is written by
+  //! one thread
+  mutable std::vector<std::vector<int>> LR_lists;
   //! List for L2L calls
   mutable std::vector<int_pair> L2L_list;
   //! List for L2P calls
@@ -50,21 +61,57 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
   mutable std::set<unsigned> L2P_set;
   //! keep track of # of sparse matrix entries needed
   mutable std::vector<unsigned> mat_entries;
+  //! Target boxes to evaluate, indexed by box index (empty = all boxes)
+  std::vector<bool> target_mask;
+  //! M2M_list and L2L_list batched by child octant, used if batch_m2m
+  Batched<Context, BatchedM2M> m2m_batched;
+  Batched<Context, BatchedL2L> l2l_batched;
+  bool batch_m2m;
+  //! LR_list batched by translation, used if batch_m2l
+  Batched<Context, BatchedM2L> m2l_batched;
+  bool batch_m2l;
+  //! LR_list in Fourier space, used if fft_m2l
+  M2L_FFT<Context> m2l_fft;
+  bool fft_m2l;
+  //! LR_list through directional plane waves, used if exp_m2l
+  M2L_Exp<Context> m2l_exp;
+  bool exp_m2l;
+  //! P2M and L2P of P2M_list and L2P_list as matrices, if use_leaf_matrices
+  LeafMatrices<Context> leaf_matrices;
+  bool use_leaf_matrices;
+  //! P2P_lists over the sources packed as arrays, used if pack_p2p
+  P2P_Packed<Context> p2p_packed;
+  bool pack_p2p;
 
  public:
 
 	/** Constructor
 	 * Precompute the interaction lists, P2P_list and LR_list
+	 *
+	 * If a target box mask is given, only the target boxes flagged in the
+	 * mask are evaluated. The mask must be closed under taking parents.
+	 *
+	 * The options select the batched translations (see EvalBatched.hpp), the
+	 * M2L in Fourier space (see EvalM2L_FFT.hpp) or through plane waves (see
+	 * EvalM2L_Exp.hpp), the precomputed P2M and L2P of the leaves (see
+	 * EvalLeafMatrices.hpp) and the P2P over packed sources (see
+	 * EvalP2P_Packed.hpp).
 	 */
-	EvalInteractionLazy(Context& bc) : mat_entries(bc.source_tree().bodies()) {
+  template <typename Options>
+	EvalInteractionLazy(Context& bc, Options& opts,
+	                    const std::vector<bool>& mask = std::vector<bool>())
+      : mat_entries(bc.source_tree().bodies()), target_mask(mask),
+        batch_m2m(false), batch_m2l(false), fft_m2l(false),
+        exp_m2l(false), use_leaf_matrices(false), pack_p2p(false) {
     // Queue based tree traversal for P2P, M2P, and/or M2L operations
     // initialise P2P lists
-    auto num_leaves = bc.source_tree().boxes();
+    auto num_leaves = bc.target_tree().boxes();
     P2P_lists.resize(num_leaves);
 
     std::deque<box_pair> pairQ;
-    pairQ.push_back(box_pair(bc.source_tree().root(),
-                             bc.target_tree().root()));
+    if (is_target(bc.target_tree().root()))
+      pairQ.push_back(box_pair(bc.source_tree().root(),
+                               bc.target_tree().root()));
 
     while (!pairQ.empty()) {
       auto b1 = pairQ.front().first;
@@ -76,7 +123,7 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 		      // Both are leaves, P2P
 		      // P2P_list.push_back(std::make_pair(b2.index(),b1.index()));
           // printf("P2P pushing: %d x %d\n",(int)b2.index(), (int)b1.index());
-		      P2P_lists[b1.index()].push_back(b2.index());
+		      P2P_lists[b2.index()].push_back(b1.index());
 	      } else {
 		      // Split the second box into children and interact
 		      auto c_end = b2.child_end();
@@ -105,6 +152,22 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
     }
     // run through interaction lists and generate all call lists
     resolve_LR_interactions(bc);
+    if (opts.rotated_translations)
+      prepare_rotations(bc);
+
+    if (opts.m2m_batched)
+      batch_m2m = (m2m_batched.assemble(bc, M2M_list) &&
+                   l2l_batched.assemble(bc, L2L_list));
+    if (IS_FMM && opts.m2l_batched)
+      batch_m2l = m2l_batched.assemble(bc, LR_list);
+    if (IS_FMM && opts.kifmm_fft && !batch_m2l)
+      fft_m2l = m2l_fft.assemble(bc, LR_list);
+    if (IS_FMM && opts.m2l_exp && !batch_m2l && !fft_m2l)
+      exp_m2l = m2l_exp.assemble(bc, LR_list);
+    if (opts.leaf_matrices)
+      use_leaf_matrices = leaf_matrices.assemble(bc, P2M_list, L2P_list);
+    if (opts.p2p_packed)
+      pack_p2p = p2p_packed.assemble(bc, P2P_lists);
 
     /* print out the # of P2P interactions & estimated sparse matrix size */
     /*
@@ -121,13 +184,21 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 	 */
   void execute(Context& bc) const {
     // Reset/Initialise all multipole & local expansions
-    auto it_end = bc.source_tree().box_end();
-    for (auto it = bc.source_tree().box_begin(); it != it_end; ++it)
-      INITM::eval(bc.kernel(), bc, *it);
-    if (IS_FMM) {
-      auto it_end = bc.target_tree().box_end();
-      for (auto it = bc.target_tree().box_begin(); it != it_end; ++it)
-        INITL::eval(bc.kernel(), bc, *it);
+    if (target_mask.empty()) {
+      auto it_end = bc.source_tree().box_end();
+      for (auto it = bc.source_tree().box_begin(); it != it_end; ++it)
+        INITM::eval(bc.kernel(), bc, *it);
+      if (IS_FMM) {
+        auto it_end = bc.target_tree().box_end();
+        for (auto it = bc.target_tree().box_begin(); it != it_end; ++it)
+          INITL::eval(bc.kernel(), bc, *it);
+      }
+    } else {
+      // Only the expansions reached from the requested targets are used
+      for (auto it = initialised_M.begin(); it != initialised_M.end(); ++it)
+        INITM::eval(bc.kernel(), bc, bc.source_tree().box(*it));
+      for (auto it = initialised_L.begin(); it != initialised_L.end(); ++it)
+        INITL::eval(bc.kernel(), bc, bc.target_tree().box(*it));
     }
     // Generate all Multipole coefficients
     eval_P2M_list(bc);
@@ -154,6 +225,11 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 
  private:
 
+  /** Whether the target box b is to be evaluated */
+  inline bool is_target(const box_type& b) const {
+    return target_mask.empty() || target_mask[b.index()];
+  }
+
   /** Recursively resolve all needed multipole expansions */
   void resolve_multipole(Context& bc, const box_type& b) const
   {
@@ -192,6 +268,8 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
     } else {
       // loop over children and propagate
       for (auto cit=b.child_begin(); cit!=b.child_end(); ++cit) {
+        // skip subtrees without requested targets
+        if (!is_target(*cit)) continue;
 
         if (!initialised_L.count(cit->index())) {
           initialised_L.insert(cit->index());
@@ -209,7 +287,10 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
   // void eval_LR_list(Context& bc) const
   void resolve_LR_interactions(Context& bc) const
   {
+    LR_lists.assign(bc.target_tree().boxes(), std::vector<int>());
     for (auto it=LR_list.begin(); it!=LR_list.end(); ++it) {
+      group_LR(bc, it->first, bc.target_tree().box(it->second));
+
       // resolve all needed multipole expansions from lower levels of the tree
       resolve_multipole(bc, bc.source_tree().box(it->first));
 
@@ -221,10 +302,27 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
     }
   }
 
+  /** Add the source box to the long-range list of the target box, or of its
+   * leaves if the interaction is a M2P */
+  void group_LR(Context& bc, int source, const box_type& target) const
+  {
+    if (IS_FMM || target.is_leaf()) {
+      LR_lists[target.index()].push_back(source);
+      return;
+    }
+    for (auto cit=target.child_begin(); cit!=target.child_end(); ++cit) {
+      if (!is_target(*cit)) continue;
+      group_LR(bc, source, *cit);
+    }
+  }
+
   template <typename Q>
   void interact(Context& bc,
                 const box_type& b1, const box_type& b2,
                 Q& pairQ) const {
+    // prune target boxes that contain no requested targets
+    if (!is_target(b2)) return;
+
     if (bc.accept_multipole(b1, b2)) {
       // These boxes satisfy the multipole acceptance criteria
       // LR_list.push_back(box_pair(b1,b2));
@@ -238,6 +336,10 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 
   void eval_P2P_lists(Context& bc) const
   {
+    if (pack_p2p) {
+      p2p_packed.execute(bc);
+      return;
+    }
     unsigned j;
 #pragma omp parallel for private(j)
     for (unsigned i=0; i<P2P_lists.size(); i++) {
@@ -253,14 +355,38 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 
   void eval_P2M_list(Context& bc) const
   {
+    if (use_leaf_matrices && leaf_matrices.P2M(bc))
+      return;
 #pragma omp parallel for
     for (unsigned i=0; i<P2M_list.size(); i++) {
       P2M::eval(bc.kernel(), bc, bc.source_tree().box(P2M_list[i]));
     }
   }
 
+  /** Prepare the rotations of the M2M, M2L and L2L translations of the
+   * lists, so that the rotated operators only read them when evaluated */
+  void prepare_rotations(Context& bc) const
+  {
+    for (unsigned i=0; i<M2M_list.size(); i++)
+      ROTATE::prepare(bc.kernel(), bc, bc.source_tree().box(M2M_list[i].first), bc.source_tree().box(M2M_list[i].second));
+    if (!IS_FMM) return;
+    for (unsigned i=0; i<LR_lists.size(); i++)
+      for (unsigned j=0; j<LR_lists[i].size(); j++)
+        ROTATE::prepare(bc.kernel(), bc,
+                        bc.source_tree().box(LR_lists[i][j]),
+                        bc.target_tree().box(i));
+    for (unsigned i=0; i<L2L_list.size(); i++)
+      ROTATE::prepare(bc.kernel(), bc,
+                      bc.target_tree().box(L2L_list[i].first),
+                      bc.target_tree().box(L2L_list[i].second));
+  }
+
   void eval_M2M_list(Context& bc) const
   {
+    if (batch_m2m) {
+      m2m_batched.execute(bc);
+      return;
+    }
     for (unsigned i=0; i<M2M_list.size(); i++) {
       M2M::eval(bc.kernel(), bc, bc.source_tree().box(M2M_list[i].first), bc.source_tree().box(M2M_list[i].second));
     }
@@ -268,22 +394,41 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 
   void eval_LR_list(Context& bc) const
   {
-#pragma omp parallel for
-    for (unsigned i=0; i<LR_list.size(); i++) {
-      if (IS_FMM) {
-        M2L::eval(bc.kernel(), bc,
-                  bc.source_tree().box(LR_list[i].first),
-                  bc.target_tree().box(LR_list[i].second));
-      } else {
-        M2P::eval(bc.kernel(), bc,
-                  bc.source_tree().box(LR_list[i].first),
-                  bc.target_tree().box(LR_list[i].second));
+    if (batch_m2l) {
+      m2l_batched.execute(bc);
+      return;
+    }
+    if (fft_m2l) {
+      m2l_fft.execute(bc);
+      return;
+    }
+    if (exp_m2l) {
+      m2l_exp.execute(bc);
+      return;
+    }
+    // Every target box accumulates its own list, in order
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i=0; i<LR_lists.size(); i++) {
+      for (unsigned j=0; j<LR_lists[i].size(); j++) {
+        if (IS_FMM) {
+          M2L::eval(bc.kernel(), bc,
+                    bc.source_tree().box(LR_lists[i][j]),
+                    bc.target_tree().box(i));
+        } else {
+          M2P::eval(bc.kernel(), bc,
+                    bc.source_tree().box(LR_lists[i][j]),
+                    bc.target_tree().box(i));
+        }
       }
     }
   }
 
   void eval_L2L_list(Context& bc) const
   {
+    if (batch_m2m) {
+      l2l_batched.execute(bc);
+      return;
+    }
     for (unsigned i=0; i<L2L_list.size(); i++) {
       L2L::eval(bc.kernel(), bc,
                 bc.target_tree().box(L2L_list[i].first),
@@ -293,6 +438,8 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 
   void eval_L2P_list(Context& bc) const
   {
+    if (use_leaf_matrices && leaf_matrices.L2P(bc))
+      return;
 #pragma omp parallel for
     for (unsigned i=0; i<L2P_list.size(); i++) {
       L2P::eval(bc.kernel(), bc, bc.target_tree().box(L2P_list[i]));
@@ -304,9 +451,49 @@ class EvalInteractionLazy : public EvaluatorBase<Context>
 template <typename Context, typename Options>
 EvaluatorBase<Context>* make_lazy_eval(Context& c, Options& opts) {
   if (opts.evaluator == FMMOptions::FMM) {
-	  return new EvalInteractionLazy<Context, true>(c);
+	  return new EvalInteractionLazy<Context, true>(c, opts);
+  } else if (opts.evaluator == FMMOptions::TREECODE) {
+	  return new EvalInteractionLazy<Context, false>(c, opts);
+  }
+  return nullptr;
+}
+
+/** Make a lazy evaluator restricted to a subset of the targets
+ * @param[in] target_mask Mask over the targets (in original order), true if
+ *                        the result of the target is requested
+ * Only leaves containing requested targets (and their ancestors) receive
+ * P2P, M2L/M2P, L2L and L2P operations. Multipoles are only formed where
+ * needed by those interactions.
+ */
+template <typename Context, typename Options>
+EvaluatorBase<Context>* make_subset_eval(Context& c, Options& opts,
+                                         const std::vector<bool>& target_mask) {
+  typedef typename Context::box_type box_type;
+  auto& tree = c.target_tree();
+
+  // Flag the leaves containing requested targets and all of their ancestors
+  std::vector<bool> box_mask(tree.boxes(), false);
+  auto b_end = tree.box_end();
+  for (auto bi = tree.box_begin(); bi != b_end; ++bi) {
+    if (!bi->is_leaf()) continue;
+
+    auto body_end = bi->body_end();
+    for (auto it = bi->body_begin(); it != body_end; ++it) {
+      if (target_mask[it->number()]) {
+        box_type box = *bi;
+        while (!box_mask[box.index()]) {
+          box_mask[box.index()] = true;
+          box = box.parent();
+        }
+        break;
+      }
+    }
+  }
+
+  if (opts.evaluator == FMMOptions::FMM) {
+	  return new EvalInteractionLazy<Context, true>(c, opts, box_mask);
   } else if (opts.evaluator == FMMOptions::TREECODE) {
-	  return new EvalInteractionLazy<Context, false>(c);
+	  return new EvalInteractionLazy<Context, false>(c, opts, box_mask);
   }
   return nullptr;
 }
@@ -2,7 +2,6 @@
 
 #include "EvaluatorBase.hpp"
 #include "EvalP2P.hpp"
-#include "Matvec.hpp"
 
 #include <deque>
 
@@ -12,6 +11,11 @@
 #include "M2P.hpp"
 #include "L2P.hpp"
 #include "L2L.hpp"
+#include "ROTATE.hpp"
+#include "EvalBatched.hpp"
+#include "EvalM2L_FFT.hpp"
+#include "EvalM2L_Exp.hpp"
+#include "EvalLeafMatrices.hpp"
 
 #include "timing.hpp"
 
@@ -41,6 +45,10 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
   mutable std::vector<int_pair> M2M_list;
   //! List for Long-range (M2P / M2L) interactions
   mutable std::vector<int_pair> LR_list;
+  //! LR_list as source boxes indexed by target box, with the M2P of a
+  //! treecode moved down to the target leaves, so every target is written by
+  //! one thread
+  mutable std::vector<std::vector<int>> LR_lists;
   //! List for L2L calls
   mutable std::vector<int_pair> L2L_list;
   //! List for L2P calls
@@ -58,14 +66,34 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
   //! keep track of # of sparse matrix entries needed
   mutable std::vector<unsigned> mat_entries;
 
-  ublas::compressed_matrix<kernel_value_type> A;
+  P2P_Matrix<Context> A;
+  //! M2M_list and L2L_list batched by child octant, used if batch_m2m
+  Batched<Context, BatchedM2M> m2m_batched;
+  Batched<Context, BatchedL2L> l2l_batched;
+  bool batch_m2m;
+  //! LR_list batched by translation, used if batch_m2l
+  Batched<Context, BatchedM2L> m2l_batched;
+  bool batch_m2l;
+  //! LR_list in Fourier space, used if fft_m2l
+  M2L_FFT<Context> m2l_fft;
+  bool fft_m2l;
+  //! LR_list through directional plane waves, used if exp_m2l
+  M2L_Exp<Context> m2l_exp;
+  bool exp_m2l;
+  //! P2M and L2P of P2M_list and L2P_list as matrices, if use_leaf_matrices
+  LeafMatrices<Context> leaf_matrices;
+  bool use_leaf_matrices;
 
  public:
 
 	/** Constructor
 	 * Precompute the interaction lists, P2P_list and LR_list
 	 */
-	EvalInteractionLazySparse(Context& bc) : mat_entries(bc.source_tree().bodies()) {
+  template <typename Options>
+	EvalInteractionLazySparse(Context& bc, Options& opts)
+      : mat_entries(bc.source_tree().bodies()),
+        batch_m2m(false), batch_m2l(false), fft_m2l(false),
+        exp_m2l(false), use_leaf_matrices(false) {
     // Local P2P evaluator to construct the interaction matrix
     P2P_Lazy<Context> p2p_lazy(bc);
 
@@ -109,17 +137,29 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
       }
     }
 
-    A = p2p_lazy.to_matrix();
+    A.assemble(p2p_lazy, opts);
     // run through interaction lists and generate all call lists
     resolve_LR_interactions(bc);
+    if (opts.rotated_translations)
+      prepare_rotations(bc);
+
+    if (opts.m2m_batched)
+      batch_m2m = (m2m_batched.assemble(bc, M2M_list) &&
+                   l2l_batched.assemble(bc, L2L_list));
+    if (IS_FMM && opts.m2l_batched)
+      batch_m2l = m2l_batched.assemble(bc, LR_list);
+    if (IS_FMM && opts.kifmm_fft && !batch_m2l)
+      fft_m2l = m2l_fft.assemble(bc, LR_list);
+    if (IS_FMM && opts.m2l_exp && !batch_m2l && !fft_m2l)
+      exp_m2l = m2l_exp.assemble(bc, LR_list);
+    if (opts.leaf_matrices)
+      use_leaf_matrices = leaf_matrices.assemble(bc, P2M_list, L2P_list);
 	}
 
 	/** Execute this evaluator by applying the operators to the interaction lists
    *  Note this is implicitly cached as lists generated in the constructor
 	 */
   void execute(Context& bc) const {
-    auto root = bc.source_tree().root();
-
     // Reset/Initialise all multipole & local expansions
     auto it_end = bc.source_tree().box_end();
     for (auto it = bc.source_tree().box_begin(); it != it_end; ++it)
@@ -133,19 +173,8 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
 
     tic = get_time();
     // Matrix-based P2P
-    typedef typename Context::charge_type charge_type;
-    ublas::vector<charge_type> charges(bc.source_tree().bodies());
-    std::copy(bc.charge_begin(root),bc.charge_end(root),charges.begin());
-
-    typedef typename Context::result_type result_type;
-    ublas::vector<result_type> results = Matvec<ublas::compressed_matrix<kernel_value_type>,
-                                                ublas::vector<charge_type>,
-                                                ublas::vector<result_type>>(A,charges);
-
-    // copy results back into iterator
-    std::transform(results.begin(), results.end(),
-                   bc.result_begin(root), bc.result_begin(root),
-                   std::plus<result_type>());
+    // Accumulate the near-field directly into the results, in tree order
+    A.apply(bc);
     toc = get_time();
     p2p_time = toc-tic;
 
@@ -224,7 +253,10 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
   // void eval_LR_list(Context& bc) const
   void resolve_LR_interactions(Context& bc) const
   {
+    LR_lists.assign(bc.target_tree().boxes(), std::vector<int>());
     for (auto it=LR_list.begin(); it!=LR_list.end(); ++it) {
+      group_LR(bc, it->first, bc.target_tree().box(it->second));
+
       // resolve all needed multipole expansions from lower levels of the tree
       resolve_multipole(bc, bc.source_tree().box(it->first));
 
@@ -236,6 +268,19 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
     }
   }
 
+  /** Add the source box to the long-range list of the target box, or of its
+   * leaves if the interaction is a M2P */
+  void group_LR(Context& bc, int source, const box_type& target) const
+  {
+    if (IS_FMM || target.is_leaf()) {
+      LR_lists[target.index()].push_back(source);
+      return;
+    }
+    for (auto cit=target.child_begin(); cit!=target.child_end(); ++cit) {
+      group_LR(bc, source, *cit);
+    }
+  }
+
   template <typename Q>
   void interact(Context& bc,
                 const box_type& b1, const box_type& b2,
@@ -253,14 +298,38 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
 
   void eval_P2M_list(Context& bc) const
   {
+    if (use_leaf_matrices && leaf_matrices.P2M(bc))
+      return;
 #pragma omp parallel for
     for (unsigned i=0; i<P2M_list.size(); i++) {
       P2M::eval(bc.kernel(), bc, bc.source_tree().box(P2M_list[i]));
     }
   }
 
+  /** Prepare the rotations of the M2M, M2L and L2L translations of the
+   * lists, so that the rotated operators only read them when evaluated */
+  void prepare_rotations(Context& bc) const
+  {
+    for (unsigned i=0; i<M2M_list.size(); i++)
+      ROTATE::prepare(bc.kernel(), bc, bc.source_tree().box(M2M_list[i].first), bc.source_tree().box(M2M_list[i].second));
+    if (!IS_FMM) return;
+    for (unsigned i=0; i<LR_lists.size(); i++)
+      for (unsigned j=0; j<LR_lists[i].size(); j++)
+        ROTATE::prepare(bc.kernel(), bc,
+                        bc.source_tree().box(LR_lists[i][j]),
+                        bc.target_tree().box(i));
+    for (unsigned i=0; i<L2L_list.size(); i++)
+      ROTATE::prepare(bc.kernel(), bc,
+                      bc.target_tree().box(L2L_list[i].first),
+                      bc.target_tree().box(L2L_list[i].second));
+  }
+
   void eval_M2M_list(Context& bc) const
   {
+    if (batch_m2m) {
+      m2m_batched.execute(bc);
+      return;
+    }
     for (unsigned i=0; i<M2M_list.size(); i++) {
       M2M::eval(bc.kernel(), bc, bc.source_tree().box(M2M_list[i].first), bc.source_tree().box(M2M_list[i].second));
     }
@@ -268,22 +337,41 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
 
   void eval_LR_list(Context& bc) const
   {
-#pragma omp parallel for
-    for (unsigned i=0; i<LR_list.size(); i++) {
-      if (IS_FMM) {
-        M2L::eval(bc.kernel(), bc,
-                  bc.source_tree().box(LR_list[i].first),
-                  bc.target_tree().box(LR_list[i].second));
-      } else {
-        M2P::eval(bc.kernel(), bc,
-                  bc.source_tree().box(LR_list[i].first),
-                  bc.target_tree().box(LR_list[i].second));
+    if (batch_m2l) {
+      m2l_batched.execute(bc);
+      return;
+    }
+    if (fft_m2l) {
+      m2l_fft.execute(bc);
+      return;
+    }
+    if (exp_m2l) {
+      m2l_exp.execute(bc);
+      return;
+    }
+    // Every target box accumulates its own list, in order
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i=0; i<LR_lists.size(); i++) {
+      for (unsigned j=0; j<LR_lists[i].size(); j++) {
+        if (IS_FMM) {
+          M2L::eval(bc.kernel(), bc,
+                    bc.source_tree().box(LR_lists[i][j]),
+                    bc.target_tree().box(i));
+        } else {
+          M2P::eval(bc.kernel(), bc,
+                    bc.source_tree().box(LR_lists[i][j]),
+                    bc.target_tree().box(i));
+        }
       }
     }
   }
 
   void eval_L2L_list(Context& bc) const
   {
+    if (batch_m2m) {
+      l2l_batched.execute(bc);
+      return;
+    }
     for (unsigned i=0; i<L2L_list.size(); i++) {
       L2L::eval(bc.kernel(), bc,
                 bc.target_tree().box(L2L_list[i].first),
@@ -293,6 +381,8 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
 
   void eval_L2P_list(Context& bc) const
   {
+    if (use_leaf_matrices && leaf_matrices.L2P(bc))
+      return;
 #pragma omp parallel for
     for (unsigned i=0; i<L2P_list.size(); i++) {
       L2P::eval(bc.kernel(), bc, bc.target_tree().box(L2P_list[i]));
@@ -304,9 +394,9 @@ class EvalInteractionLazySparse : public EvaluatorBase<Context>
 template <typename Context, typename Options>
 EvaluatorBase<Context>* make_lazy_sparse_eval(Context& c, Options& opts) {
   if (opts.evaluator == FMMOptions::FMM) {
-	  return new EvalInteractionLazySparse<Context, true>(c);
+	  return new EvalInteractionLazySparse<Context, true>(c, opts);
   } else if (opts.evaluator == FMMOptions::TREECODE) {
-	  return new EvalInteractionLazySparse<Context, false>(c);
+	  return new EvalInteractionLazySparse<Context, false>(c, opts);
   }
   return nullptr;
 }
@@ -0,0 +1,178 @@
+#pragma once
+/** @file EvalLeafMatrices.hpp
+ * @brief P2M and L2P of the leaves as precomputed dense matrices
+ *
+ * For a fixed geometry only the charges change between evaluations, so the
+ * P2M of a leaf is a fixed linear map from its charges to its multipole and
+ * the L2P a fixed linear map from its local expansion to its results. Both
+ * are built once, and every evaluation is a small matrix-vector product.
+ *
+ * A kernel with scalar charges and results opts in by providing
+ *   template <typename SourceIter>
+ *   void P2M_matrix(SourceIter s_begin, SourceIter s_end,
+ *                   const point_type& center, double* A) const;
+ *   template <typename TargetIter>
+ *   void L2P_matrix(const point_type& center,
+ *                   TargetIter t_begin, TargetIter t_end, double* B) const;
+ * and the vector form of its expansions (see EvalBatched.hpp), where A is
+ * the column-major expansion_size() x #sources matrix and B the
+ * column-major #targets x expansion_size() matrix.
+ */
+
+#include "KernelTraits.hpp"
+#include "Gemm.hpp"
+
+#include <vector>
+#include <iterator>
+#include <cstdio>
+#include <type_traits>
+
+template <typename Context>
+class LeafMatrices
+{
+  typedef typename Context::kernel_type kernel_type;
+  typedef typename Context::box_type box_type;
+  typedef ExpansionTraits<kernel_type> traits;
+  typedef std::integral_constant<bool,
+      traits::has_P2M_matrix && traits::has_L2P_matrix> has_matrix;
+
+  //! Leaves of the P2M and L2P, by box index
+  std::vector<unsigned> P2M_boxes_;
+  std::vector<unsigned> L2P_boxes_;
+  //! The matrices of the leaves in the above order
+  mutable std::vector<std::vector<double>> P2M_;
+  mutable std::vector<std::vector<double>> L2P_;
+  //! Size of the vector form of the expansions the matrices were built for
+  mutable unsigned size_;
+
+  //! Largest total size of the matrices in bytes
+  static constexpr std::size_t max_matrix_storage = std::size_t(1) << 30;
+
+ public:
+  LeafMatrices()
+      : size_(0) {
+  }
+
+  /** Build the P2M and L2P matrices of the leaves
+   * @returns false if the kernel has no matrices or they would not fit
+   */
+  template <typename BoxList>
+  bool assemble(Context& bc, const BoxList& P2M_list, const BoxList& L2P_list) {
+    if (!has_matrix::value) {
+      printf("[W]: Kernel has no P2M_matrix or L2P_matrix -- "
+             "leaf matrices ignored\n");
+      return false;
+    }
+
+    P2M_boxes_.assign(P2M_list.begin(), P2M_list.end());
+    L2P_boxes_.assign(L2P_list.begin(), L2P_list.end());
+    size_ = 0;
+    if (!build(bc, has_matrix())) {
+      printf("[W]: Leaf matrices exceed %zuMB -- leaf matrices ignored\n",
+             max_matrix_storage >> 20);
+      return false;
+    }
+    return true;
+  }
+
+  /** Accumulate the P2M of all leaves into their multipole expansions
+   * @returns false if the matrices could not be built for the current
+   * expansion order, then nothing is evaluated
+   */
+  bool P2M(Context& bc) const {
+    return P2M(bc, has_matrix());
+  }
+
+  /** Accumulate the L2P of all leaves into their results
+   * @returns false if the matrices could not be built for the current
+   * expansion order, then nothing is evaluated
+   */
+  bool L2P(Context& bc) const {
+    return L2P(bc, has_matrix());
+  }
+
+ private:
+
+  static unsigned num_bodies(const box_type& b) {
+    return std::distance(b.body_begin(), b.body_end());
+  }
+
+  bool build(Context&, std::false_type) const {
+    return false;
+  }
+  bool P2M(Context&, std::false_type) const {
+    return false;
+  }
+  bool L2P(Context&, std::false_type) const {
+    return false;
+  }
+
+  /** (Re)build the matrices for the current expansion size */
+  bool build(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+    const unsigned s = K.expansion_size();
+    if (s == size_) return true;
+
+    std::size_t entries = 0;
+    for (unsigned b : P2M_boxes_)
+      entries += s * num_bodies(bc.source_tree().box(b));
+    for (unsigned b : L2P_boxes_)
+      entries += s * num_bodies(bc.target_tree().box(b));
+    if (entries * sizeof(double) > max_matrix_storage)
+      return false;
+
+    size_ = s;
+    P2M_.resize(P2M_boxes_.size());
+    L2P_.resize(L2P_boxes_.size());
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < P2M_boxes_.size(); ++i) {
+      auto box = bc.source_tree().box(P2M_boxes_[i]);
+      P2M_[i].resize(s * num_bodies(box));
+      K.P2M_matrix(bc.source_begin(box), bc.source_end(box),
+                   bc.center(box), P2M_[i].data());
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < L2P_boxes_.size(); ++i) {
+      auto box = bc.target_tree().box(L2P_boxes_[i]);
+      L2P_[i].resize(s * num_bodies(box));
+      K.L2P_matrix(bc.center(box), bc.target_begin(box), bc.target_end(box),
+                   L2P_[i].data());
+    }
+    return true;
+  }
+
+  bool P2M(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+    if (!build(bc, std::true_type()))
+      return false;
+
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < P2M_boxes_.size(); ++i) {
+      auto box = bc.source_tree().box(P2M_boxes_[i]);
+      std::vector<double> c(bc.charge_begin(box), bc.charge_end(box));
+      std::vector<double> v(size_, 0);
+      Gemm(size_, 1, c.size(), P2M_[i].data(), c.data(), v.data());
+      K.vector_to_multipole(v.data(), bc.multipole_expansion(box));
+    }
+    return true;
+  }
+
+  bool L2P(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+    if (!build(bc, std::true_type()))
+      return false;
+
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < L2P_boxes_.size(); ++i) {
+      auto box = bc.target_tree().box(L2P_boxes_[i]);
+      const unsigned n = num_bodies(box);
+      std::vector<double> v(size_), r(n, 0);
+      K.local_to_vector(bc.local_expansion(box), v.data());
+      Gemm(n, 1, size_, L2P_[i].data(), v.data(), r.data());
+      auto ri = bc.result_begin(box);
+      for (unsigned j = 0; j < n; ++j, ++ri)
+        *ri += r[j];
+    }
+    return true;
+  }
+};
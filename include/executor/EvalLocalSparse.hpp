@@ -2,7 +2,6 @@
 
 #include "EvaluatorBase.hpp"
 #include "EvalP2P.hpp"
-#include "Matvec.hpp"
 
 #include <deque>
 
@@ -26,12 +25,13 @@ class EvalLocalSparse
 
   //! matrix pair
   typedef std::pair<int, kernel_value_type> matrix_pair;
-  //! sparse matrix
-  ublas::compressed_matrix<kernel_value_type> A;
+  //! sparse near-field matrix
+  P2P_Matrix<Context> A;
 
  public:
   // constructor -- create matrix
-  EvalLocalSparse(Context& bc) {
+  template <typename Options>
+  EvalLocalSparse(Context& bc, Options& opts) {
     // Local P2P evaluator to construct the interaction matrix
     P2P_Lazy<Context> p2p_lazy(bc);
 
@@ -76,41 +76,12 @@ class EvalLocalSparse
       }
     }
 
-    A = p2p_lazy.to_matrix();
+    A.assemble(p2p_lazy, opts);
   } // end constructor
 
   void execute(Context& bc) const {
-    // printf("EvalLocalSparse::execute(Context&)\n");
-    // do shit here
-    auto root = bc.source_tree().root();
-
-    //double tic, toc;
-    //static double t_charge = 0., t_result = 0.;
-
-    //tic = get_time();
-    typedef typename Context::charge_type charge_type;
-    ublas::vector<charge_type> charges(bc.source_tree().bodies());
-    std::copy(bc.charge_begin(root), bc.charge_end(root), charges.begin());
-    //toc = get_time();
-    //t_charge += toc-tic;
-
-    // call the matvec
-    typedef typename Context::result_type result_type;
-    // ublas::vector<result_type> results = ublas::prod(A, charges);
-    // ublas::vector<result_type> results = Matvec(A, charges);
-    ublas::vector<result_type> results = Matvec<ublas::compressed_matrix<kernel_value_type>,
-                                                ublas::vector<charge_type>,
-                                                ublas::vector<result_type>>(A,charges);
-
-    // copy results back into iterator
-    //tic = get_time();
-    std::transform(results.begin(), results.end(),
-                   bc.result_begin(root), bc.result_begin(root),
-                   std::plus<result_type>());
-    //toc = get_time();
-    //t_result += toc-tic;
-
-    //printf("charge copy: %.3es, result copy: %.3es\n",t_charge, t_result);
+    // Accumulate the near-field directly into the results, in tree order
+    A.apply(bc);
   }
 
   template <typename BOX, typename Q>
@@ -127,6 +98,5 @@ class EvalLocalSparse
 
 template <typename Context, typename Options>
 EvaluatorBase<Context>* make_sparse_local_eval(Context& bc, Options& opts) {
-  (void) opts;
-  return new EvalLocalSparse<Context>(bc);
+  return new EvalLocalSparse<Context>(bc, opts);
 }
@@ -0,0 +1,256 @@
+#pragma once
+/** @file EvalM2L_Exp.hpp
+ * @brief M2L of a list of box pairs through directional plane waves
+ *
+ * The pairs of boxes of one side are split into six directional lists
+ * (+x,-x,+y,-y,+z,-z) by the dominant axis of their translation. In a list
+ * the M2L factors into an exponential expansion per source box, a diagonal
+ * translation per pair and one conversion to the local expansion per target
+ * box, which sums the translated expansions of all its sources first. The
+ * pairs the kernel cannot represent, such as boxes of different sides, use
+ * the kernel's M2L.
+ *
+ * A kernel opts in by providing
+ *   typedef std::complex<real> exp_type;
+ *   unsigned M2L_exp_size(double side) const;  // plane waves per expansion
+ *   int M2L_exp_direction(const point_type& translation, double side) const;
+ *   void M2L_exp_multipole(const multipole_type& M, double side, int dir,
+ *                          exp_type* X) const;
+ *   void M2L_exp_translation(const point_type& translation, double side,
+ *                            int dir, exp_type* T) const;
+ *   void M2L_exp_local(const exp_type* Y, double side, int dir,
+ *                      local_type& L) const;
+ * where M2L_exp_direction returns -1 for the pairs it cannot represent and
+ * M2L_exp_local accumulates into the local expansion.
+ */
+
+#include "KernelTraits.hpp"
+#include "M2L.hpp"
+
+#include <map>
+#include <array>
+#include <tuple>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <complex>
+#include <algorithm>
+#include <type_traits>
+
+template <typename Context>
+class M2L_Exp
+{
+  typedef typename Context::kernel_type kernel_type;
+  typedef typename Context::box_type box_type;
+  typedef typename kernel_type::point_type point_type;
+  typedef std::integral_constant<bool,
+      ExpansionTraits<kernel_type>::has_M2L_exp> has_exp;
+
+  //! The kernel's exp_type, or a placeholder if it has no plane-wave M2L
+  template <typename K, bool = has_exp::value>
+  struct exp_type_of { typedef std::complex<double> type; };
+  template <typename K>
+  struct exp_type_of<K, true> { typedef typename K::exp_type type; };
+  typedef typename exp_type_of<kernel_type>::type exp_type;
+
+  //! An expansion in a direction: of a source box or a translation
+  struct expansion {
+    point_type translation;
+    unsigned box;
+    double side;
+    int dir;
+    //! Offset of its plane waves
+    std::size_t offset;
+  };
+  //! A source of a target box in a direction and the translation between them
+  struct source_translation {
+    int dir;
+    unsigned source;
+    unsigned translation;
+    bool operator<(const source_translation& other) const {
+      return dir < other.dir;
+    }
+  };
+
+  std::vector<expansion> sources_;
+  std::vector<expansion> translations_;
+  //! Target boxes, by box index, their sources, and the sources of the
+  //! kernel's M2L
+  std::vector<unsigned> targets_;
+  std::vector<std::vector<source_translation>> target_sources_;
+  std::vector<std::vector<unsigned>> target_direct_;
+  //! Plane waves per expansion of the targets
+  std::vector<unsigned> target_size_;
+
+  //! The source expansions and the translations
+  mutable std::vector<exp_type> X_;
+  mutable std::vector<exp_type> T_;
+  std::size_t X_size_, T_size_;
+
+  //! Largest total size of the expansions and translations in bytes
+  static constexpr std::size_t max_exp_storage = std::size_t(1) << 30;
+
+ public:
+  M2L_Exp()
+      : X_size_(0), T_size_(0) {
+  }
+
+  /** Split the (source, target) box index pairs into directional lists
+   * @returns false if the kernel has no plane-wave M2L or the expansions
+   * would not fit
+   */
+  template <typename PairList>
+  bool assemble(Context& bc, const PairList& pairs) {
+    return assemble(bc, pairs, has_exp());
+  }
+
+  /** Number of distinct translations */
+  unsigned translations() const {
+    return translations_.size();
+  }
+
+  /** Accumulate the M2L of all pairs into the target local expansions */
+  void execute(Context& bc) const {
+    execute(bc, has_exp());
+  }
+
+ private:
+
+  template <typename PairList>
+  bool assemble(Context&, const PairList&, std::false_type) {
+    printf("[W]: Kernel has no M2L_exp -- plane-wave M2L ignored\n");
+    return false;
+  }
+
+  template <typename PairList>
+  bool assemble(Context& bc, const PairList& pairs, std::true_type) {
+    const kernel_type& K = bc.kernel();
+    sources_.clear();
+    translations_.clear();
+    targets_.clear();
+    target_sources_.clear();
+    target_direct_.clear();
+    target_size_.clear();
+    X_size_ = T_size_ = 0;
+
+    std::map<std::pair<unsigned,int>, unsigned> source_id;
+    std::map<unsigned, unsigned> target_id;
+    std::map<std::tuple<double,int,long long,long long,long long>, unsigned>
+        translation_id;
+    for (auto it = pairs.begin(); it != pairs.end(); ++it) {
+      box_type s = bc.source_tree().box(it->first);
+      box_type t = bc.target_tree().box(it->second);
+      point_type r = bc.center(t) - bc.center(s);
+      const double side = t.side_length();
+
+      auto gi = target_id.insert(std::make_pair(t.index(), targets_.size()));
+      if (gi.second) {
+        targets_.push_back(t.index());
+        target_sources_.resize(targets_.size());
+        target_direct_.resize(targets_.size());
+        target_size_.push_back(K.M2L_exp_size(side));
+      }
+      const unsigned ti = gi.first->second;
+
+      int dir = -1;
+      if (std::fabs(s.side_length() - side) <= 1e-12 * side)
+        dir = K.M2L_exp_direction(r, side);
+      if (dir < 0) {
+        target_direct_[ti].push_back(s.index());
+        continue;
+      }
+      const std::size_t n = target_size_[ti];
+
+      // In units of the side, as in EvalBatched.hpp
+      auto key = std::make_tuple(side, dir,
+                                 std::llround(std::ldexp(r[0] / side, 32)),
+                                 std::llround(std::ldexp(r[1] / side, 32)),
+                                 std::llround(std::ldexp(r[2] / side, 32)));
+      auto tr = translation_id.insert(std::make_pair(key, translations_.size()));
+      if (tr.second) {
+        translations_.push_back(expansion{r, 0, side, dir, T_size_});
+        T_size_ += n;
+      }
+      auto si = source_id.insert(std::make_pair(std::make_pair(s.index(), dir),
+                                                sources_.size()));
+      if (si.second) {
+        sources_.push_back(expansion{r, s.index(), side, dir, X_size_});
+        X_size_ += n;
+      }
+      target_sources_[ti].push_back(
+          source_translation{dir, si.first->second, tr.first->second});
+    }
+
+    // Group the sources of every target by direction
+    for (auto& ts : target_sources_)
+      std::stable_sort(ts.begin(), ts.end());
+
+    const std::size_t bytes = (X_size_ + T_size_) * sizeof(exp_type);
+    if (bytes > max_exp_storage) {
+      printf("[W]: Plane-wave M2L needs %zuMB, exceeds %zuMB -- "
+             "plane-wave M2L ignored\n", bytes >> 20, max_exp_storage >> 20);
+      return false;
+    }
+    T_.clear();
+    return true;
+  }
+
+  void execute(Context&, std::false_type) const {
+  }
+
+  void execute(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+
+    // The translations only depend on the geometry
+    if (T_.size() != T_size_) {
+      T_.resize(T_size_);
+#pragma omp parallel for schedule(dynamic)
+      for (unsigned i = 0; i < translations_.size(); ++i) {
+        const expansion& e = translations_[i];
+        K.M2L_exp_translation(e.translation, e.side, e.dir, &T_[e.offset]);
+      }
+    }
+
+    // Exponential expansion of every source once per direction
+    X_.resize(X_size_);
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < sources_.size(); ++i) {
+      const expansion& e = sources_[i];
+      K.M2L_exp_multipole(bc.multipole_expansion(bc.source_tree().box(e.box)),
+                          e.side, e.dir, &X_[e.offset]);
+    }
+
+    // Sum the translated expansions of every target per direction
+#pragma omp parallel
+    {
+      std::vector<exp_type> Y;
+#pragma omp for schedule(dynamic)
+      for (unsigned i = 0; i < targets_.size(); ++i) {
+        box_type t = bc.target_tree().box(targets_[i]);
+        const auto& ts = target_sources_[i];
+        const unsigned n = target_size_[i];
+        for (unsigned j = 0; j < ts.size(); ) {
+          const int dir = ts[j].dir;
+          Y.assign(n, exp_type(0));
+          for ( ; j < ts.size() && ts[j].dir == dir; ++j) {
+            // Spelled out, std::complex products check for inf and nan
+            typedef typename exp_type::value_type real;
+            const real* X = reinterpret_cast<const real*>(
+                &X_[sources_[ts[j].source].offset]);
+            const real* T = reinterpret_cast<const real*>(
+                &T_[translations_[ts[j].translation].offset]);
+            real* y = reinterpret_cast<real*>(Y.data());
+            for (unsigned k = 0; k < 2*n; k += 2) {
+              y[k]   += X[k] * T[k]   - X[k+1] * T[k+1];
+              y[k+1] += X[k] * T[k+1] + X[k+1] * T[k];
+            }
+          }
+          K.M2L_exp_local(Y.data(), t.side_length(), dir,
+                          bc.local_expansion(t));
+        }
+        for (unsigned s : target_direct_[i])
+          M2L::eval(K, bc, bc.source_tree().box(s), t);
+      }
+    }
+  }
+};
@@ -0,0 +1,291 @@
+#pragma once
+/** @file EvalM2L_FFT.hpp
+ * @brief M2L of a list of box pairs as pointwise products in Fourier space
+ *
+ * If the M2L is a convolution of the multipole with a function of the
+ * translation, it is a pointwise product of their Fourier transforms. Every
+ * source multipole is transformed once, the translations take only a few
+ * distinct values and are transformed once, and the up to 189 products of a
+ * target box are summed before a single inverse transform. The transforms
+ * may depend on the sides of the source and the target box: a source is
+ * transformed once per side of its targets, and a target sums the products
+ * of its sources of each side separately.
+ *
+ * A kernel opts in by providing
+ *   typedef std::complex<real> fft_type;
+ *   unsigned M2L_fft_size(double source_side, double target_side) const;
+ *   void M2L_fft_multipole(const multipole_type& M, double source_side,
+ *                          double target_side, fft_type* Mhat) const;
+ *   void M2L_fft_translation(const point_type& translation,
+ *                            double source_side, double target_side,
+ *                            fft_type* That) const;
+ *   void M2L_fft_local(const fft_type* Lhat, double source_side,
+ *                      double target_side, local_type& L) const;
+ * where M2L_fft_size is the number of Fourier coefficients per component, 0
+ * for the pairs the kernel cannot transform, which use the kernel's M2L, and
+ * M2L_fft_local accumulates into the local expansion. A kernel whose
+ * transforms are C x R matrices, from C components of the multipole to R of
+ * the local expansion, also provides
+ *   unsigned M2L_fft_charges() const;  // C
+ *   unsigned M2L_fft_results() const;  // R
+ * Then Mhat has C components, Lhat has R and That has R*C, row-major.
+ *
+ * The N^3 products of a pair only pay off against an M2L that is expensive
+ * per pair, e.g. that of KIFMM.hpp, which evaluates the kernel between the
+ * surfaces of the boxes. KIFMM kernels use it unless
+ * FMMOptions::kifmm_fft is off (-kifmm_direct).
+ */
+
+#include "KernelTraits.hpp"
+#include "M2L.hpp"
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <complex>
+#include <algorithm>
+#include <type_traits>
+
+template <typename Context>
+class M2L_FFT
+{
+  typedef typename Context::kernel_type kernel_type;
+  typedef typename Context::box_type box_type;
+  typedef typename kernel_type::point_type point_type;
+  typedef std::integral_constant<bool,
+      ExpansionTraits<kernel_type>::has_M2L_fft> has_fft;
+
+  //! The kernel's fft_type, or a placeholder if it has no FFT-based M2L
+  template <typename K, bool = has_fft::value>
+  struct fft_type_of { typedef std::complex<double> type; };
+  template <typename K>
+  struct fft_type_of<K, true> { typedef typename K::fft_type type; };
+  typedef typename fft_type_of<kernel_type>::type fft_type;
+
+  //! A transform of a source box or of a translation, towards a target side
+  struct transform {
+    point_type translation;
+    unsigned box;
+    double source_side;
+    double target_side;
+    //! Offset of its Fourier coefficients
+    std::size_t offset;
+  };
+  //! A source of a target box and the translation between them
+  struct source_translation {
+    double source_side;
+    unsigned source;
+    unsigned translation;
+    bool operator<(const source_translation& other) const {
+      return source_side < other.source_side;
+    }
+  };
+
+  std::vector<transform> sources_;
+  std::vector<transform> translations_;
+  //! Target boxes, by box index, their sources, and the sources of the
+  //! kernel's M2L
+  std::vector<unsigned> targets_;
+  std::vector<std::vector<source_translation>> target_sources_;
+  std::vector<std::vector<unsigned>> target_direct_;
+
+  //! Transforms of the translations and of the source multipoles
+  mutable std::vector<fft_type> That_;
+  mutable std::vector<fft_type> Mhat_;
+  std::size_t Mhat_size_, That_size_;
+
+  //! Largest total size of the transforms in bytes
+  static constexpr std::size_t max_fft_storage = std::size_t(1) << 30;
+
+ public:
+  M2L_FFT()
+      : Mhat_size_(0), That_size_(0) {
+  }
+
+  /** Group the (source, target) box index pairs by target and translation
+   * @returns false if the kernel has no FFT-based M2L or the transforms
+   * would not fit
+   */
+  template <typename PairList>
+  bool assemble(Context& bc, const PairList& pairs) {
+    return assemble(bc, pairs, has_fft());
+  }
+
+  /** Number of distinct translations */
+  unsigned translations() const {
+    return translations_.size();
+  }
+
+  /** Accumulate the M2L of all pairs into the target local expansions */
+  void execute(Context& bc) const {
+    execute(bc, has_fft());
+  }
+
+ private:
+
+  template <typename PairList>
+  bool assemble(Context&, const PairList&, std::false_type) {
+    return false;
+  }
+
+  template <typename PairList>
+  bool assemble(Context& bc, const PairList& pairs, std::true_type) {
+    const kernel_type& K = bc.kernel();
+    const std::size_t C = fft_charges(K, 0), R = fft_results(K, 0);
+    sources_.clear();
+    translations_.clear();
+    targets_.clear();
+    target_sources_.clear();
+    target_direct_.clear();
+    Mhat_size_ = That_size_ = 0;
+
+    std::map<std::pair<unsigned,double>, unsigned> source_id;
+    std::map<unsigned, unsigned> target_id;
+    std::map<std::tuple<double,double,long long,long long,long long>, unsigned>
+        translation_id;
+    for (auto it = pairs.begin(); it != pairs.end(); ++it) {
+      box_type s = bc.source_tree().box(it->first);
+      box_type t = bc.target_tree().box(it->second);
+      point_type r = bc.center(t) - bc.center(s);
+      const double source_side = s.side_length();
+      const double side = t.side_length();
+
+      auto gi = target_id.insert(std::make_pair(t.index(), targets_.size()));
+      if (gi.second) {
+        targets_.push_back(t.index());
+        target_sources_.resize(targets_.size());
+        target_direct_.resize(targets_.size());
+      }
+      const unsigned ti = gi.first->second;
+
+      const std::size_t n = K.M2L_fft_size(source_side, side);
+      if (n == 0) {
+        target_direct_[ti].push_back(s.index());
+        continue;
+      }
+
+      // In units of the target side, as in EvalBatched.hpp
+      auto key = std::make_tuple(source_side, side,
+                                 std::llround(std::ldexp(r[0] / side, 32)),
+                                 std::llround(std::ldexp(r[1] / side, 32)),
+                                 std::llround(std::ldexp(r[2] / side, 32)));
+      auto tr = translation_id.insert(std::make_pair(key, translations_.size()));
+      if (tr.second) {
+        translations_.push_back(
+            transform{r, 0, source_side, side, That_size_});
+        That_size_ += R * C * n;
+      }
+      auto si = source_id.insert(std::make_pair(std::make_pair(s.index(), side),
+                                                sources_.size()));
+      if (si.second) {
+        sources_.push_back(
+            transform{r, s.index(), source_side, side, Mhat_size_});
+        Mhat_size_ += C * n;
+      }
+      target_sources_[ti].push_back(
+          source_translation{source_side, si.first->second, tr.first->second});
+    }
+
+    // Group the sources of every target by side
+    for (auto& ts : target_sources_)
+      std::stable_sort(ts.begin(), ts.end());
+
+    const std::size_t bytes = (Mhat_size_ + That_size_) * sizeof(fft_type);
+    if (bytes > max_fft_storage) {
+      printf("[W]: FFT-based M2L needs %zuMB, exceeds %zuMB -- "
+             "FFT-based M2L ignored\n", bytes >> 20, max_fft_storage >> 20);
+      return false;
+    }
+    That_.clear();
+    return true;
+  }
+
+  void execute(Context&, std::false_type) const {
+  }
+
+  void execute(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+    const unsigned C = fft_charges(K, 0), R = fft_results(K, 0);
+
+    // The transforms of the translations only depend on the geometry
+    if (That_.size() != That_size_) {
+      That_.resize(That_size_);
+#pragma omp parallel for schedule(dynamic)
+      for (unsigned i = 0; i < translations_.size(); ++i) {
+        const transform& e = translations_[i];
+        K.M2L_fft_translation(e.translation, e.source_side, e.target_side,
+                              &That_[e.offset]);
+      }
+    }
+
+    // Forward transform of every source once per target side
+    Mhat_.resize(Mhat_size_);
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < sources_.size(); ++i) {
+      const transform& e = sources_[i];
+      K.M2L_fft_multipole(bc.multipole_expansion(bc.source_tree().box(e.box)),
+                          e.source_side, e.target_side, &Mhat_[e.offset]);
+    }
+
+    // Sum the products of every target, one inverse transform per side of
+    // its sources
+#pragma omp parallel
+    {
+      std::vector<fft_type> Lhat;
+#pragma omp for schedule(dynamic)
+      for (unsigned i = 0; i < targets_.size(); ++i) {
+        box_type t = bc.target_tree().box(targets_[i]);
+        const double side = t.side_length();
+        const auto& ts = target_sources_[i];
+        for (unsigned j = 0; j < ts.size(); ) {
+          const double source_side = ts[j].source_side;
+          const std::size_t n = K.M2L_fft_size(source_side, side);
+          Lhat.assign(R * n, fft_type(0));
+          for ( ; j < ts.size() && ts[j].source_side == source_side; ++j) {
+            const std::size_t Moffset = sources_[ts[j].source].offset;
+            const std::size_t Toffset = translations_[ts[j].translation].offset;
+            for (unsigned r = 0; r < R; ++r)
+              for (unsigned c = 0; c < C; ++c) {
+                // Spelled out, std::complex products check for inf and nan
+                typedef typename fft_type::value_type real;
+                const real* M = reinterpret_cast<const real*>(
+                    &Mhat_[Moffset + c * n]);
+                const real* T = reinterpret_cast<const real*>(
+                    &That_[Toffset + (r * C + c) * n]);
+                real* L = reinterpret_cast<real*>(&Lhat[r * n]);
+                for (std::size_t k = 0; k < 2*n; k += 2) {
+                  L[k]   += M[k] * T[k]   - M[k+1] * T[k+1];
+                  L[k+1] += M[k] * T[k+1] + M[k+1] * T[k];
+                }
+              }
+          }
+          K.M2L_fft_local(Lhat.data(), source_side, side,
+                          bc.local_expansion(t));
+        }
+        for (unsigned s : target_direct_[i])
+          M2L::eval(K, bc, bc.source_tree().box(s), t);
+      }
+    }
+  }
+
+  /** Components of the multipole transforms, 1 unless the kernel says */
+  template <typename K>
+  static auto fft_charges(const K& k, int) -> decltype(k.M2L_fft_charges()) {
+    return k.M2L_fft_charges();
+  }
+  template <typename K>
+  static unsigned fft_charges(const K&, long) {
+    return 1;
+  }
+  /** Components of the local transforms, 1 unless the kernel says */
+  template <typename K>
+  static auto fft_results(const K& k, int) -> decltype(k.M2L_fft_results()) {
+    return k.M2L_fft_results();
+  }
+  template <typename K>
+  static unsigned fft_results(const K&, long) {
+    return 1;
+  }
+};
@@ -1,12 +1,14 @@
 #pragma once
 
-#define BOOST_UBLAS_NDEBUG
-#include <boost/numeric/ublas/matrix_sparse.hpp>
-namespace ublas = boost::numeric::ublas;
-
 #include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
 
 #include "P2P.hpp"
+#include "SparseMatrix.hpp"
+#include "BlockSparseMatrix.hpp"
+#include "Matvec.hpp"
 
 /** A lazy P2P evaluator which saves a list of pairs of boxes
  * That are sent to the P2P dispatcher on demand.
@@ -32,6 +34,16 @@ class P2P_Lazy
       : bc(_bc) {
   }
 
+  /** The context of this interaction list */
+  Context& context() const {
+    return bc;
+  }
+
+  /** The (source, target) box pairs of the interaction list */
+  const std::vector<box_pair>& interactions() const {
+    return p2p_list;
+  }
+
   /** Insert a source-target box interaction to the interaction list */
   void insert(const box_type& box1, const box_type& box2) {
     p2p_list.push_back(std::make_pair(box1,box2));
@@ -43,57 +55,477 @@ class P2P_Lazy
       P2P::eval(bc.kernel(), bc, b2b.first, b2b.second, P2P::ONE_SIDED());
   }
 
-  /** Convert the interaction list to an interaction matrix */
-  ublas::compressed_matrix<kernel_value_type> to_matrix() {
+  /** Convert the interaction list to an interaction matrix
+   * Rows and columns of the matrix are the targets and sources in tree order.
+   * Assembled in two passes, counting then filling, parallel over target boxes
+   */
+  SparseMatrix<unsigned, kernel_value_type> to_matrix() const {
     auto first_source = bc.source_begin(bc.source_tree().root());
     auto first_target = bc.target_begin(bc.target_tree().root());
 
-    // Interaction list for each target body
     unsigned rows = bc.target_tree().bodies();
-    unsigned cols = 0;
-    unsigned nnz = 0;
-    std::vector<std::vector<unsigned>> csr(rows);
-
-    for (const box_pair& b2b : p2p_list) {
-      const box_type& box1 = b2b.first;
-      const box_type& box2 = b2b.second;
-
-      auto source_end = bc.source_end(box1);
-      auto target_end = bc.target_end(box2);
-      for (auto t = bc.target_begin(box2); t != target_end; ++t) {
-        // Row
-        unsigned i = t - first_target;
-        std::vector<unsigned>& csri = csr[i];
-
-        for (auto s = bc.source_begin(box1); s != source_end; ++s) {
-          // Column
-          unsigned j = s - first_source;
-
-          //assert(std::find(csri.begin(), csri.end(), j) == csri.end());
-          csri.push_back(j);
-          ++nnz;
-          cols = std::max(cols, j);
+    unsigned cols = bc.source_tree().bodies();
+
+    // Source boxes of each target box, in order
+    std::vector<std::vector<box_type>> sources;
+    std::vector<unsigned> targets;
+    group_by_target(sources, targets);
+
+    SparseMatrix<unsigned, kernel_value_type> m(rows, cols, 0);
+    std::fill(m.offsets.begin(), m.offsets.end(), 0);
+
+    // Pass 1: count the entries of each row
+#pragma omp parallel for
+    for (unsigned k = 0; k < targets.size(); ++k) {
+      const box_type box = bc.target_tree().box(targets[k]);
+      std::size_t row_nnz = 0;
+      for (const box_type& sbox : sources[box.index()])
+        row_nnz += bc.source_end(sbox) - bc.source_begin(sbox);
+
+      auto target_end = bc.target_end(box);
+      for (auto t = bc.target_begin(box); t != target_end; ++t)
+        m.offsets[(t - first_target) + 1] = row_nnz;
+    }
+    std::partial_sum(m.offsets.begin(), m.offsets.end(), m.offsets.begin());
+    m.resize(rows, cols, m.offsets[rows]);
+
+    // Pass 2: fill the rows
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned k = 0; k < targets.size(); ++k) {
+      const box_type box = bc.target_tree().box(targets[k]);
+
+      auto target_end = bc.target_end(box);
+      for (auto t = bc.target_begin(box); t != target_end; ++t) {
+        std::size_t jj = m.offsets[t - first_target];
+        const auto& target = *t;
+
+        for (const box_type& sbox : sources[box.index()]) {
+          auto source_end = bc.source_end(sbox);
+          for (auto s = bc.source_begin(sbox); s != source_end; ++s, ++jj) {
+            m.indices[jj] = s - first_source;
+            m.vals[jj] = bc.kernel()(target, *s);
+          }
         }
       }
     }
-    ++cols;
 
-    // The precomputed interaction matrix
-    ublas::compressed_matrix<kernel_value_type> m(rows, cols, nnz);
+    return m;
+  }
+
+  /** Convert the interaction list to a block sparse interaction matrix
+   * with one dense block per (source leaf, target leaf) pair.
+   * Rows and columns of the matrix are the targets and sources in tree order.
+   * @tparam V The type the kernel values are stored as
+   */
+  template <typename V = kernel_value_type>
+  BlockSparseMatrix<V> to_block_matrix() const {
+    typedef typename BlockSparseMatrix<V>::block block;
+    auto first_source = bc.source_begin(bc.source_tree().root());
+    auto first_target = bc.target_begin(bc.target_tree().root());
+
+    // Source boxes of each target box, in order
+    std::vector<std::vector<box_type>> sources;
+    std::vector<unsigned> targets;
+    group_by_target(sources, targets);
+
+    BlockSparseMatrix<V> m;
+    m.rows = bc.target_tree().bodies();
+    m.cols = bc.source_tree().bodies();
 
-    typedef typename kernel_type::source_type source_type;
-    typedef typename kernel_type::target_type target_type;
-    for (unsigned i = 0; i < csr.size(); ++i) {
-      // Insert elements to compressed_matrix in-order for efficiency
-      std::sort(csr[i].begin(), csr[i].end());
-      const target_type& target = first_target[i];
+    // Lay out the blocks of every target box
+    std::size_t offset = 0;
+    m.group_offsets.assign(1, 0);
+    for (unsigned k = 0; k < targets.size(); ++k) {
+      const box_type box = bc.target_tree().box(targets[k]);
+      block b;
+      b.row_begin = bc.target_begin(box) - first_target;
+      b.rows = bc.target_end(box) - bc.target_begin(box);
 
-      for (unsigned j : csr[i]) {
-        const source_type& source = first_source[j];
-        m.push_back(i, j, bc.kernel()(target, source));
+      for (const box_type& sbox : sources[box.index()]) {
+        b.col_begin = bc.source_begin(sbox) - first_source;
+        b.cols = bc.source_end(sbox) - bc.source_begin(sbox);
+        b.offset = offset;
+        offset += std::size_t(b.rows) * b.cols;
+        m.blocks.push_back(b);
       }
+      m.group_offsets.push_back(m.blocks.size());
+    }
+    m.vals.resize(offset);
+
+    // Fill the blocks
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned g = 0; g < m.groups(); ++g) {
+      for (unsigned k = m.group_offsets[g]; k < m.group_offsets[g+1]; ++k)
+        fill_block(m.blocks[k], &m.vals[m.blocks[k].offset]);
     }
 
     return m;
   }
+
+ private:
+
+  /** Group the source boxes of the interaction list by target box
+   * @param[out] sources The source boxes of each target box sorted by their
+   *                     first body, indexed by target box index
+   * @param[out] targets The target boxes with at least one source box
+   */
+  void group_by_target(std::vector<std::vector<box_type>>& sources,
+                       std::vector<unsigned>& targets) const {
+    auto first_source = bc.source_begin(bc.source_tree().root());
+
+    sources.assign(bc.target_tree().boxes(), std::vector<box_type>());
+    for (const box_pair& b2b : p2p_list)
+      sources[b2b.second.index()].push_back(b2b.first);
+
+    targets.clear();
+    for (unsigned k = 0; k < sources.size(); ++k) {
+      if (sources[k].empty()) continue;
+      targets.push_back(k);
+      // Insert columns in-order for efficiency
+      std::sort(sources[k].begin(), sources[k].end(),
+                [&](const box_type& a, const box_type& b) {
+                  return bc.source_begin(a) - first_source
+                       < bc.source_begin(b) - first_source;
+                });
+    }
+  }
+
+  /** Evaluate the kernel for all entries of a dense, row-major block */
+  template <typename Block, typename V>
+  void fill_block(const Block& b, V* v) const {
+    auto first_source = bc.source_begin(bc.source_tree().root());
+    auto first_target = bc.target_begin(bc.target_tree().root());
+
+    for (unsigned r = 0; r < b.rows; ++r) {
+      const auto& target = first_target[b.row_begin + r];
+      auto s = first_source + b.col_begin;
+      for (unsigned c = 0; c < b.cols; ++c, ++v)
+        *v = V(bc.kernel()(target, s[c]));
+    }
+  }
+};
+
+
+/** Precomputed near-field operator assembled from a P2P_Lazy interaction list
+ * Stored either element-wise in CSR or as dense leaf-pair blocks, selected by
+ * FMMOptions::sparse_format.
+ *
+ * With a memory budget (FMMOptions::sparse_memory_budget) the leaf-pair
+ * blocks are assembled hottest first -- the pairs of closest leaves, whose
+ * kernel values are the most expensive (e.g. semi-analytical integrals).
+ * The hottest blocks are stored in double and, for arithmetic kernel
+ * values, the overflow in float, as many in double as fit with the rest in
+ * float. The pairs that do not fit even in float are recomputed with P2P on
+ * every application.
+ *
+ * With FMMOptions::sparse_symmetric and a kernel with a transpose, a single
+ * tree stores only one block of every pair of leaves interacting both ways,
+ * K(t,s) with s < t, and applies K(s,t) = transpose(K(t,s)) from it.
+ *
+ * While the kernel allows it (single_precision_near_field), an operator
+ * with arithmetic values is applied from a float copy of the matrix, made
+ * on first use, halving the memory traffic of the SpMV. With a memory
+ * budget the copy is only made if it fits in what the blocks left.
+ */
+template <typename Context>
+class P2P_Matrix {
+  //! Kernel type
+  typedef typename Context::kernel_type kernel_type;
+  //! Kernel value type
+  typedef typename Context::kernel_value_type kernel_value_type;
+  //! Compressed kernel value type
+  typedef typename std::conditional<std::is_arithmetic<kernel_value_type>::value,
+                                    float,
+                                    kernel_value_type>::type compressed_value_type;
+  //! Type of box
+  typedef typename Context::box_type box_type;
+  typedef std::pair<box_type,box_type> box_pair;
+
+  //! Storage format in use
+  typename FMMOptions::SparseFormat format_;
+  //! Element-wise storage
+  SparseMatrix<unsigned, kernel_value_type> csr_;
+  //! Leaf-pair block storage
+  BlockSparseMatrix<kernel_value_type> block_;
+  //! Compressed leaf-pair blocks, the overflow of a memory budget
+  BlockSparseMatrix<compressed_value_type> compressed_;
+  //! Memory budget in bytes, 0 for none, and the bytes used by the blocks
+  std::size_t budget_, budget_used_;
+  //! Source boxes recomputed on the fly, indexed by target box
+  std::vector<std::vector<box_type>> recompute_;
+  //! Target boxes with recomputed source boxes
+  std::vector<unsigned> recompute_targets_;
+  //! Whether the upper blocks of a symmetric near-field are stored
+  bool symmetric_;
+  //! Upper blocks K(t,s), s < t, of the leaf pairs interacting both ways
+  BlockSparseMatrix<kernel_value_type> upper_;
+  //! Groups of upper_ by color, writing disjoint rows, see color_groups
+  std::vector<std::vector<unsigned>> upper_colors_;
+  //! Single precision copies of csr_ and block_, made on first use
+  mutable SparseMatrix<unsigned, compressed_value_type> csr_single_;
+  mutable BlockSparseMatrix<compressed_value_type> block_single_;
+  mutable bool has_single_;
+  //! Whether the single precision copies were tried
+  mutable bool single_tried_;
+
+  typedef std::integral_constant<bool, KernelTraits<kernel_type>::has_transpose>
+      has_transpose;
+
+ public:
+  P2P_Matrix()
+      : format_(FMMOptions::CSR), budget_(0), budget_used_(0),
+        symmetric_(false), has_single_(false), single_tried_(false) {
+  }
+
+  /** Assemble the interaction list into the format requested in opts */
+  template <typename Options>
+  void assemble(const P2P_Lazy<Context>& p2p, Options& opts) {
+    format_ = opts.sparse_format;
+    budget_ = 0;
+    compressed_ = BlockSparseMatrix<compressed_value_type>();
+    has_single_ = single_tried_ = false;
+    if (opts.sparse_memory_budget > 0) {
+      if (format_ != FMMOptions::BLOCK)
+        printf("[W]: Memory budgeted near-field uses BLOCK storage\n");
+      if (opts.sparse_symmetric)
+        printf("[W]: Symmetric near-field ignored with a memory budget\n");
+      format_ = FMMOptions::BLOCK;
+      assemble_budgeted(p2p, opts.sparse_memory_budget);
+    } else if (opts.sparse_symmetric) {
+      assemble_symmetric(p2p, has_transpose());
+    } else if (format_ == FMMOptions::BLOCK) {
+      block_ = p2p.to_block_matrix();
+    } else {
+      csr_ = p2p.to_matrix();
+    }
+  }
+
+  /** Accumulate the near-field into the results of the context,
+   * reading the charges and writing the results in tree order */
+  void apply(Context& bc) const {
+    auto root = bc.source_tree().root();
+    if (std::is_arithmetic<kernel_value_type>::value
+        && single_precision(bc.kernel(), 0) && make_single()) {
+      if (format_ == FMMOptions::BLOCK)
+        Matvec(block_single_, bc.charge_begin(root), bc.result_begin(root));
+      else
+        Matvec(csr_single_, bc.charge_begin(root), bc.result_begin(root));
+    } else if (format_ == FMMOptions::BLOCK) {
+      if (!block_.blocks.empty())
+        Matvec(block_, bc.charge_begin(root), bc.result_begin(root));
+    } else {
+      Matvec(csr_, bc.charge_begin(root), bc.result_begin(root));
+    }
+    if (!compressed_.blocks.empty())
+      Matvec(compressed_, bc.charge_begin(root), bc.result_begin(root));
+    if (symmetric_)
+      apply_upper(bc, has_transpose());
+
+    // Pairs outside of the memory budget, parallel over target boxes
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned k = 0; k < recompute_targets_.size(); ++k) {
+      const box_type target = bc.target_tree().box(recompute_targets_[k]);
+      for (const box_type& source : recompute_[target.index()])
+        P2P::eval(bc.kernel(), bc, source, target, P2P::ONE_SIDED());
+    }
+  }
+
+  /** Storage used by the operator in bytes */
+  std::size_t storage_size() const {
+    if (format_ == FMMOptions::BLOCK)
+      return block_.storage_size() + compressed_.storage_size()
+           + upper_.storage_size()
+           + (has_single_ ? block_single_.storage_size() : 0);
+    return csr_.storage_size()
+         + (has_single_ ? csr_single_.storage_size() : 0);
+  }
+
+ private:
+
+  /** Split the interaction list into the leaf pairs interacting both ways,
+   * of which only K(t,s) with s < t is stored, and the remaining pairs
+   * (diagonal blocks and one way pairs), which are stored in full.
+   */
+  void assemble_symmetric(const P2P_Lazy<Context>& p2p, std::true_type) {
+    Context& bc = p2p.context();
+    const std::vector<box_pair>& pairs = p2p.interactions();
+
+    if (&bc.source_tree() != &bc.target_tree()) {
+      printf("[W]: Symmetric near-field needs a single tree -- "
+             "storing all blocks\n");
+      assemble_symmetric(p2p, std::false_type());
+      return;
+    }
+    if (format_ != FMMOptions::BLOCK)
+      printf("[W]: Symmetric near-field uses BLOCK storage\n");
+    format_ = FMMOptions::BLOCK;
+
+    // Sorted (source, target) keys to find the pairs interacting both ways
+    std::vector<unsigned long long> keys(pairs.size());
+    for (unsigned k = 0; k < pairs.size(); ++k)
+      keys[k] = pair_key(pairs[k].first.index(), pairs[k].second.index());
+    std::sort(keys.begin(), keys.end());
+
+    P2P_Lazy<Context> full(bc), upper(bc);
+    for (const box_pair& b2b : pairs) {
+      unsigned s = b2b.first.index();
+      unsigned t = b2b.second.index();
+      if (s != t && std::binary_search(keys.begin(), keys.end(),
+                                       pair_key(t, s))) {
+        if (s < t)
+          upper.insert(b2b.first, b2b.second);
+      } else {
+        full.insert(b2b.first, b2b.second);
+      }
+    }
+
+    block_ = full.to_block_matrix();
+    upper_ = upper.to_block_matrix();
+    upper_colors_ = color_groups(upper_);
+    symmetric_ = true;
+
+    printf("Near-field: %d of %d leaf pairs stored once (symmetric, "
+           "%d colors), %d stored in full\n",
+           (int)upper.interactions().size(), (int)pairs.size(),
+           (int)upper_colors_.size(), (int)full.interactions().size());
+  }
+
+  /** Kernels without a transpose store all blocks */
+  void assemble_symmetric(const P2P_Lazy<Context>& p2p, std::false_type) {
+    if (KernelTraits<kernel_type>::has_transpose == false)
+      printf("[W]: Symmetric near-field needs Kernel::transpose -- "
+             "storing all blocks\n");
+    if (format_ == FMMOptions::BLOCK)
+      block_ = p2p.to_block_matrix();
+    else
+      csr_ = p2p.to_matrix();
+  }
+
+  /** Whether a kernel with single_precision_near_field() applies the near
+   * field in single precision */
+  template <typename Kernel>
+  static auto single_precision(const Kernel& K, int)
+      -> decltype(bool(K.single_precision_near_field())) {
+    return K.single_precision_near_field();
+  }
+  template <typename Kernel>
+  static bool single_precision(const Kernel&, long) {
+    return false;
+  }
+
+  /** Make the single precision copy of csr_ or block_ on first use, unless
+   * it exceeds the memory budget
+   * @returns whether the copy was made
+   */
+  bool make_single() const {
+    if (single_tried_)
+      return has_single_;
+    single_tried_ = true;
+    if (format_ == FMMOptions::BLOCK) {
+      typedef typename BlockSparseMatrix<compressed_value_type>::block block;
+      const std::size_t size = block_.nnz() * sizeof(compressed_value_type)
+                             + block_.blocks.size() * sizeof(block);
+      if (budget_ > 0 && budget_used_ + size > budget_) {
+        printf("[W]: Single precision near-field needs %.4gMB more than "
+               "the memory budget -- applying in double\n",
+               (budget_used_ + size - budget_) / 1024. / 1024.);
+        return false;
+      }
+      block_single_ = BlockSparseMatrix<compressed_value_type>(block_);
+    } else {
+      csr_single_ = SparseMatrix<unsigned, compressed_value_type>(csr_);
+    }
+    has_single_ = true;
+    return true;
+  }
+
+  static unsigned long long pair_key(unsigned s, unsigned t) {
+    return ((unsigned long long)s << 32) | t;
+  }
+
+  /** Accumulate the upper blocks and their transposes */
+  void apply_upper(Context& bc, std::true_type) const {
+    auto root = bc.source_tree().root();
+    const kernel_type& K = bc.kernel();
+    MatvecSymmetric(upper_, upper_colors_,
+                    [&K](const kernel_value_type& kts) {
+                      return K.transpose(kts);
+                    },
+                    bc.charge_begin(root), bc.result_begin(root));
+  }
+
+  void apply_upper(Context&, std::false_type) const {
+  }
+
+  /** Assemble the hottest leaf pairs that fit in budget bytes, the hottest
+   * in double and the overflow compressed */
+  void assemble_budgeted(const P2P_Lazy<Context>& p2p, std::size_t budget) {
+    Context& bc = p2p.context();
+    const std::vector<box_pair>& pairs = p2p.interactions();
+    typedef typename BlockSparseMatrix<kernel_value_type>::block block;
+
+    // Order the pairs from the closest (hottest) to the furthest leaves
+    std::vector<double> dist(pairs.size());
+    std::vector<unsigned> order(pairs.size());
+    std::vector<std::size_t> entries(pairs.size());
+    for (unsigned k = 0; k < pairs.size(); ++k) {
+      const box_type& s = pairs[k].first;
+      const box_type& t = pairs[k].second;
+      dist[k] = norm(bc.center(s) - bc.center(t)) / (s.radius() + t.radius());
+      order[k] = k;
+      entries[k] = std::size_t(bc.source_end(s) - bc.source_begin(s))
+                 * (bc.target_end(t) - bc.target_begin(t));
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](unsigned a, unsigned b) { return dist[a] < dist[b]; });
+
+    // The hottest pairs that fit compressed, then as many of them in double
+    // as fit with the rest compressed
+    std::size_t used = 0;
+    unsigned stored = 0;
+    for ( ; stored < order.size(); ++stored) {
+      std::size_t size = entries[order[stored]] * sizeof(compressed_value_type)
+                       + sizeof(block);
+      if (used + size > budget) break;
+      used += size;
+    }
+    unsigned doubled = 0;
+    for ( ; doubled < stored; ++doubled) {
+      std::size_t extra = entries[order[doubled]]
+          * (sizeof(kernel_value_type) - sizeof(compressed_value_type));
+      if (used + extra > budget) break;
+      used += extra;
+    }
+
+    P2P_Lazy<Context> assembled(bc), compressed(bc), recomputed(bc);
+    for (unsigned k = 0; k < order.size(); ++k) {
+      const box_pair& b2b = pairs[order[k]];
+      if (k < doubled)
+        assembled.insert(b2b.first, b2b.second);
+      else if (k < stored)
+        compressed.insert(b2b.first, b2b.second);
+      else
+        recomputed.insert(b2b.first, b2b.second);
+    }
+
+    block_ = assembled.to_block_matrix();
+    compressed_ = compressed.template to_block_matrix<compressed_value_type>();
+    budget_ = budget;
+    budget_used_ = used;
+
+    // Group the recomputed pairs by target box
+    recompute_.assign(bc.target_tree().boxes(), std::vector<box_type>());
+    recompute_targets_.clear();
+    for (const box_pair& b2b : recomputed.interactions()) {
+      if (recompute_[b2b.second.index()].empty())
+        recompute_targets_.push_back(b2b.second.index());
+      recompute_[b2b.second.index()].push_back(b2b.first);
+    }
+
+    printf("Near-field: %d of %d leaf pairs assembled (%d double, "
+           "%d compressed, %.4gMB), %d recomputed\n",
+           (int)stored, (int)pairs.size(), (int)doubled,
+           (int)(stored - doubled), used / 1024. / 1024.,
+           (int)recomputed.interactions().size());
+  }
 };
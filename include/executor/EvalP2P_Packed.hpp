@@ -0,0 +1,136 @@
+#pragma once
+/** @file EvalP2P_Packed.hpp
+ * @brief P2P of the leaves over their sources packed as aligned arrays
+ *
+ * The sources of the tree are accessed through the permutation of the
+ * context and the kernel is evaluated one pair at a time, which does not
+ * vectorize. Instead the coordinates of the sources of every leaf are copied
+ * once into aligned structure-of-arrays packs (see SourcePack.hpp), their
+ * charges once per evaluation, and the kernel sums a whole pack for one
+ * target in a loop it can vectorize.
+ *
+ * A kernel opts in by providing
+ *   typedef SourcePack<real,C> source_pack_type;  // C charge components
+ *   void operator()(const target_type& t, const source_pack_type& s,
+ *                   result_type& r) const;
+ * which accumulates sum_j K(t,s_j) * c_j into r.
+ */
+
+#include "KernelTraits.hpp"
+#include "SourcePack.hpp"
+
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <iterator>
+#include <type_traits>
+
+template <typename Context>
+class P2P_Packed
+{
+  typedef typename Context::kernel_type kernel_type;
+  typedef typename Context::box_type box_type;
+  typedef KernelTraits<kernel_type> traits;
+  typedef std::integral_constant<bool, traits::has_pack_op> has_pack;
+
+  //! The kernel's source_pack_type, or a placeholder if it has no packed P2P
+  template <typename K, bool = has_pack::value>
+  struct pack_type_of { typedef SourcePack<double,1> type; };
+  template <typename K>
+  struct pack_type_of<K, true> { typedef typename K::source_pack_type type; };
+  typedef typename pack_type_of<kernel_type>::type pack_type;
+
+  //! Source leaves, by box index, in the order of their packs
+  std::vector<unsigned> sources_;
+  //! Target leaves, by box index, and the packs of their sources
+  std::vector<unsigned> targets_;
+  std::vector<std::vector<unsigned>> target_packs_;
+
+  //! Coordinates and charges of the source leaves
+  mutable SourcePackBuffer<pack_type> packs_;
+
+ public:
+
+  /** Pack the coordinates of the source leaves of the P2P lists
+   * @param[in] P2P_lists The source leaves, by box index, of every target
+   *                      box, indexed by box index
+   * @returns false if the kernel has no packed P2P or the packs could not
+   * be allocated
+   */
+  template <typename ListOfLists>
+  bool assemble(Context& bc, const ListOfLists& P2P_lists) {
+    return assemble(bc, P2P_lists, has_pack());
+  }
+
+  /** Accumulate the P2P of all lists into the target results */
+  void execute(Context& bc) const {
+    execute(bc, has_pack());
+  }
+
+ private:
+
+  static unsigned num_bodies(const box_type& b) {
+    return std::distance(b.body_begin(), b.body_end());
+  }
+
+  template <typename ListOfLists>
+  bool assemble(Context&, const ListOfLists&, std::false_type) {
+    printf("[W]: Kernel has no packed operator() -- packed P2P ignored\n");
+    return false;
+  }
+
+  template <typename ListOfLists>
+  bool assemble(Context& bc, const ListOfLists& P2P_lists, std::true_type) {
+    sources_.clear();
+    targets_.clear();
+    target_packs_.clear();
+
+    std::map<unsigned, unsigned> source_id;
+    for (unsigned t = 0; t < P2P_lists.size(); ++t) {
+      if (P2P_lists[t].empty()) continue;
+      targets_.push_back(t);
+      target_packs_.push_back(std::vector<unsigned>());
+      for (auto s : P2P_lists[t]) {
+        auto si = source_id.insert(std::make_pair(unsigned(s), sources_.size()));
+        if (si.second)
+          sources_.push_back(s);
+        target_packs_.back().push_back(si.first->second);
+      }
+    }
+
+    std::vector<unsigned> counts;
+    for (unsigned s : sources_)
+      counts.push_back(num_bodies(bc.source_tree().box(s)));
+    if (!packs_.reserve(counts.begin(), counts.end())) {
+      printf("[W]: Packed P2P ignored\n");
+      return false;
+    }
+
+#pragma omp parallel for
+    for (unsigned i = 0; i < sources_.size(); ++i)
+      packs_.set_sources(i, bc.source_begin(bc.source_tree().box(sources_[i])));
+    return true;
+  }
+
+  void execute(Context&, std::false_type) const {
+  }
+
+  void execute(Context& bc, std::true_type) const {
+    const kernel_type& K = bc.kernel();
+
+    // The charges change between evaluations
+#pragma omp parallel for
+    for (unsigned i = 0; i < sources_.size(); ++i)
+      packs_.set_charges(i, bc.charge_begin(bc.source_tree().box(sources_[i])));
+
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned i = 0; i < targets_.size(); ++i) {
+      box_type t = bc.target_tree().box(targets_[i]);
+      auto ri = bc.result_begin(t);
+      auto t_end = bc.target_end(t);
+      for (auto ti = bc.target_begin(t); ti != t_end; ++ti, ++ri)
+        for (unsigned p : target_packs_[i])
+          K(*ti, packs_.pack(p), *ri);
+    }
+  }
+};
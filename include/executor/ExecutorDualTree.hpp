@@ -111,6 +111,12 @@ class ExecutorDualTree : public ExecutorBase<Kernel>
   //! Local expansions corresponding to Box indices in Tree
   typedef std::vector<local_type> local_container;
   local_container L_;
+  //! Contiguous storage of the expansion coefficients, if the kernel has it
+  ExpansionArena M_arena_, L_arena_;
+  //! Whether to bind the expansions to contiguous storage
+  bool use_arena_;
+  //! Whether to back the contiguous storage with huge pages
+  bool huge_pages_;
 
   //! The sources associated with bodies in the source_tree
   typedef const std::vector<source_type> source_container;
@@ -148,6 +154,8 @@ class ExecutorDualTree : public ExecutorBase<Kernel>
         acceptMultipole(opts.MAC()),
         M_(source_tree_.boxes()),
         L_((opts.evaluator == FMMOptions::TREECODE ? 0 : target_tree_.boxes())),
+        use_arena_(opts.expansion_arena),
+        huge_pages_(opts.huge_pages),
         sources(sfirst, slast),
         targets(tfirst, tlast) {
     s_ = sources.begin();
@@ -165,9 +173,44 @@ class ExecutorDualTree : public ExecutorBase<Kernel>
     t_ = targets.begin();
     r_ = results.begin();
 
+    bind_expansions();
     evals_.execute(*this);
   }
 
+  /** Execute an evaluator that is not part of this executor's collection,
+   * e.g. an evaluator restricted to a subset of the targets
+   */
+  void execute(const std::vector<charge_type>& charges,
+               std::vector<result_type>& results,
+               const EvaluatorBase<self_type>& eval) {
+    s_ = sources.begin();
+    c_ = charges.begin();
+    t_ = targets.begin();
+    r_ = results.begin();
+
+    bind_expansions();
+    eval.execute(*this);
+  }
+
+  /** Bind the expansions of all boxes to contiguous storage laid out for the
+   * current expansion order of the kernel, which may change between executes
+   */
+  void bind_expansions() {
+    if (!use_arena_) return;
+    typedef ExpansionTraits<kernel_type> traits;
+    const bool M_bound = (BIND::multipoles(K_, M_, M_arena_, huge_pages_) ||
+                          !traits::has_multipole_stride);
+    const bool L_bound = (BIND::locals(K_, L_, L_arena_, huge_pages_) ||
+                          !traits::has_local_stride);
+    if (!M_bound || !L_bound) {
+      // Give all expansions their own coefficients again and stop binding
+      printf("[W]: Expansion arena disabled\n");
+      M_.assign(M_.size(), multipole_type());
+      L_.assign(L_.size(), local_type());
+      use_arena_ = false;
+    }
+  }
+
   bool accept_multipole(const box_type& source, const box_type& target) const {
     return acceptMultipole(source, target);
   }
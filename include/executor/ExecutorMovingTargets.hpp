@@ -0,0 +1,236 @@
+#pragma once
+
+#include "ExecutorStreaming.hpp"
+
+#include "Direct.hpp"
+
+/** @class ExecutorMovingTargets
+ * @brief Evaluate the field of fixed sources and charges at targets that move
+ * between evaluations.
+ *
+ * The first execute bins the targets into a target tree and computes the
+ * local expansions of all target boxes, which are kept. After the targets
+ * have moved, a target that is still inside its leaf only gets L2P with the
+ * kept local expansion and P2P with the leaf's near-field source boxes at its
+ * new position. Only targets that left their leaf are re-binned into the leaf
+ * of the target tree now containing them. Targets that left the target tree
+ * entirely (orphans) are summed directly against all sources while they fit
+ * in a leaf; past that they are binned into a target tree of their own and
+ * evaluated as in ExecutorStreaming.
+ *
+ * Local expansions are only kept for the FMM. With a treecode every move
+ * rebuilds the target tree and re-evaluates all targets.
+ */
+template <typename SourceContext>
+class ExecutorMovingTargets : public ExecutorStreaming<SourceContext>
+{
+  typedef ExecutorStreaming<SourceContext> super_type;
+
+ public:
+  typedef typename super_type::tree_type tree_type;
+  typedef typename super_type::box_type box_type;
+  typedef typename super_type::kernel_type kernel_type;
+  typedef typename super_type::point_type point_type;
+  typedef typename super_type::target_type target_type;
+  typedef typename super_type::result_type result_type;
+
+ protected:
+  using super_type::sc_;
+  using super_type::is_fmm_;
+  using super_type::targets;
+  using super_type::results;
+  using super_type::P2P_lists;
+
+  //! Marker of a target outside of all leaves of the target tree
+  static constexpr unsigned orphan = unsigned(-1);
+  //! Leaf box index of each target
+  std::vector<unsigned> leaf_;
+  //! Targets of each leaf box, indexed by box index
+  std::vector<std::vector<unsigned>> leaf_targets_;
+  //! Targets outside of all leaves
+  std::vector<unsigned> orphans_;
+  //! Evaluator of the orphans binned into their own target tree
+  super_type orphan_eval_;
+
+ public:
+  //! Constructor
+  template <typename Options>
+  ExecutorMovingTargets(SourceContext& sc, Options& opts)
+      : super_type(sc, opts), orphan_eval_(sc, opts) {
+  }
+
+  /** Initial evaluation: build the target tree and its local expansions
+   * @param[in] first,last The targets
+   * @param[out] out Output iterator the results are written to, in order
+   */
+  template <typename TargetIter, typename ResultIter>
+  ResultIter execute(TargetIter first, TargetIter last, ResultIter out) {
+    out = super_type::execute(first, last, out);
+
+    // Record the leaf of every target
+    leaf_.assign(targets.size(), orphan);
+    orphans_.clear();
+    if (targets.empty())
+      return out;
+
+    tree_type& tree = this->target_tree();
+    auto b_end = tree.box_end();
+    for (auto bi = tree.box_begin(); bi != b_end; ++bi) {
+      if (!bi->is_leaf()) continue;
+      auto body_end = bi->body_end();
+      for (auto it = bi->body_begin(); it != body_end; ++it)
+        leaf_[it->number()] = bi->index();
+    }
+    return out;
+  }
+
+  /** Evaluate after the targets have moved
+   * @param[in] first,last The new positions of the targets, in the same order
+   *                       and of the same number as in the initial execute
+   * @param[out] out Output iterator the results are written to, in order
+   */
+  template <typename TargetIter, typename ResultIter>
+  ResultIter move(TargetIter first, TargetIter last, ResultIter out) {
+    if (!is_fmm_ || leaf_.empty())
+      return execute(first, last, out);
+
+    targets.assign(first, last);
+    if (targets.size() != leaf_.size()) {
+      printf("[W]: Number of moving targets changed -- re-binning all..\n");
+      std::vector<target_type> moved(targets);
+      return execute(moved.begin(), moved.end(), out);
+    }
+
+    rebin();
+
+    const kernel_type& K = this->kernel();
+    tree_type& tree = this->target_tree();
+    results.assign(targets.size(), result_type());
+
+    // L2P with the kept local expansions and P2P at the new positions
+    int num_boxes = tree.boxes();
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_boxes; ++i) {
+      auto& idx = leaf_targets_[i];
+      if (idx.empty()) continue;
+
+      std::vector<target_type> t(idx.size());
+      std::vector<result_type> r(idx.size(), result_type());
+      for (unsigned k = 0; k < idx.size(); ++k)
+        t[k] = targets[idx[k]];
+
+      box_type box = tree.box(i);
+      L2P::eval(K, this->local_expansion(box), this->center(box),
+                t.begin(), t.end(), r.begin());
+
+      auto& p2p = P2P_lists[i];
+      for (unsigned j = 0; j < p2p.size(); ++j) {
+        box_type sbox = this->source_tree().box(p2p[j]);
+        Direct::matvec(K,
+                       sc_.source_begin(sbox), sc_.source_end(sbox),
+                       sc_.charge_begin(sbox),
+                       t.begin(), t.end(), r.begin());
+      }
+
+      for (unsigned k = 0; k < idx.size(); ++k)
+        results[idx[k]] = r[k];
+    }
+
+    // Targets outside of the target tree see all sources directly, unless
+    // there are more than a leaf of them
+    if (orphans_.size() > this->ncrit_) {
+      std::vector<target_type> t(orphans_.size());
+      std::vector<result_type> r(orphans_.size());
+      for (unsigned k = 0; k < orphans_.size(); ++k)
+        t[k] = targets[orphans_[k]];
+      orphan_eval_.execute(t.begin(), t.end(), r.begin());
+      for (unsigned k = 0; k < orphans_.size(); ++k)
+        results[orphans_[k]] = r[k];
+    } else {
+      box_type root = this->source_tree().root();
+#pragma omp parallel for
+      for (unsigned k = 0; k < orphans_.size(); ++k) {
+        unsigned i = orphans_[k];
+        Direct::matvec(K,
+                       sc_.source_begin(root), sc_.source_end(root),
+                       sc_.charge_begin(root),
+                       targets.begin() + i, targets.begin() + i + 1,
+                       results.begin() + i);
+      }
+    }
+
+    return std::copy(results.begin(), results.end(), out);
+  }
+
+  //! The number of targets outside of the target tree after the last move
+  unsigned orphans() const {
+    return orphans_.size();
+  }
+
+ protected:
+
+  /** Whether the point p is inside the box b */
+  static bool contains(const box_type& b, const point_type& p) {
+    point_type d = p - b.center();
+    point_type e = b.extents();
+    for (unsigned k = 0; k < d.size(); ++k)
+      if (std::abs(d[k]) > e[k] / 2) return false;
+    return true;
+  }
+
+  /** Find the leaf containing the point p by descending the target tree
+   * @returns The box index of the leaf or orphan if there is none
+   */
+  unsigned find_leaf(const point_type& p) {
+    box_type b = this->target_tree().root();
+    if (!contains(b, p)) return orphan;
+
+    while (!b.is_leaf()) {
+      bool found = false;
+      auto c_end = b.child_end();
+      for (auto cit = b.child_begin(); cit != c_end; ++cit) {
+        if (contains(*cit, p)) {
+          b = *cit;
+          found = true;
+          break;
+        }
+      }
+      // p is in an octant without any of the original targets
+      if (!found) return orphan;
+    }
+    return b.index();
+  }
+
+  /** Re-bin the targets that left their leaf and regroup targets by leaf */
+  void rebin() {
+    tree_type& tree = this->target_tree();
+    unsigned rebinned = 0;
+
+#pragma omp parallel for reduction(+:rebinned)
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      point_type p = static_cast<point_type>(targets[i]);
+      if (leaf_[i] != orphan && contains(tree.box(leaf_[i]), p))
+        continue;
+      leaf_[i] = find_leaf(p);
+      ++rebinned;
+    }
+
+    leaf_targets_.assign(tree.boxes(), std::vector<unsigned>());
+    orphans_.clear();
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      if (leaf_[i] == orphan)
+        orphans_.push_back(i);
+      else
+        leaf_targets_[leaf_[i]].push_back(i);
+    }
+
+#ifdef DEBUG
+    printf("Moving targets: %d re-binned, %d outside of tree\n",
+           rebinned, (int)orphans_.size());
+#endif
+  }
+};
+
+/** Annoying C++ */
+template <typename SourceContext>
+constexpr unsigned ExecutorMovingTargets<SourceContext>::orphan;
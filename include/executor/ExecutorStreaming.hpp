@@ -0,0 +1,334 @@
+#pragma once
+
+#include "EvaluatorBase.hpp"
+
+#include "INITL.hpp"
+#include "M2L.hpp"
+#include "M2P.hpp"
+#include "P2P.hpp"
+#include "L2L.hpp"
+#include "L2P.hpp"
+
+#include <deque>
+
+#include <boost/iterator/transform_iterator.hpp>
+using boost::transform_iterator;
+using boost::make_transform_iterator;
+
+/** @class ExecutorStreaming
+ * @brief Evaluate the field of an already executed source context on chunks
+ * of targets. The source tree, charges and multipole expansions are borrowed
+ * from the source context; each chunk of targets is binned into its own
+ * lightweight target tree with its own local expansions and results, so the
+ * memory used is bounded by the chunk size.
+ *
+ * The source context must provide the BoxContext interface on the source side
+ * and must have all multipole expansions formed (e.g. by EvalUpward).
+ */
+template <typename SourceContext>
+class ExecutorStreaming
+{
+ public:
+  //! This type
+  typedef ExecutorStreaming<SourceContext> self_type;
+
+  //! Tree type
+  typedef typename SourceContext::tree_type tree_type;
+  //! Tree box type
+  typedef typename tree_type::box_type box_type;
+  //! Tree body type
+  typedef typename tree_type::body_type body_type;
+  //! Tree body iterator
+  typedef typename tree_type::body_iterator body_iterator;
+
+  //! Kernel type
+  typedef typename SourceContext::kernel_type kernel_type;
+  //! Kernel multipole type
+  typedef typename kernel_type::multipole_type multipole_type;
+  //! Kernel local type
+  typedef typename kernel_type::local_type local_type;
+  //! Kernel point type
+  typedef typename kernel_type::point_type point_type;
+  //! Kernel target type
+  typedef typename kernel_type::target_type target_type;
+  //! Kernel result type
+  typedef typename kernel_type::result_type result_type;
+
+ protected:
+  // Transform a body to a value
+  template <typename Indexable>
+  struct BodyTransformer {
+    typedef typename Indexable::reference result_type;
+    typedef body_type argument_type;
+    BodyTransformer(const Indexable& value) : value_(value) {}
+    result_type operator()(const body_type& body) const {
+      return value_[body.number()];
+    }
+   private:
+    Indexable value_;
+  };
+
+  template <typename Indexable>
+  BodyTransformer<Indexable> body_transformer(Indexable v) const {
+    return BodyTransformer<Indexable>(v);
+  }
+
+  template <typename Indexable>
+  using body_transform = transform_iterator<BodyTransformer<Indexable>,
+                                            body_iterator>;
+
+  //! The executed context providing the sources and multipoles
+  SourceContext& sc_;
+  //! Whether to use M2L & L2L (FMM) or M2P (treecode) for far-field
+  bool is_fmm_;
+  //! Maximum number of targets per box in the chunk trees
+  unsigned ncrit_;
+
+  //! The tree of the current chunk of targets
+  tree_type* target_tree_;
+  //! Local expansions corresponding to Box indices in the target tree
+  std::vector<local_type> L_;
+
+  //! The targets of the current chunk
+  typedef std::vector<target_type> target_container;
+  typedef typename target_container::const_iterator target_iterator;
+  target_container targets;
+  //! The results of the current chunk
+  typedef std::vector<result_type> result_container;
+  typedef typename result_container::iterator result_iterator;
+  result_container results;
+
+  //! Long-range (M2L / M2P) source boxes indexed by target box
+  std::vector<std::vector<unsigned>> LR_lists;
+  //! P2P source boxes indexed by target box
+  std::vector<std::vector<unsigned>> P2P_lists;
+
+ public:
+  //! Constructor
+  template <typename Options>
+  ExecutorStreaming(SourceContext& sc, Options& opts)
+      : sc_(sc),
+        is_fmm_(opts.evaluator == FMMOptions::FMM),
+        ncrit_(opts.max_per_box()),
+        target_tree_(nullptr) {
+  }
+
+  ~ExecutorStreaming() {
+    delete target_tree_;
+  }
+
+  /** Evaluate the field at a chunk of targets
+   * @param[in] first,last The targets of this chunk
+   * @param[out] out Output iterator the results are written to, in order
+   * @returns The output iterator past the last written result
+   */
+  template <typename TargetIter, typename ResultIter>
+  ResultIter execute(TargetIter first, TargetIter last, ResultIter out) {
+    // Bin the chunk into a new target tree
+    targets.assign(first, last);
+    if (targets.empty())
+      return out;
+
+    struct { unsigned ncrit; unsigned max_per_box() const { return ncrit; } }
+    tree_opts = {ncrit_};
+    delete target_tree_;
+    target_tree_ = new tree_type(targets.begin(), targets.end(), tree_opts);
+
+    results.assign(targets.size(), result_type());
+    if (is_fmm_)
+      L_.resize(target_tree_->boxes());
+
+    build_lists();
+    eval_far_field();
+    eval_near_field();
+
+    return std::copy(results.begin(), results.end(), out);
+  }
+
+  bool accept_multipole(const box_type& source, const box_type& target) const {
+    return sc_.accept_multipole(source, target);
+  }
+
+  const kernel_type& kernel() const {
+    return sc_.kernel();
+  }
+
+  tree_type& source_tree() {
+    return sc_.source_tree();
+  }
+  tree_type& target_tree() {
+    return *target_tree_;
+  }
+
+  // Accessors to make this Executor into a BoxContext
+  inline const multipole_type& multipole_expansion(const box_type& box) const {
+    return sc_.multipole_expansion(box);
+  }
+  inline local_type& local_expansion(const box_type& box) {
+    return L_[box.index()];
+  }
+  inline const local_type& local_expansion(const box_type& box) const {
+    return L_[box.index()];
+  }
+
+  inline point_type center(const box_type& b) const {
+    return b.center();
+  }
+
+  typedef typename SourceContext::body_source_iterator body_source_iterator;
+  inline body_source_iterator source_begin(const box_type& b) const {
+    return sc_.source_begin(b);
+  }
+  inline body_source_iterator source_end(const box_type& b) const {
+    return sc_.source_end(b);
+  }
+
+  typedef typename SourceContext::body_charge_iterator body_charge_iterator;
+  inline body_charge_iterator charge_begin(const box_type& b) const {
+    return sc_.charge_begin(b);
+  }
+  inline body_charge_iterator charge_end(const box_type& b) const {
+    return sc_.charge_end(b);
+  }
+
+  typedef body_transform<target_iterator> body_target_iterator;
+  inline body_target_iterator target_begin(const box_type& b) const {
+    return make_transform_iterator(b.body_begin(),
+                                   body_transformer(target_iterator(targets.begin())));
+  }
+  inline body_target_iterator target_end(const box_type& b) const {
+    return make_transform_iterator(b.body_end(),
+                                   body_transformer(target_iterator(targets.begin())));
+  }
+
+  typedef body_transform<result_iterator> body_result_iterator;
+  inline body_result_iterator result_begin(const box_type& b) {
+    return make_transform_iterator(b.body_begin(),
+                                   body_transformer(results.begin()));
+  }
+  inline body_result_iterator result_end(const box_type& b) {
+    return make_transform_iterator(b.body_end(),
+                                   body_transformer(results.begin()));
+  }
+
+ protected:
+
+  /** Dual tree traversal of the source tree and the chunk's target tree
+   * generating the long-range and P2P lists of each target box
+   */
+  void build_lists() {
+    typedef std::pair<box_type, box_type> box_pair;
+
+    unsigned num_boxes = target_tree_->boxes();
+    LR_lists.assign(num_boxes, std::vector<unsigned>());
+    P2P_lists.assign(num_boxes, std::vector<unsigned>());
+
+    std::deque<box_pair> pairQ;
+    pairQ.push_back(box_pair(source_tree().root(), target_tree().root()));
+
+    while (!pairQ.empty()) {
+      auto b1 = pairQ.front().first;
+      auto b2 = pairQ.front().second;
+      pairQ.pop_front();
+
+      if (b1.is_leaf() && b2.is_leaf()) {
+        P2P_lists[b2.index()].push_back(b1.index());
+      } else if (b2.is_leaf() ||
+                 (!b1.is_leaf() && b1.side_length() > b2.side_length())) {
+        // Split the source box into children and interact
+        auto c_end = b1.child_end();
+        for (auto cit = b1.child_begin(); cit != c_end; ++cit)
+          interact(*cit, b2, pairQ);
+      } else {
+        // Split the target box into children and interact
+        auto c_end = b2.child_end();
+        for (auto cit = b2.child_begin(); cit != c_end; ++cit)
+          interact(b1, *cit, pairQ);
+      }
+    }
+  }
+
+  template <typename Q>
+  void interact(const box_type& b1, const box_type& b2, Q& pairQ) {
+    // The upward pass stops below the root, which has no multipole, so
+    // targets far from all sources still split it
+    if (b1.level() != 0 && accept_multipole(b1, b2))
+      group_LR(b1.index(), b2);
+    else
+      pairQ.push_back(std::make_pair(b1, b2));
+  }
+
+  /** Add the source box to the long-range list of the target box, or of its
+   * leaves if the interaction is a M2P */
+  void group_LR(unsigned source, const box_type& target) {
+    if (is_fmm_ || target.is_leaf()) {
+      LR_lists[target.index()].push_back(source);
+      return;
+    }
+    auto c_end = target.child_end();
+    for (auto cit = target.child_begin(); cit != c_end; ++cit)
+      group_LR(source, *cit);
+  }
+
+  /** Far-field: M2L + downward pass for FMM, M2P for treecode
+   * Parallel over target boxes. A FMM box owns its local expansion, and the
+   * M2P of a treecode are grouped on the target leaves, so every thread
+   * owns the results it writes.
+   */
+  void eval_far_field() {
+    const kernel_type& K = kernel();
+    int num_boxes = target_tree_->boxes();
+
+    if (is_fmm_) {
+#pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < num_boxes; ++i) {
+        box_type tbox = target_tree().box(i);
+        INITL::eval(K, *this, tbox);
+        auto& lr = LR_lists[i];
+        for (unsigned j = 0; j < lr.size(); ++j)
+          M2L::eval(K, *this, source_tree().box(lr[j]), tbox);
+      }
+
+      // Downward pass, parallel within each level
+      tree_type& tree = target_tree();
+      for (unsigned l = 0; l < tree.levels(); ++l) {
+        int b_begin = (*tree.box_begin(l)).index();
+        int b_end = b_begin + (tree.box_end(l) - tree.box_begin(l));
+#pragma omp parallel for
+        for (int i = b_begin; i < b_end; ++i) {
+          box_type box = tree.box(i);
+          if (box.is_leaf()) {
+            L2P::eval(K, *this, box);
+          } else {
+            auto c_end = box.child_end();
+            for (auto cit = box.child_begin(); cit != c_end; ++cit)
+              L2L::eval(K, *this, box, *cit);
+          }
+        }
+      }
+    } else {
+#pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < num_boxes; ++i) {
+        box_type tbox = target_tree().box(i);
+        auto& lr = LR_lists[i];
+        for (unsigned j = 0; j < lr.size(); ++j)
+          M2P::eval(K, *this, source_tree().box(lr[j]), tbox);
+      }
+    }
+  }
+
+  /** Near-field P2P, parallel over target leaves */
+  void eval_near_field() {
+    const kernel_type& K = kernel();
+    int num_boxes = target_tree_->boxes();
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_boxes; ++i) {
+      auto& p2p = P2P_lists[i];
+      for (unsigned j = 0; j < p2p.size(); ++j)
+        P2P::eval(K, *this,
+                  source_tree().box(p2p[j]), target_tree().box(i),
+                  P2P::ONE_SIDED());
+    }
+  }
+};
@@ -0,0 +1,37 @@
+#pragma once
+/** @file ROTATE.hpp
+ * @brief Dispatch methods preparing the rotated translations of a kernel
+ * ahead of evaluation, see LaplaceSpherical::set_rotation
+ */
+
+class ROTATE
+{
+  /** If the kernel does not rotate its translations */
+  template <typename Kernel>
+  inline static void prepare(const Kernel&,
+                             const typename Kernel::point_type&, long) {
+  }
+
+  template <typename Kernel>
+  inline static auto prepare(const Kernel& K,
+                             const typename Kernel::point_type& translation,
+                             int)
+      -> decltype(K.prepare_rotation(translation)) {
+    K.prepare_rotation(translation);
+  }
+
+ public:
+
+  /** Prepare the translation from source to target of M2M, M2L or L2L
+   * Not thread-safe: call while the interaction lists are built.
+   */
+  template <typename Kernel, typename Context>
+  inline static void prepare(const Kernel& K,
+                             Context& bc,
+                             const typename Context::box_type& source,
+                             const typename Context::box_type& target)
+  {
+    typename Kernel::point_type r = bc.center(target) - bc.center(source);
+    ROTATE::prepare(K, r, 0);
+  }
+};
@@ -563,7 +563,8 @@ inline void getCoef(Lset& C, const vect& dist, real& invR2, const real& invR) {
 
 template<int P, typename Lset, typename Mset>
 inline void sumM2L(Lset& L, const Lset& C, const Mset& M) {
-  L += C;
+  for (int i = 0; i < (P+1)*(P+2)*(P+3)/6; ++i)
+    L[i] += M[0] * C[i];
   for (int i = 1; i < P*(P+1)*(P+2)/6; ++i)
     L[0] += M[i] * C[i];
   Downward<P,0,0,P-1>::M2L(L,C,M);
@@ -728,10 +729,10 @@ inline void sumM2L(Lset& L, const Lset& C, const Mset& M) {
 
 template <int P, typename Result, typename Lset, typename Mset>
 inline void sumM2P(Result& B, const Lset& C, const Mset& M) {
-  B[0] += C[0];
-  B[1] += C[1];
-  B[2] += C[2];
-  B[3] += C[3];
+  B[0] += M[0] * C[0];
+  B[1] += M[0] * C[1];
+  B[2] += M[0] * C[2];
+  B[3] += M[0] * C[3];
   for (int i = 1; i<P*(P+1)*(P+2)/6; ++i)
     B[0] += M[i] * C[i];
   Downward<P,0,0,1>::M2P(B,C,M);
@@ -767,6 +768,17 @@ class LaplaceCartesian
   //! Local expansion type
   typedef Vec<LTERM,real> local_type;
 
+  /** Initialize a multipole expansion to zero */
+  void init_multipole(multipole_type& M,
+                      const point_type&, unsigned) const {
+    M = multipole_type(real(0));
+  }
+  /** Initialize a local expansion to zero */
+  void init_local(local_type& L,
+                  const point_type&, unsigned) const {
+    L = local_type(real(0));
+  }
+
   /** Kernel evaluation
    * K(t,s)
    *
@@ -834,7 +846,7 @@ class LaplaceCartesian
            local_type& L,
            const point_type& translation) const {
     real invR2 = 1.0 / normSq(translation);
-    real invR  = M[0] * sqrt(invR2);
+    real invR  = sqrt(invR2);
     local_type C;
     getCoef<P>(C, translation, invR2, invR);
     sumM2L<P>(L, C, M);
@@ -853,7 +865,7 @@ class LaplaceCartesian
            const target_type& target, result_type& result) const {
     point_type dist = target - center;
     real invR2 = 1.0 / normSq(dist);
-    real invR  = M[0] * sqrt(invR2);
+    real invR  = sqrt(invR2);
     local_type C;
     getCoef<P>(C, dist, invR2, invR);
     sumM2P<P>(result, C, M);
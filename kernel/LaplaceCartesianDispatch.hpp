@@ -0,0 +1,237 @@
+#pragma once
+/** @file LaplaceCartesianDispatch.hpp
+ * @brief The Laplace kernel with cartesian expansions of an order chosen at
+ * runtime among the instantiations LaplaceCartesian<1> .. LaplaceCartesian<MaxP>
+ *
+ * K(t,s) = 1 / |s-t|        // Laplace potential
+ * K(t,s) = (s-t) / |s-t|^3  // Laplace force
+ *
+ * The terms of the expansions are indexed by cart_index, order by order, so
+ * the expansions of order p are the prefixes of those of order MaxP. The
+ * expansions of this kernel have room for MaxP and set_p selects the table
+ * of the operators of LaplaceCartesian<p>, which act on copies of the
+ * prefixes. Like LaplaceSpherical, it can follow the order requested by the
+ * relaxed GMRES at every iteration: the expansions are initialised at every
+ * execution, so no conversion between orders is needed.
+ */
+
+#include "LaplaceCartesian.hpp"
+
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+
+template <unsigned MaxP>
+class LaplaceCartesianDispatch
+{
+  //! Number of Cartesian multipole terms of order p, of degree < p
+  static constexpr unsigned mterms(unsigned p) {
+    return p*(p+1)*(p+2)/6;
+  }
+  //! Number of Cartesian local terms of order p, of degree <= p
+  static constexpr unsigned lterms(unsigned p) {
+    return (p+1)*(p+2)*(p+3)/6;
+  }
+
+ public:
+  //! The dimension of the Kernel
+  static constexpr unsigned dimension = 3;
+  //! Point type
+  typedef Vec<dimension,real> point_type;
+  //! Source type
+  typedef point_type source_type;
+  //! Target type
+  typedef point_type target_type;
+  //! Charge type
+  typedef real charge_type;
+  //! The return type of a kernel evaluation
+  typedef Vec<4,real> kernel_value_type;
+  //! The product of the kernel_value_type and the charge_type
+  typedef Vec<4,real> result_type;
+
+  //! Multipole expansion type, with room for the order MaxP
+  typedef Vec<mterms(MaxP),real> multipole_type;
+  //! Local expansion type, with room for the order MaxP
+  typedef Vec<lterms(MaxP),real> local_type;
+
+ private:
+  //! The operators of one order
+  struct operators {
+    unsigned p;
+    void (*P2M)(const source_type&, const charge_type&,
+                const point_type&, multipole_type&);
+    void (*M2M)(const multipole_type&, multipole_type&, const point_type&);
+    void (*M2L)(const multipole_type&, local_type&, const point_type&);
+    void (*M2P)(const multipole_type&, const point_type&,
+                const target_type&, result_type&);
+    void (*L2L)(const local_type&, local_type&, const point_type&);
+    void (*L2P)(const local_type&, const point_type&,
+                const target_type&, result_type&);
+  };
+
+  /** The operators of LaplaceCartesian<p> on the prefixes of the expansions
+   * The inputs are copied into expansions of LaplaceCartesian<p>, and the
+   * operators accumulate into zero expansions added to the output prefixes.
+   */
+  template <unsigned p, bool = (p <= MaxP)>
+  struct order {
+    typedef LaplaceCartesian<p> kernel_type;
+    typedef typename kernel_type::multipole_type M_type;
+    typedef typename kernel_type::local_type     L_type;
+
+    static M_type M(const multipole_type& m) {
+      M_type r;
+      std::copy(m.begin(), m.begin() + mterms(p), r.begin());
+      return r;
+    }
+    static L_type L(const local_type& l) {
+      L_type r;
+      std::copy(l.begin(), l.begin() + lterms(p), r.begin());
+      return r;
+    }
+    template <typename E, typename Ep>
+    static void add(E& e, const Ep& ep) {
+      for (unsigned i = 0; i < ep.size(); ++i)
+        e[i] += ep[i];
+    }
+
+    static void P2M(const source_type& s, const charge_type& c,
+                    const point_type& center, multipole_type& m) {
+      M_type mp(real(0));
+      kernel_type().P2M(s, c, center, mp);
+      add(m, mp);
+    }
+    static void M2M(const multipole_type& ms, multipole_type& mt,
+                    const point_type& t) {
+      M_type mp(real(0));
+      kernel_type().M2M(M(ms), mp, t);
+      add(mt, mp);
+    }
+    static void M2L(const multipole_type& m, local_type& l,
+                    const point_type& t) {
+      L_type lp(real(0));
+      kernel_type().M2L(M(m), lp, t);
+      add(l, lp);
+    }
+    static void M2P(const multipole_type& m, const point_type& center,
+                    const target_type& t, result_type& r) {
+      kernel_type().M2P(M(m), center, t, r);
+    }
+    static void L2L(const local_type& ls, local_type& lt,
+                    const point_type& t) {
+      L_type lp(real(0));
+      kernel_type().L2L(L(ls), lp, t);
+      add(lt, lp);
+    }
+    static void L2P(const local_type& l, const point_type& center,
+                    const target_type& t, result_type& r) {
+      kernel_type().L2P(L(l), center, t, r);
+    }
+
+    /** Append the operators of the orders p to MaxP */
+    static void append(std::vector<operators>& ops) {
+      ops.push_back(operators{p, &P2M, &M2M, &M2L, &M2P, &L2L, &L2P});
+      order<p+1>::append(ops);
+    }
+  };
+  template <unsigned p>
+  struct order<p,false> {
+    static void append(std::vector<operators>&) {}
+  };
+
+  /** The operators of all orders, at index p-1 */
+  static const std::vector<operators>& table() {
+    static const std::vector<operators> ops = [] {
+      std::vector<operators> o;
+      order<1>::append(o);
+      return o;
+    }();
+    return ops;
+  }
+
+  //! The operators of the current order
+  const operators* ops_;
+
+ public:
+  //! Constructor
+  LaplaceCartesianDispatch(unsigned p = MaxP)
+      : ops_(nullptr) {
+    set_p(p);
+  }
+
+  /** Set the expansion order, between 1 and MaxP */
+  void set_p(int p) {
+    const int q = std::min(std::max(p, 1), int(MaxP));
+    if (q != p && (ops_ == nullptr || int(ops_->p) != q))
+      printf("[W]: Order %d out of range of LaplaceCartesianDispatch<%u> "
+             "-- using %d\n", p, MaxP, q);
+    ops_ = &table()[q-1];
+  }
+  /** The expansion order */
+  unsigned get_p() const {
+    return ops_->p;
+  }
+
+  /** Initialize a multipole expansion to zero */
+  void init_multipole(multipole_type& M,
+                      const point_type&, unsigned) const {
+    M = multipole_type(real(0));
+  }
+  /** Initialize a local expansion to zero */
+  void init_local(local_type& L,
+                  const point_type&, unsigned) const {
+    L = local_type(real(0));
+  }
+
+  /** Kernel evaluation
+   * K(t,s)
+   *
+   * @param[in] t,s The target and source points to evaluate the kernel
+   * @result The Laplace potential and force 4-vector on t from s:
+   * Potential: 1/|s-t|  Force: (s-t)/|s-t|^3
+   */
+  kernel_value_type operator()(const point_type& t,
+                               const point_type& s) const {
+    return LaplaceCartesian<1>()(t, s);
+  }
+
+  /** Kernel P2M operation, see LaplaceCartesian */
+  void P2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    ops_->P2M(source, charge, center, M);
+  }
+
+  /** Kernel M2M operator, see LaplaceCartesian */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    ops_->M2M(Msource, Mtarget, translation);
+  }
+
+  /** Kernel M2L operation, see LaplaceCartesian */
+  void M2L(const multipole_type& M,
+           local_type& L,
+           const point_type& translation) const {
+    ops_->M2L(M, L, translation);
+  }
+
+  /** Kernel M2P operation, see LaplaceCartesian */
+  void M2P(const multipole_type& M, const point_type& center,
+           const target_type& target, result_type& result) const {
+    ops_->M2P(M, center, target, result);
+  }
+
+  /** Kernel L2L operator, see LaplaceCartesian */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    ops_->L2L(Lsource, Ltarget, translation);
+  }
+
+  /** Kernel L2P operation, see LaplaceCartesian */
+  void L2P(const local_type& L, const point_type& center,
+           const target_type& target, result_type& result) const {
+    ops_->L2P(L, center, target, result);
+  }
+};
@@ -9,7 +9,13 @@
 
 #include <complex>
 #include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 #include <Vec.hpp>
+#include "SourcePack.hpp"
 
 class LaplaceSpherical
 {
@@ -19,12 +25,20 @@ class LaplaceSpherical
 
   //! Expansion order
   int P;
+  //! Largest expansion order the tables below are computed for
+  int max_P;
   //! \f$ \sqrt{ \frac{(n - |m|)!}{(n + |m|)!} } \f$
   std::vector<real> prefactor;
   //! \f$ (-1)^n / \sqrt{ \frac{(n + m)!}{(n - m)!} } \f$
   std::vector<real> Anm;
-  //! M2L translation matrix \f$ C_{jn}^{km} \f$
+  //! M2L translation matrix \f$ C_{jn}^{km} \f$, at jk * max_P^2 + nm
   std::vector<complex> Cnm;
+  //! Whether P2P is evaluated in single precision
+  bool single_;
+  //! Whether M2M, M2L and L2L rotate the expansions onto the z-axis
+  bool rotate_;
+  //! Wigner d-matrices up to max_P by polar angle, see prepare_rotation()
+  mutable std::map<long long, std::vector<real>> rotations_;
 
   //! Epsilon
   static constexpr real EPS = 1e-12;
@@ -35,9 +49,82 @@ class LaplaceSpherical
     return (((n & 1) == 1) ? -1 : 1);
   };
 
+  /** Expansion coefficients, either owned or a view of a fixed number of
+   * coefficients in contiguous storage (see bind_multipole / bind_local).
+   * Copies always own their coefficients; assigning to or re-initialising
+   * coefficients of the same size writes in place without reallocation.
+   */
+  class coefficients {
+    complex* data_;
+    unsigned size_;
+    std::vector<complex> own_;
+
+   public:
+    coefficients()
+        : data_(nullptr), size_(0) {
+    }
+    coefficients(unsigned n, const complex& v)
+        : data_(nullptr), size_(0) {
+      assign(n, v);
+    }
+    coefficients(const coefficients& c)
+        : data_(nullptr), size_(0), own_(c.begin(), c.end()) {
+      data_ = own_.data();
+      size_ = own_.size();
+    }
+
+    coefficients& operator=(const coefficients& c) {
+      if (this == &c) return *this;
+      if (size_ == c.size_) {
+        std::copy(c.begin(), c.end(), data_);
+      } else {
+        own_.assign(c.begin(), c.end());
+        data_ = own_.data();
+        size_ = own_.size();
+      }
+      return *this;
+    }
+
+    /** Set n coefficients to v, in place if the size is unchanged
+     * Owned storage is reserved for at least capacity coefficients.
+     */
+    void assign(unsigned n, const complex& v, unsigned capacity = 0) {
+      if (size_ == n) {
+        std::fill(data_, data_ + n, v);
+      } else {
+        own_.reserve(std::max(n, capacity));
+        own_.assign(n, v);
+        data_ = own_.data();
+        size_ = n;
+      }
+    }
+
+    /** View the n coefficients at data, releasing any owned storage */
+    void bind(complex* data, unsigned n) {
+      std::vector<complex>().swap(own_);
+      data_ = data;
+      size_ = n;
+    }
+
+    unsigned size() const {
+      return size_;
+    }
+    complex* begin() { return data_; }
+    complex* end() { return data_ + size_; }
+    const complex* begin() const { return data_; }
+    const complex* end() const { return data_ + size_; }
+
+    complex& operator[](const int i) {
+      return data_[i];
+    }
+    const complex& operator[](const int i) const {
+      return data_[i];
+    }
+  };
+
   //! Custom multipole type
   struct multipole {
-    std::vector<complex> M;
+    coefficients M;
     real RCRIT;
     real RMAX;
 
@@ -70,23 +157,32 @@ class LaplaceSpherical
   //! Multipole expansion type
   typedef multipole multipole_type;
   //! Local expansion type
-  typedef std::vector<complex> local_type;
+  typedef coefficients local_type;
+  //! Type of the expansion coefficients
+  typedef complex coefficient_type;
+  //! Sources of a leaf in structure-of-arrays form for the packed P2P
+  typedef SourcePack<real,1> source_pack_type;
 
   //! default constructor - use delegating constructor
   LaplaceSpherical() : LaplaceSpherical(5) {};
   //! Constructor
   LaplaceSpherical(int p)
-      : P(p), prefactor(4*P*P), Anm(4*P*P), Cnm(P*P*P*P) {
+      : P(p), max_P(p), single_(false), rotate_(false) {
     precompute();
   }
 
   /**
-   * precompute all values
-   * assume memory correctly allocated
+   * precompute all values for the orders up to max_P
+   * The tables are nested: the values of a lower order are a subset at the
+   * same indices, so changing the order does not recompute them.
    */
   void precompute()
   {
-    for( int n=0; n!=2*P; ++n ) {                               // Loop over n in Anm
+    prefactor.resize(4*max_P*max_P);
+    Anm.resize(4*max_P*max_P);
+    Cnm.resize(max_P*max_P*max_P*max_P);
+
+    for( int n=0; n!=2*max_P; ++n ) {                               // Loop over n in Anm
       for( int m=-n; m<=n; ++m ) {                              //  Loop over m in Anm
         int nm = n*n+n+m;                                       //   Index of Anm
         int nabsm = abs(m);                                     //   |m|
@@ -103,9 +199,9 @@ class LaplaceSpherical
       }                                                         //  End loop over m in Anm
     }                                                           // End loop over n in Anm
 
-    for( int j=0, jk=0, jknm=0; j!=P; ++j ) {                   // Loop over j in Cjknm
+    for( int j=0, jk=0, jknm=0; j!=max_P; ++j ) {               // Loop over j in Cjknm
       for( int k=-j; k<=j; ++k, ++jk ){                         //  Loop over k in Cjknm
-        for( int n=0, nm=0; n!=P; ++n ) {                       //   Loop over n in Cjknm
+        for( int n=0, nm=0; n!=max_P; ++n ) {                   //   Loop over n in Cjknm
           for( int m=-n; m<=n; ++m, ++nm, ++jknm ) {            //    Loop over m in Cjknm
             const int jnkm = (j+n)*(j+n)+j+n+m-k;               //     Index C_{j+n}^{m-k}
             Cnm[jknm] = std::pow(CI,real(abs(k-m)-abs(k)-abs(m)))//     Cjknm
@@ -116,22 +212,68 @@ class LaplaceSpherical
     }                                                           // End loop over in j in Cjknm
   }
 
+  /** Set the expansion order
+   * Up to the order of construction this only selects the order, the tables
+   * are only recomputed (and expansions reallocated) for a larger one.
+   */
   void set_p(int p)
   {
     P = p;
-    prefactor.resize(4*P*P);
-    Anm.resize(4*P*P);
-    Cnm.resize(P*P*P*P);
+    if (P > max_P) {
+      max_P = P;
+      precompute();
+      for (auto& r : rotations_)
+        compute_wigner(r.second, wigner_angle(r.first));
+    }
+  }
 
-    // recompute all precomputed values for new P
-    precompute();
+  /** Translate by rotating the expansions so that the translation is along
+   * the z-axis, translating there and rotating back, in O(p^3) instead of
+   * the O(p^4) of the direct M2M, M2L and L2L. Off by default, FMM_plan
+   * sets it from FMMOptions::rotated_translations.
+   */
+  void set_rotation(bool rotate) {
+    rotate_ = rotate;
+  }
+  bool rotation() const {
+    return rotate_;
+  }
+
+  /** Compute the rotation of a translation ahead of evaluation
+   * The rotated M2M, M2L and L2L only read the prepared rotations, so they
+   * run concurrently without locking; an unprepared translation computes
+   * its rotation on every call. Not thread-safe: the lazy evaluators call
+   * this for their interaction lists while building them (see ROTATE.hpp).
+   */
+  void prepare_rotation(const point_type& translation) const {
+    const real ctheta = translation[2] / norm(translation);
+    std::vector<real>& d = rotations_[wigner_key(ctheta)];
+    if (d.empty())
+      compute_wigner(d, ctheta);
+  }
+
+  /** Evaluate P2P in single precision (accumulating into double)
+   * For late iterations of a relaxed solver, whose requested accuracy is
+   * above the float resolution. The M2L stays in double: in float, with or
+   * without set_rotation, it was no faster at p = 8 and p = 16.
+   */
+  void set_single_precision(bool single) {
+    single_ = single;
+  }
+  bool single_precision() const {
+    return single_;
+  }
+  /** Whether the assembled near-field operator (P2P_Matrix) is applied in
+   * single precision, by default while single_precision() is set */
+  bool single_precision_near_field() const {
+    return single_;
   }
 
   /** Initialize a multipole expansion with the size of a box at this level */
   void init_multipole(multipole_type& M,
                       const point_type& extents, unsigned level) const {
     (void) level;
-    M.M = std::vector<complex>(P*(P+1)/2, 0);
+    M.M.assign(P*(P+1)/2, 0, max_P*(max_P+1)/2);
     M.RMAX = 0;
     M.RCRIT = extents[0] / 2;
   }
@@ -140,7 +282,25 @@ class LaplaceSpherical
                   const point_type& extents, unsigned level) const {
     (void) extents;  // Quiet warning
     (void) level;
-    L = std::vector<complex>(P*(P+1)/2, 0);
+    L.assign(P*(P+1)/2, 0, max_P*(max_P+1)/2);
+  }
+
+  /** Number of coefficients reserved per multipole expansion, enough for
+   * every order up to max_P so that set_p does not move the expansions */
+  unsigned multipole_stride() const {
+    return max_P*(max_P+1)/2;
+  }
+  /** Number of coefficients reserved per local expansion */
+  unsigned local_stride() const {
+    return max_P*(max_P+1)/2;
+  }
+  /** Make M a view of the coefficients of the current order at data */
+  void bind_multipole(multipole_type& M, coefficient_type* data) const {
+    M.M.bind(data, P*(P+1)/2);
+  }
+  /** Make L a view of the coefficients of the current order at data */
+  void bind_local(local_type& L, coefficient_type* data) const {
+    L.bind(data, P*(P+1)/2);
   }
 
   /** Kernel evaluation
@@ -161,6 +321,39 @@ class LaplaceSpherical
     return kernel_value_type(invR, dist[0], dist[1], dist[2]);
   }
 
+  /** Packed kernel evaluation
+   * r += sum_j K(t,s_j) * c_j over a pack of sources
+   *
+   * @param[in] t The target point
+   * @param[in] s The sources and charges, see SourcePack.hpp
+   * @param[in,out] r The result to accumulate into
+   */
+  void operator()(const target_type& t, const source_pack_type& s,
+                  result_type& r) const {
+    const real tx = t[0], ty = t[1], tz = t[2];
+    const real* x = s.x;
+    const real* y = s.y;
+    const real* z = s.z;
+    const real* c = s.c[0];
+    real pot = 0, fx = 0, fy = 0, fz = 0;
+#pragma omp simd aligned(x,y,z,c:64) reduction(+:pot,fx,fy,fz)
+    for (unsigned j = 0; j < s.size; ++j) {
+      real dx = x[j] - tx, dy = y[j] - ty, dz = z[j] - tz;
+      real R2 = dx*dx + dy*dy + dz*dz;
+      real invR2 = (R2 < 1e-8) ? 0 : 1 / R2;   // Exclude self interaction
+      real invR = c[j] * std::sqrt(invR2);
+      real invR3 = invR2 * invR;
+      pot += invR;
+      fx += dx * invR3;
+      fy += dy * invR3;
+      fz += dz * invR3;
+    }
+    r[0] += pot;
+    r[1] += fx;
+    r[2] += fy;
+    r[3] += fz;
+  }
+
   /** Optional Kernel value source and target transposition
    * K(t,s) -> K(s,t)
    * Often, a kernel has a symmetry in s and t that can be computed faster than
@@ -175,6 +368,70 @@ class LaplaceSpherical
     return kernel_value_type(kst[0], -kst[1], -kst[2], -kst[3]);
   }
 
+  /** Kernel P2P operation
+   * r_i += sum_j K(t_i, s_j) * c_j
+   *
+   * In single precision the sources are gathered into float arrays on the
+   * stack, a block at a time, and the sum of every target over a block is
+   * accumulated in float before adding it to r_i.
+   * Only enabled for result_type results, not in kernels derived from this.
+   */
+  template <typename SourceIter, typename ChargeIter,
+            typename TargetIter, typename ResultIter>
+  typename std::enable_if<std::is_convertible<
+      decltype(*std::declval<ResultIter>()), result_type&>::value>::type
+  P2P(SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+      TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    if (!single_) {
+      for ( ; t_first != t_last; ++t_first, ++r_first) {
+        const target_type& t = *t_first;
+        result_type& r = *r_first;
+        ChargeIter c = c_first;
+        for (SourceIter s = s_first; s != s_last; ++s, ++c)
+          r += (*this)(t, *s) * (*c);
+      }
+      return;
+    }
+
+    // The sources in blocks of float arrays on the stack
+    const unsigned block = 256;
+    float sx[block], sy[block], sz[block], sc[block];
+    while (s_first != s_last) {
+      unsigned n = 0;
+      for ( ; s_first != s_last && n != block; ++s_first, ++c_first, ++n) {
+        const source_type& sj = *s_first;
+        sx[n] = sj[0];
+        sy[n] = sj[1];
+        sz[n] = sj[2];
+        sc[n] = *c_first;
+      }
+
+      ResultIter r_it = r_first;
+      for (TargetIter t_it = t_first; t_it != t_last; ++t_it, ++r_it) {
+        const target_type& t = *t_it;
+        const float tx = t[0], ty = t[1], tz = t[2];
+        float pot = 0, fx = 0, fy = 0, fz = 0;
+#pragma omp simd reduction(+:pot,fx,fy,fz)
+        for (unsigned j = 0; j < n; ++j) {
+          float dx = sx[j] - tx, dy = sy[j] - ty, dz = sz[j] - tz;
+          float R2 = dx*dx + dy*dy + dz*dz;
+          float invR2 = (R2 < 1e-8f) ? 0.f : 1.f / R2;   // Exclude self interaction
+          float invR = sc[j] * std::sqrt(invR2);
+          float invR3 = invR2 * invR;
+          pot += invR;
+          fx += dx * invR3;
+          fy += dy * invR3;
+          fz += dz * invR3;
+        }
+        result_type& r = *r_it;
+        r[0] += pot;
+        r[1] += fx;
+        r[2] += fy;
+        r[3] += fz;
+      }
+    }
+  }
+
   /** Kernel P2M operation
    * M += Op(s) * c where M is the multipole and s is the source
    *
@@ -209,31 +466,73 @@ class LaplaceSpherical
    * @param[in] center The center of the box containing the multipole expansion
    * @param[in,out] M The multipole expansion to accumulate into
    * @pre M is the result of init_multipole
+   *
+   * The points are evaluated in batches, see evalSolid().
    */
   template <typename SourceIter, typename ChargeIter>
   void P2M(SourceIter p_begin, SourceIter p_end, ChargeIter c_begin,
            const point_type& center, multipole_type& M) const {
-    real Rmax = 0;
-    complex Ynm[4*P*P], YnmTheta[4*P*P];
-    for ( ; p_begin != p_end; ++p_begin, ++c_begin) {
-      point_type dist = *p_begin - center;
-      real R = norm(dist);
-      if( R > Rmax ) Rmax = R;
-      real rho, alpha, beta;
-      cart2sph(rho,alpha,beta,dist);
-      evalMultipole(rho,alpha,-beta,Ynm,YnmTheta);
+    const int NT = P*(P+1)/2;
+    real x[batch], y[batch], z[batch], q[batch];
+    real Rr[NT*batch], Ri[NT*batch];
+    real R2max = 0;
+    while (p_begin != p_end) {
+      int nb = 0;
+      for ( ; nb != batch && p_begin != p_end; ++nb, ++p_begin, ++c_begin) {
+        point_type dist = *p_begin - center;
+        x[nb] = dist[0]; y[nb] = dist[1]; z[nb] = dist[2];
+        q[nb] = *c_begin;
+        R2max = std::max(R2max, normSq(dist));
+      }
+      for (int b = nb; b != batch; ++b) {                       // Pad with zero charges
+        x[b] = y[b] = z[b] = q[b] = 0;
+      }
+      evalSolid(x, y, z, P, false, Rr, Ri);
       for( int n=0; n!=P; ++n ) {
-        for( int m=0; m<=n; ++m ) {
-          const int nm  = n * n + n + m;
+        for( int m=0; m<=n; ++m ) {                             // sum_b q_b conj(R_n^m)
           const int nms = n * (n + 1) / 2 + m;
-          M[nms] += (*c_begin) * Ynm[nm];
+          real re = 0, im = 0;
+          for (int b = 0; b != batch; ++b) {
+            re += q[b] * Rr[nms*batch+b];
+            im -= q[b] * Ri[nms*batch+b];
+          }
+          M[nms] += complex(re, im) * prefactor[n*n+n+m];
         }
       }
     }
-    M.RMAX = Rmax;
+    M.RMAX = std::sqrt(R2max);
     M.RCRIT = std::min(M.RCRIT, M.RMAX);
   }
 
+  /** Number of reals in the vector form of an expansion for the batched
+   * translations: the real and imaginary parts of the P(P+1)/2 coefficients
+   */
+  unsigned expansion_size() const {
+    return P*(P+1);
+  }
+  //! Vector form of a multipole expansion
+  void multipole_to_vector(const multipole_type& M, real* v) const {
+    const real* m = reinterpret_cast<const real*>(&M[0]);
+    std::copy(m, m + P*(P+1), v);
+  }
+  //! Vector form of a local expansion
+  void local_to_vector(const local_type& L, real* v) const {
+    const real* l = reinterpret_cast<const real*>(&L[0]);
+    std::copy(l, l + P*(P+1), v);
+  }
+  //! Accumulate the vector form of a multipole expansion into M
+  void vector_to_multipole(const real* v, multipole_type& M) const {
+    real* m = reinterpret_cast<real*>(&M[0]);
+    for (int i = 0; i != P*(P+1); ++i)
+      m[i] += v[i];
+  }
+  //! Accumulate the vector form of a local expansion into L
+  void vector_to_local(const real* v, local_type& L) const {
+    real* l = reinterpret_cast<real*>(&L[0]);
+    for (int i = 0; i != P*(P+1); ++i)
+      l[i] += v[i];
+  }
+
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
    *
@@ -245,6 +544,10 @@ class LaplaceSpherical
   void M2M(const multipole_type& Msource,
            multipole_type& Mtarget,
            const point_type& translation) const {
+    if (rotate_) {
+      M2M_rotated(Msource, Mtarget, translation);
+      return;
+    }
     complex Ynm[4*P*P], YnmTheta[4*P*P];
     real Rmax = Mtarget.RMAX;
     real R = norm(translation) + Msource.RCRIT;
@@ -284,6 +587,48 @@ class LaplaceSpherical
     Mtarget.RCRIT = std::min(Mtarget.RCRIT, Mtarget.RMAX);
   }
 
+  /** Kernel M2M operator as a dense matrix
+   * The real column-major matrix T with vec(M_t) += T vec(M_s) for the
+   * translation, see expansion_size() and EvalBatched.hpp.
+   * Unlike M2M, the radii RMAX and RCRIT of the target are not updated.
+   */
+  void M2M_matrix(const point_type& translation, real* T) const {
+    complex Ynm[4*P*P], YnmTheta[4*P*P];
+    real rho, alpha, beta;
+    cart2sph(rho,alpha,beta,translation);
+    evalMultipole(rho,alpha,-beta,Ynm,YnmTheta);
+
+    std::fill(T, T + expansion_size()*expansion_size(), real(0));
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        for( int n=0; n<=j; ++n ) {
+          for( int m=-n; m<=std::min(k-1,n); ++m ) {
+            if( j-n >= k-m ) {
+              const int jnkm  = (j - n) * (j - n) + j - n + k - m;
+              const int jnkms = (j - n) * (j - n + 1) / 2 + k - m;
+              const int nm    = n * n + n + m;
+              matrix_add(T, jks, jnkms, std::pow(CI,real(m-abs(m))) * Ynm[nm]
+                         * real(ODDEVEN(n) * Anm[nm] * Anm[jnkm] / Anm[jk] * EPS),
+                         false);
+            }
+          }
+          for( int m=k; m<=n; ++m ) {
+            if( j-n >= m-k ) {
+              const int jnkm  = (j - n) * (j - n) + j - n + k - m;
+              const int jnkms = (j - n) * (j - n + 1) / 2 - k + m;
+              const int nm    = n * n + n + m;
+              matrix_add(T, jks, jnkms, Ynm[nm]
+                         * real(ODDEVEN(k+n+m) * Anm[nm] * Anm[jnkm] / Anm[jk] * EPS),
+                         true);
+            }
+          }
+        }
+      }
+    }
+  }
+
   /** Kernel M2L operation
    * L += Op(M)
    *
@@ -296,6 +641,10 @@ class LaplaceSpherical
   void M2L(const multipole_type& Msource,
                  local_type& Ltarget,
            const point_type& translation) const {
+    if (rotate_) {
+      M2L_rotated(Msource, Ltarget, translation);
+      return;
+    }
     complex Ynm[4*P*P], YnmTheta[4*P*P];
 
     point_type dist = translation;
@@ -311,14 +660,14 @@ class LaplaceSpherical
           for( int m=-n; m<0; ++m ) {
             const int nm   = n * n + n + m;
             const int nms  = n * (n + 1) / 2 - m;
-            const int jknm = jk * P * P + nm;
+            const int jknm = jk * max_P * max_P + nm;
             const int jnkm = (j + n) * (j + n) + j + n + m - k;
             L += std::conj(Msource[nms]) * Cnm[jknm] * Ynm[jnkm];
           }
           for( int m=0; m<=n; ++m ) {
             const int nm   = n * n + n + m;
             const int nms  = n * (n + 1) / 2 + m;
-            const int jknm = jk * P * P + nm;
+            const int jknm = jk * max_P * max_P + nm;
             const int jnkm = (j + n) * (j + n) + j + n + m - k;
             L += Msource[nms] * Cnm[jknm] * Ynm[jnkm];
           }
@@ -328,6 +677,44 @@ class LaplaceSpherical
     }
   }
 
+  /** Kernel M2L operation as a dense matrix
+   * The real column-major matrix T with vec(L) += T vec(M) for the
+   * translation, see expansion_size() and EvalBatched.hpp.
+   * The matrix is always in double precision.
+   */
+  void M2L_matrix(const point_type& translation, real* T) const {
+    complex Ynm[4*P*P], YnmTheta[4*P*P];
+
+    point_type dist = translation;
+    real rho, alpha, beta;
+    cart2sph(rho,alpha,beta,dist);
+    evalLocal(rho,alpha,beta,Ynm,YnmTheta);
+
+    std::fill(T, T + expansion_size()*expansion_size(), real(0));
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        for( int n=0; n!=P; ++n ) {
+          for( int m=-n; m<0; ++m ) {
+            const int nm   = n * n + n + m;
+            const int nms  = n * (n + 1) / 2 - m;
+            const int jknm = jk * max_P * max_P + nm;
+            const int jnkm = (j + n) * (j + n) + j + n + m - k;
+            matrix_add(T, jks, nms, Cnm[jknm] * Ynm[jnkm], true);
+          }
+          for( int m=0; m<=n; ++m ) {
+            const int nm   = n * n + n + m;
+            const int nms  = n * (n + 1) / 2 + m;
+            const int jknm = jk * max_P * max_P + nm;
+            const int jnkm = (j + n) * (j + n) + j + n + m - k;
+            matrix_add(T, jks, nms, Cnm[jknm] * Ynm[jnkm], false);
+          }
+        }
+      }
+    }
+  }
+
   /** Kernel M2P operation
    * r += Op(M, t) where M is the multipole and r is the result
    *
@@ -367,6 +754,35 @@ class LaplaceSpherical
     result[3] += cartesian[2];
   }
 
+  /** Kernel M2P operation on the targets of a box
+   * r_i += Op(M, t_i), the batched form of the M2P above, see evalSolid()
+   */
+  template <typename TargetIter, typename ResultIter>
+  void M2P(const multipole_type& M, const point_type& center,
+           TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    const int NT = (P+1)*(P+2)/2;                               // Gradient is one degree higher
+    complex c[NT], gx[NT], gy[NT], gz[NT];
+    std::fill(c, c + NT, complex(0));
+    std::fill(gx, gx + NT, complex(0));
+    std::fill(gy, gy + NT, complex(0));
+    std::fill(gz, gz + NT, complex(0));
+    for( int n=0; n!=P; ++n ) {
+      for( int m=0; m<=n; ++m ) {
+        const int nms = n * (n + 1) / 2 + m;
+        const complex cnm = real(m ? 2 : 1) * prefactor[n*n+n+m] * M[nms];
+        c[nms] = cnm;
+        // d/dz I_n^m = -(n-m+1) I_{n+1}^m
+        // (d/dx + i d/dy) I_n^m = I_{n+1}^{m+1}
+        // (d/dx - i d/dy) I_n^m = -(n-m+1)(n-m+2) I_{n+1}^{m-1}
+        const int up = (n + 1) * (n + 2) / 2 + m;
+        gz[up] -= real(n - m + 1) * cnm;
+        add_gradient(gx, gy, up + 1, m ? up - 1 : -1,
+                     cnm, -real((n - m + 1) * (n - m + 2)) * cnm);
+      }
+    }
+    evalExpansion(c, gx, gy, gz, P+1, true, center, t_begin, t_end, r_begin);
+  }
+
   /** Kernel L2L operator
    * L_t += Op(L_s) where L_t is the target and L_s is the source
    *
@@ -378,6 +794,10 @@ class LaplaceSpherical
   void L2L(const local_type& source,
            local_type& target,
            const point_type& translation) const {
+    if (rotate_) {
+      L2L_rotated(source, target, translation);
+      return;
+    }
     complex Ynm[4*P*P], YnmTheta[4*P*P];
     real rho, alpha, beta;
     cart2sph(rho,alpha,beta,translation);
@@ -410,6 +830,45 @@ class LaplaceSpherical
     }
   }
 
+  /** Kernel L2L operator as a dense matrix
+   * The real column-major matrix T with vec(L_t) += T vec(L_s) for the
+   * translation, see expansion_size() and EvalBatched.hpp.
+   */
+  void L2L_matrix(const point_type& translation, real* T) const {
+    complex Ynm[4*P*P], YnmTheta[4*P*P];
+    real rho, alpha, beta;
+    cart2sph(rho,alpha,beta,translation);
+    evalMultipole(rho,alpha,beta,Ynm,YnmTheta);
+
+    std::fill(T, T + expansion_size()*expansion_size(), real(0));
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        for( int n=j; n!=P; ++n ) {
+          for( int m=j+k-n; m<0; ++m ) {
+            const int jnkm = (n - j) * (n - j) + n - j + m - k;
+            const int nm   = n * n + n - m;
+            const int nms  = n * (n + 1) / 2 - m;
+            matrix_add(T, jks, nms, Ynm[jnkm]
+                       * real(ODDEVEN(k) * Anm[jnkm] * Anm[jk] / Anm[nm] * EPS),
+                       true);
+          }
+          for( int m=0; m<=n; ++m ) {
+            if( n-j >= abs(m-k) ) {
+              const int jnkm = (n - j) * (n - j) + n - j + m - k;
+              const int nm   = n * n + n + m;
+              const int nms  = n * (n + 1) / 2 + m;
+              matrix_add(T, jks, nms, std::pow(CI,real(m-k-abs(m-k)))
+                         * Ynm[jnkm] * (Anm[jnkm] * Anm[jk] / Anm[nm] * EPS),
+                         false);
+            }
+          }
+        }
+      }
+    }
+  }
+
   /** Kernel L2P operation
    * r += Op(L, t) where L is the local expansion and r is the result
    *
@@ -449,17 +908,435 @@ class LaplaceSpherical
     result[3] += cartesian[2];
   }
 
+  /** Kernel L2P operation on the targets of a box
+   * r_i += Op(L, t_i), the batched form of the L2P above, see evalSolid()
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2P(const local_type& L, const point_type& center,
+           TargetIter t_begin, TargetIter t_end, ResultIter r_begin) const {
+    const int NT = P*(P+1)/2;
+    complex c[NT], gx[NT], gy[NT], gz[NT];
+    std::fill(gx, gx + NT, complex(0));
+    std::fill(gy, gy + NT, complex(0));
+    std::fill(gz, gz + NT, complex(0));
+    for( int n=0; n!=P; ++n ) {
+      for( int m=0; m<=n; ++m ) {
+        const int nms = n * (n + 1) / 2 + m;
+        const complex cnm = real(m ? 2 : 1) * prefactor[n*n+n+m] * L[nms];
+        c[nms] = cnm;
+        if (n == 0) continue;
+        // d/dz R_n^m = (n+m) R_{n-1}^m
+        // (d/dx + i d/dy) R_n^m = R_{n-1}^{m+1}
+        // (d/dx - i d/dy) R_n^m = -(n+m)(n+m-1) R_{n-1}^{m-1}
+        const int down = (n - 1) * n / 2 + m;
+        if (m < n) gz[down] += real(n + m) * cnm;
+        add_gradient(gx, gy, m + 1 < n ? down + 1 : -1, m ? down - 1 : -1,
+                     cnm, -real((n + m) * (n + m - 1)) * cnm);
+      }
+    }
+    evalExpansion(c, gx, gy, gz, P, false, center, t_begin, t_end, r_begin);
+  }
+
  protected:
+  //! Bodies evaluated together by the batched P2M, M2P and L2P
+  static constexpr int batch = 8;
+
+  /** Add the x and y derivatives of a term c S_n^m of a solid harmonic
+   * expansion to the expansions gx and gy of the derivatives, where
+   *   (d/dx + i d/dy) c S_n^m = a S_k^{m+1},  at index up (< 0 if k < m+1)
+   *   (d/dx - i d/dy) c S_n^m = b S_k^{m-1},  at index down (< 0 if m = 0)
+   * For m = 0, b S_k^{-1} = conj(a S_k^1) for both the regular and the
+   * irregular harmonics. Only the real parts are evaluated, so
+   *   d/dx = Re((a S^{m+1} + b S^{m-1}) / 2)
+   *   d/dy = Re((a S^{m+1} - b S^{m-1}) / 2i)
+   */
+  void add_gradient(complex* gx, complex* gy, int up, int down,
+                    const complex& a, const complex& b) const {
+    if (up >= 0) {
+      gx[up] += real(0.5) * a;
+      gy[up] -= real(0.5) * CI * a;
+    }
+    if (down >= 0) {
+      gx[down] += real(0.5) * b;
+      gy[down] += real(0.5) * CI * b;
+    } else if (up >= 0) {
+      gx[up] += real(0.5) * std::conj(a);
+      gy[up] -= real(0.5) * CI * std::conj(a);
+    }
+  }
+
+  /** Solid harmonics of a batch of points from their Cartesian coordinates
+   *   regular:   R_n^m = r^n P_n^m(cos theta) e^{i m phi}
+   *   irregular: I_n^m = r^{-n-1} P_n^m(cos theta) e^{i m phi}
+   * for n < N and 0 <= m <= n, at (n*(n+1)/2+m)*batch + lane, which are
+   * Ynm of evalMultipole and evalLocal without the prefactor. With w = x+iy
+   * and s = r^2 (regular) or w = (x+iy)/r^2, z = z/r^2 and s = 1/r^2
+   * (irregular) both follow
+   *   S_m^m = -(2m-1) w S_{m-1}^{m-1}
+   *   (n-m+1) S_{n+1}^m = (2n+1) z S_n^m - (n+m) s S_{n-1}^m
+   * from S_0^0 = 1 or 1/r, so the only non-arithmetic operation is one
+   * reciprocal square root per point of the irregular harmonics.
+   */
+  void evalSolid(const real* x, const real* y, const real* z, int N,
+                 bool irregular, real* Rr, real* Ri) const {
+    real wr[batch], wi[batch], zz[batch], ss[batch];
+    for (int b = 0; b != batch; ++b) {
+      const real r2 = x[b]*x[b] + y[b]*y[b] + z[b]*z[b];
+      const real s = irregular ? 1 / r2 : 1;
+      wr[b] = x[b] * s;
+      wi[b] = y[b] * s;
+      zz[b] = z[b] * s;
+      ss[b] = irregular ? s : r2;
+      Rr[b] = irregular ? std::sqrt(s) : 1;
+      Ri[b] = 0;
+    }
+    for( int m=0; m!=N; ++m ) {
+      real* Smm = Rr + (m * (m + 1) / 2 + m) * batch;           // S_m^m
+      real* Smi = Ri + (m * (m + 1) / 2 + m) * batch;
+      if (m > 0) {
+        const real* Spr = Rr + ((m - 1) * m / 2 + m - 1) * batch;
+        const real* Spi = Ri + ((m - 1) * m / 2 + m - 1) * batch;
+        const real f = -(2 * m - 1);
+        for (int b = 0; b != batch; ++b) {
+          Smm[b] = f * (wr[b] * Spr[b] - wi[b] * Spi[b]);
+          Smi[b] = f * (wr[b] * Spi[b] + wi[b] * Spr[b]);
+        }
+      }
+      for( int n=m; n+1<N; ++n ) {
+        real* S1r = Rr + ((n + 1) * (n + 2) / 2 + m) * batch;   // S_{n+1}^m
+        real* S1i = Ri + ((n + 1) * (n + 2) / 2 + m) * batch;
+        const real* S0r = Rr + (n * (n + 1) / 2 + m) * batch;   // S_n^m
+        const real* S0i = Ri + (n * (n + 1) / 2 + m) * batch;
+        const real a = real(2 * n + 1) / (n - m + 1);
+        if (n == m) {
+          for (int b = 0; b != batch; ++b) {
+            S1r[b] = a * zz[b] * S0r[b];
+            S1i[b] = a * zz[b] * S0i[b];
+          }
+          continue;
+        }
+        const real* Smr = Rr + ((n - 1) * n / 2 + m) * batch;   // S_{n-1}^m
+        const real* Smi2 = Ri + ((n - 1) * n / 2 + m) * batch;
+        const real c = real(n + m) / (n - m + 1);
+        for (int b = 0; b != batch; ++b) {
+          S1r[b] = a * zz[b] * S0r[b] - c * ss[b] * Smr[b];
+          S1i[b] = a * zz[b] * S0i[b] - c * ss[b] * Smi2[b];
+        }
+      }
+    }
+  }
+
+  /** Accumulate Re(sum c S), Re(sum gx S), Re(sum gy S), Re(sum gz S) of
+   * the solid harmonics S of degree n < N at the targets into their results
+   */
+  template <typename TargetIter, typename ResultIter>
+  void evalExpansion(const complex* c, const complex* gx, const complex* gy,
+                     const complex* gz, int N, bool irregular,
+                     const point_type& center,
+                     TargetIter t_begin, TargetIter t_end,
+                     ResultIter r_begin) const {
+    const int NT = N*(N+1)/2;
+    real x[batch], y[batch], z[batch];
+    real Sr[NT*batch], Si[NT*batch];
+    while (t_begin != t_end) {
+      int nb = 0;
+      for ( ; nb != batch && t_begin != t_end; ++nb, ++t_begin) {
+        point_type dist = *t_begin - center;
+        x[nb] = dist[0]; y[nb] = dist[1]; z[nb] = dist[2];
+      }
+      for (int b = nb; b != batch; ++b) {                       // Pad with the first target
+        x[b] = x[0]; y[b] = y[0]; z[b] = z[0];
+      }
+      evalSolid(x, y, z, N, irregular, Sr, Si);
+      real pot[batch] = {0}, fx[batch] = {0}, fy[batch] = {0}, fz[batch] = {0};
+      for (int j = 0; j != NT; ++j) {
+        const real* sr = Sr + j * batch;
+        const real* si = Si + j * batch;
+        const real cr = std::real(c[j]), ci = std::imag(c[j]);
+        const real xr = std::real(gx[j]), xi = std::imag(gx[j]);
+        const real yr = std::real(gy[j]), yi = std::imag(gy[j]);
+        const real zr = std::real(gz[j]), zi = std::imag(gz[j]);
+        for (int b = 0; b != batch; ++b) {
+          pot[b] += cr * sr[b] - ci * si[b];
+          fx[b]  += xr * sr[b] - xi * si[b];
+          fy[b]  += yr * sr[b] - yi * si[b];
+          fz[b]  += zr * sr[b] - zi * si[b];
+        }
+      }
+      for (int b = 0; b != nb; ++b, ++r_begin) {
+        result_type& r = *r_begin;
+        r[0] += pot[b];
+        r[1] += fx[b];
+        r[2] += fy[b];
+        r[3] += fz[b];
+      }
+    }
+  }
+
+  /** Add the coefficient c of M[col] (or of conj(M[col])) to L[row] to the
+   * real column-major matrix T of the vector forms, see expansion_size().
+   * conj(M) is linear in the real and imaginary parts of M, so the complex
+   * operators are real matrices of 2x2 blocks.
+   */
+  void matrix_add(real* T, int row, int col, const complex& c,
+                  bool conjugate) const {
+    const int s = expansion_size();
+    // Columns of the real and imaginary parts of M[col]
+    real* Tr = T + 2*col*s + 2*row;
+    real* Ti = Tr + s;
+    const real cr = std::real(c), ci = std::imag(c);
+    Tr[0] += cr;
+    Tr[1] += ci;
+    if (conjugate) {
+      Ti[0] += ci;
+      Ti[1] -= cr;
+    } else {
+      Ti[0] -= ci;
+      Ti[1] += cr;
+    }
+  }
+
+  /** M2M by rotation, translation along the z-axis and rotation back */
+  void M2M_rotated(const multipole_type& Msource,
+                   multipole_type& Mtarget,
+                   const point_type& translation) const {
+    real Rmax = Mtarget.RMAX;
+    real R = norm(translation) + Msource.RCRIT;
+    if (R > Rmax) Rmax = R;
+    real rho;
+    complex ephi[P];
+    std::vector<real> scratch;
+    const std::vector<real>& d = z_rotation(translation, rho, ephi, scratch);
+    complex Ms[P*(P+1)/2], Mt[P*(P+1)/2];
+    rotate(&Msource[0], Ms, d, ephi);
+    real rhon[P];                                               // rho^n
+    rhon[0] = 1;
+    for( int n=1; n!=P; ++n ) rhon[n] = rhon[n-1] * rho;
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        complex M = 0;
+        for( int n=0; n<=j-k; ++n ) {                           // Only Y_n^0 of the translation
+          const int jnkm  = (j - n) * (j - n) + j - n + k;
+          const int jnkms = (j - n) * (j - n + 1) / 2 + k;
+          const int n0    = n * n + n;
+          M += Ms[jnkms] * rhon[n]
+              * real(ODDEVEN(n) * Anm[n0] * Anm[jnkm] / Anm[jk]);
+        }
+        Mt[jks] = M * EPS;
+      }
+    }
+    rotate_back(Mt, &Mtarget[0], d, ephi);
+    Mtarget.RMAX = Rmax;
+    Mtarget.RCRIT = std::min(Mtarget.RCRIT, Mtarget.RMAX);
+  }
+
+  /** M2L by rotation, translation along the z-axis and rotation back */
+  void M2L_rotated(const multipole_type& Msource,
+                   local_type& Ltarget,
+                   const point_type& translation) const {
+    real rho;
+    complex ephi[P];
+    std::vector<real> scratch;
+    const std::vector<real>& d = z_rotation(translation, rho, ephi, scratch);
+    complex Ms[P*(P+1)/2], Lt[P*(P+1)/2];
+    rotate(&Msource[0], Ms, d, ephi);
+    real rhon[2*P];                                             // rho^(-n-1)
+    rhon[0] = 1 / rho;
+    for( int n=1; n!=2*P; ++n ) rhon[n] = rhon[n-1] / rho;
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        complex L = 0;
+        for( int n=k; n!=P; ++n ) {                             // Only Y_{j+n}^0 of the translation
+          const int nms  = n * (n + 1) / 2 + k;
+          const int jknm = jk * max_P * max_P + n * n + n + k;
+          L += Ms[nms] * Cnm[jknm] * rhon[j+n];
+        }
+        Lt[jks] = L;
+      }
+    }
+    rotate_back(Lt, &Ltarget[0], d, ephi);
+  }
+
+  /** L2L by rotation, translation along the z-axis and rotation back */
+  void L2L_rotated(const local_type& source,
+                   local_type& target,
+                   const point_type& translation) const {
+    real rho;
+    complex ephi[P];
+    std::vector<real> scratch;
+    const std::vector<real>& d = z_rotation(translation, rho, ephi, scratch);
+    complex Ls[P*(P+1)/2], Lt[P*(P+1)/2];
+    rotate(&source[0], Ls, d, ephi);
+    real rhon[P];                                               // rho^n
+    rhon[0] = 1;
+    for( int n=1; n!=P; ++n ) rhon[n] = rhon[n-1] * rho;
+    for( int j=0; j!=P; ++j ) {
+      for( int k=0; k<=j; ++k ) {
+        const int jk = j * j + j + k;
+        const int jks = j * (j + 1) / 2 + k;
+        complex L = 0;
+        for( int n=j; n!=P; ++n ) {                             // Only Y_{n-j}^0 of the translation
+          const int nm   = n * n + n + k;
+          const int nms  = n * (n + 1) / 2 + k;
+          const int jn0  = (n - j) * (n - j) + n - j;
+          L += Ls[nms] * rhon[n-j] * (Anm[jn0] * Anm[jk] / Anm[nm]);
+        }
+        Lt[jks] = L * EPS;
+      }
+    }
+    rotate_back(Lt, &target[0], d, ephi);
+  }
+
+  /** The rotation taking the translation onto the positive z-axis
+   * @param[out] rho The length of the translation
+   * @param[out] ephi \f$ e^{im\phi} \f$ of the azimuth of the translation
+   * @param[in,out] scratch Storage of an unprepared rotation
+   * @returns The Wigner d-matrices of its polar angle
+   */
+  const std::vector<real>& z_rotation(const point_type& translation,
+                                      real& rho, complex* ephi,
+                                      std::vector<real>& scratch) const {
+    rho = norm(translation);
+    real rxy = std::sqrt(translation[0] * translation[0]
+                         + translation[1] * translation[1]);
+    complex eiphi = 1;
+    if (rxy > EPS * rho)
+      eiphi = complex(translation[0], translation[1]) / rxy;
+    ephi[0] = 1;
+    for( int m=1; m!=P; ++m ) ephi[m] = ephi[m-1] * eiphi;
+    return wigner(translation[2] / rho, scratch);
+  }
+
+  /** Rotate the coefficients C into the frame of a rotation:
+   * \f$ C'^k_n = \sum_m C^m_n e^{im\phi} d^n_{mk} \f$
+   */
+  void rotate(const complex* C, complex* Cr,
+              const std::vector<real>& d, const complex* ephi) const {
+    complex Ce[P];
+    for( int n=0; n!=P; ++n ) {
+      const int n0 = n * (n + 1) / 2;
+      for( int m=0; m<=n; ++m ) Ce[m] = C[n0+m] * ephi[m];
+      for( int k=0; k<=n; ++k ) {
+        complex c = Ce[0] * d[wigner_index(n,0,k)];
+        for( int m=1; m<=n; ++m )                               // d^n_{-m,k} = d^n_{m,-k}
+          c += Ce[m] * d[wigner_index(n,m,k)] + std::conj(Ce[m]) * d[wigner_index(n,m,-k)];
+        Cr[n0+k] = c;
+      }
+    }
+  }
+
+  /** Rotate the coefficients Cr back and accumulate them into C:
+   * \f$ C^m_n \mathrel{+}= e^{-im\phi} \sum_k C'^k_n d^n_{mk} \f$
+   */
+  void rotate_back(const complex* Cr, complex* C,
+                   const std::vector<real>& d, const complex* ephi) const {
+    for( int n=0; n!=P; ++n ) {
+      const int n0 = n * (n + 1) / 2;
+      for( int m=0; m<=n; ++m ) {
+        complex c = Cr[n0] * d[wigner_index(n,m,0)];
+        for( int k=1; k<=n; ++k )
+          c += Cr[n0+k] * d[wigner_index(n,m,k)] + std::conj(Cr[n0+k]) * d[wigner_index(n,m,-k)];
+        C[n0+m] += c * std::conj(ephi[m]);
+      }
+    }
+  }
+
+  /** Index of \f$ d^n_{mk} \f$, 0 <= m <= n, -n <= k <= n */
+  static int wigner_index(int n, int m, int k) {
+    return n * (n + 1) * (4 * n - 1) / 6 + m * (2 * n + 1) + k + n;
+  }
+
+  /** The Wigner d-matrices of a rotation about the y-axis by the polar angle
+   * theta, \f$ R_n^m(R_y(\theta) x) = \sum_k d^n_{mk} R_n^k(x) \f$ for the
+   * solid harmonics R of evalMultipole and n < max_P: the prepared ones, or
+   * else computed into scratch.
+   */
+  const std::vector<real>& wigner(real ctheta,
+                                  std::vector<real>& scratch) const {
+    auto it = rotations_.find(wigner_key(ctheta));
+    if (it != rotations_.end())
+      return it->second;
+    compute_wigner(scratch, ctheta);
+    return scratch;
+  }
+
+  /** The key of the polar angle acos(ctheta) in rotations_ */
+  static long long wigner_key(real ctheta) {
+    return std::llround(ctheta * real(1LL << 40));
+  }
+  static real wigner_angle(long long key) {
+    return real(key) / real(1LL << 40);
+  }
+
+  /** Compute the Wigner d-matrices of the polar angle acos(ctheta)
+   * The rotated harmonic of degree n is again of degree n, so its Fourier
+   * coefficients on a circle of constant polar angle are the row of d^n
+   * times the harmonics there. Some circles are combined in least squares
+   * so that no row relies on a zero of the harmonics.
+   */
+  void compute_wigner(std::vector<real>& d, real ctheta) const {
+    const int N = max_P;
+    const int K = 2 * N;                                        // Samples per circle
+    const real circle[3] = {0.7, 0.1, -0.45};                   // cos of polar angle of circles
+    const real stheta = std::sqrt(std::max(real(0), 1 - ctheta * ctheta));
+    d.assign(wigner_index(N,0,-N), 0);
+    std::vector<real> weight(N*N, 0);
+    complex Ynm[N*N], Yc[N*N], YnmTheta[N*N], eik[2*N+1];
+    for( int c=0; c!=3; ++c ) {
+      const real x = circle[c], y = std::sqrt(1 - x * x);
+      evalMultipole(1, std::acos(x), 0, Yc, YnmTheta, N);       // Real harmonics on the circle
+      for( int n=0; n!=N; ++n )
+        for( int k=-n; k<=n; ++k )
+          weight[n*n+n+k] += std::norm(Yc[n*n+n+k]);
+      for( int i=0; i!=K; ++i ) {
+        const real psi = 2 * M_PI * i / K;
+        const complex e = std::exp(-CI * psi);
+        eik[N] = 1;                                             // e^{-ik psi}
+        for( int k=1; k<=N; ++k ) {
+          eik[N+k] = eik[N+k-1] * e;
+          eik[N-k] = std::conj(eik[N+k]);
+        }
+        point_type u;                                           // R_y(theta) of the point on the circle
+        u[0] =  ctheta * y * std::cos(psi) + stheta * x;
+        u[1] =  y * std::sin(psi);
+        u[2] = -stheta * y * std::cos(psi) + ctheta * x;
+        real r, alpha, beta;
+        cart2sph(r, alpha, beta, u);
+        evalMultipole(1, alpha, beta, Ynm, YnmTheta, N);
+        for( int n=0; n!=N; ++n ) {
+          for( int m=0; m<=n; ++m ) {
+            const complex g = Ynm[n*n+n+m] / real(K);
+            for( int k=-n; k<=n; ++k )
+              d[wigner_index(n,m,k)] += std::real(g * eik[N+k]) * std::real(Yc[n*n+n+k]);
+          }
+        }
+      }
+    }
+    for( int n=0; n!=N; ++n )
+      for( int m=0; m<=n; ++m )
+        for( int k=-n; k<=n; ++k )
+          d[wigner_index(n,m,k)] /= weight[n*n+n+k];
+  }
 
   //! Evaluate solid harmonics \f$ r^n Y_{n}^{m} \f$
   void evalMultipole(real rho, real alpha, real beta,
                      complex* Ynm, complex* YnmTheta) const {
+    evalMultipole(rho, alpha, beta, Ynm, YnmTheta, P);
+  }
+
+  //! Evaluate solid harmonics \f$ r^n Y_{n}^{m} \f$ of the degrees n < N
+  void evalMultipole(real rho, real alpha, real beta,
+                     complex* Ynm, complex* YnmTheta, int N) const {
     real x = std::cos(alpha);                                   // x = cos(alpha)
     real y = std::sin(alpha);                                   // y = sin(alpha)
     real fact = 1;                                              // Initialize 2 * m + 1
     real pn = 1;                                                // Initialize Legendre polynomial Pn
     real rhom = 1;                                              // Initialize rho^m
-    for( int m=0; m!=P; ++m ) {                                 // Loop over m in Ynm
+    for( int m=0; m!=N; ++m ) {                                 // Loop over m in Ynm
       complex eim = std::exp(CI * real(m * beta));              //  exp(i * m * beta)
       real p = pn;                                              //  Associated Legendre polynomial Pnm
       int npn = m * m + 2 * m;                                  //  Index of Ynm for m > 0
@@ -471,7 +1348,7 @@ class LaplaceSpherical
       YnmTheta[npn] = rhom * (p - (m + 1) * x * p1) / y * prefactor[npn] * eim;// theta derivative of r^n * Ynm
       rhom *= rho;                                              //  rho^m
       real rhon = rhom;                                         //  rho^n
-      for( int n=m+1; n!=P; ++n ) {                             //  Loop over n in Ynm
+      for( int n=m+1; n!=N; ++n ) {                             //  Loop over n in Ynm
         int npm = n * n + n + m;                                //   Index of Ynm for m > 0
         int nmm = n * n + n - m;                                //   Index of Ynm for m < 0
         Ynm[npm] = rhon * p * prefactor[npm] * eim;             //   rho^n * Ynm
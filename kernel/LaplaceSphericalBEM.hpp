@@ -117,10 +117,33 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     };
   };
 
+  /** Expansion with a component for G (0, from POTENTIAL panels) and one for
+   * dG/dn (1, from NORMAL_DERIV panels). A component is only translated once
+   * it receives a contribution, so the boxes whose panels all have the same
+   * BC do half of the expansion work.
+   */
+  template <typename Expansion>
+  struct bc_expansion {
+    Expansion component[2];
+    //! Whether each component may be nonzero
+    bool used[2];
+
+    bc_expansion() {
+      used[0] = used[1] = false;
+    }
+
+    Expansion& operator[](const int i) {
+      return component[i];
+    }
+    const Expansion& operator[](const int i) const {
+      return component[i];
+    }
+  };
+
   //! Multipole expansion type
-  typedef std::vector<LaplaceSpherical::multipole_type> multipole_type;
+  typedef bc_expansion<LaplaceSpherical::multipole_type> multipole_type;
   //! Local expansion type
-  typedef std::vector<LaplaceSpherical::local_type> local_type;
+  typedef bc_expansion<LaplaceSpherical::local_type> local_type;
 
   //! Panel type (for BEM kernel(s)
   typedef Panel panel_type;
@@ -143,17 +166,84 @@ class LaplaceSphericalBEM : public LaplaceSpherical
   void init_multipole(multipole_type& M,
                       const point_type& extents, unsigned level) const {
     (void) level;
-    M.resize(2);
-    LaplaceSpherical::init_multipole(M[0], extents, level);
-    LaplaceSpherical::init_multipole(M[1], extents, level);
+    // Coefficients are zeroed on the first contribution, see use()
+    for (int i = 0; i < 2; ++i) {
+      M[i].RMAX = 0;
+      M[i].RCRIT = extents[0] / 2;
+      M.used[i] = false;
+    }
   }
   /** Initialize a local expansion with the size of a box at this level */
   void init_local(local_type& L,
                   const point_type& extents, unsigned level) const {
+    (void) extents;
     (void) level;
-    L.resize(2);
-    LaplaceSpherical::init_local(L[0], extents, level);
-    LaplaceSpherical::init_local(L[1], extents, level);
+    // Zeroed here rather than on the first contribution: the M2L into a
+    // target may come from several threads
+    for (int i = 0; i < 2; ++i) {
+      L[i].assign(P*(P+1)/2, 0);
+      L.used[i] = false;
+    }
+  }
+
+  /** Number of coefficients of the two component multipole expansion */
+  unsigned multipole_stride() const {
+    return 2*LaplaceSpherical::multipole_stride();
+  }
+  /** Number of coefficients of the two component local expansion */
+  unsigned local_stride() const {
+    return 2*LaplaceSpherical::local_stride();
+  }
+  /** Make both components of M views of consecutive coefficients at data */
+  void bind_multipole(multipole_type& M, coefficient_type* data) const {
+    LaplaceSpherical::bind_multipole(M[0], data);
+    LaplaceSpherical::bind_multipole(M[1], data + LaplaceSpherical::multipole_stride());
+  }
+  /** Make both components of L views of consecutive coefficients at data */
+  void bind_local(local_type& L, coefficient_type* data) const {
+    LaplaceSpherical::bind_local(L[0], data);
+    LaplaceSpherical::bind_local(L[1], data + LaplaceSpherical::local_stride());
+  }
+
+  /** Number of reals in the vector form of the two component expansions,
+   * see LaplaceSpherical::expansion_size()
+   */
+  unsigned expansion_size() const {
+    return 2*LaplaceSpherical::expansion_size();
+  }
+  //! Vector form of a multipole expansion, zero for the unused components
+  void multipole_to_vector(const multipole_type& M, real* v) const {
+    const unsigned s = LaplaceSpherical::expansion_size();
+    for (int i = 0; i < 2; ++i, v += s) {
+      if (M.used[i]) LaplaceSpherical::multipole_to_vector(M[i], v);
+      else           std::fill(v, v + s, real(0));
+    }
+  }
+  //! Vector form of a local expansion, zero for the unused components
+  void local_to_vector(const local_type& L, real* v) const {
+    const unsigned s = LaplaceSpherical::expansion_size();
+    for (int i = 0; i < 2; ++i, v += s) {
+      if (L.used[i]) LaplaceSpherical::local_to_vector(L[i], v);
+      else           std::fill(v, v + s, real(0));
+    }
+  }
+  //! Accumulate the vector form into M, skipping the zero components
+  void vector_to_multipole(const real* v, multipole_type& M) const {
+    const unsigned s = LaplaceSpherical::expansion_size();
+    for (int i = 0; i < 2; ++i, v += s) {
+      if (std::all_of(v, v + s, [](real x) { return x == 0; })) continue;
+      use(M, i);
+      LaplaceSpherical::vector_to_multipole(v, M[i]);
+    }
+  }
+  //! Accumulate the vector form into L, skipping the zero components
+  void vector_to_local(const real* v, local_type& L) const {
+    const unsigned s = LaplaceSpherical::expansion_size();
+    for (int i = 0; i < 2; ++i, v += s) {
+      if (std::all_of(v, v + s, [](real x) { return x == 0; })) continue;
+      use(L, i);
+      LaplaceSpherical::vector_to_local(v, L[i]);
+    }
   }
   /** perform Gaussian integration over panel to evaluate \int G */
   double eval_G(const source_type& source, const point_type& target) const {
@@ -296,6 +386,13 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     }
   }
 
+  /** The near field is assembled from panel quadratures, singular on and
+   * near the panel, and stays in double precision, so set_single_precision
+   * has no effect here. */
+  bool single_precision_near_field() const {
+    return false;
+  }
+
   /** Kernel P2M operation
    * M += Op(s) * c where M is the multipole and s is the source
    *
@@ -309,6 +406,7 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     complex Ynm[4*P*P], YnmTheta[4*P*P];
 
     auto& gauss_weight = BEMConfig::Instance()->GaussWeights(); // GQ.weights(3);
+    use(M, source.BC == Panel::POTENTIAL ? 0 : 1);
 
     for (auto i=0u; i<source.quad_points.size(); i++) {
       auto qp = source.quad_points[i];
@@ -351,6 +449,22 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     }
   }
 
+  /** Kernel P2M operation as a dense matrix
+   * The real column-major expansion_size() x n matrix A of the n sources
+   * with vec(M) += A c for the charges c, see EvalLeafMatrices.hpp.
+   */
+  template <typename SourceIter>
+  void P2M_matrix(SourceIter s_begin, SourceIter s_end,
+                  const point_type& center, real* A) const {
+    const unsigned s = expansion_size();
+    multipole_type M;
+    for ( ; s_begin != s_end; ++s_begin, A += s) {
+      init_multipole(M, point_type(real(0)), 0);
+      P2M(*s_begin, charge_type(1), center, M);
+      multipole_to_vector(M, A);
+    }
+  }
+
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
    *
@@ -362,8 +476,11 @@ class LaplaceSphericalBEM : public LaplaceSpherical
   void M2M(const multipole_type& Msource,
            multipole_type& Mtarget,
            const point_type& translation) const {
-    LaplaceSpherical::M2M(Msource[0],Mtarget[0],translation);
-    LaplaceSpherical::M2M(Msource[1],Mtarget[1],translation);
+    for (int i = 0; i < 2; ++i) {
+      if (!Msource.used[i]) continue;
+      use(Mtarget, i);
+      LaplaceSpherical::M2M(Msource[i],Mtarget[i],translation);
+    }
   }
 
   /** Kernel M2L operation
@@ -378,8 +495,11 @@ class LaplaceSphericalBEM : public LaplaceSpherical
   void M2L(const multipole_type& Msource,
                  local_type& Ltarget,
            const point_type& translation) const {
-    LaplaceSpherical::M2L(Msource[0],Ltarget[0],translation);
-    LaplaceSpherical::M2L(Msource[1],Ltarget[1],translation);
+    for (int i = 0; i < 2; ++i) {
+      if (!Msource.used[i]) continue;
+      use(Ltarget, i);
+      LaplaceSpherical::M2L(Msource[i],Ltarget[i],translation);
+    }
   }
 
   /** Kernel M2P operation
@@ -398,26 +518,28 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     complex Ynm[4*P*P], YnmTheta[4*P*P];
 
     for( ; t_begin != t_end ; ++t_begin, ++r_begin ) {
+      // A target only sees the component of its BC
+      const int c = ((*t_begin).BC == Panel::POTENTIAL) ? 0 : 1;
+      if (!M.used[c]) continue;
+      auto& Mc = M[c];
+
       point_type dist = static_cast<point_type>(*t_begin) - center;
-      point_type cartesian;
-      double r0_temp(0), r1_temp(0);
+      double r_temp(0);
       real r, theta, phi;
       cart2sph(r,theta,phi,dist);
       evalLocal(r,theta,phi,Ynm,YnmTheta);
       for( int n=0; n!=P; ++n ) {
         int nm  = n * n + n;
         int nms = n * (n + 1) / 2;
-        r0_temp += std::real(M[0][nms] * Ynm[nm]);
-        r1_temp += std::real(M[1][nms] * Ynm[nm]);
+        r_temp += std::real(Mc[nms] * Ynm[nm]);
         for( int m=1; m<=n; ++m ) {
           nm  = n * n + n + m;
           nms = n * (n + 1) / 2 + m;
-          r0_temp += 2 * std::real(M[0][nms] * Ynm[nm]);
-          r1_temp += 2 * std::real(M[1][nms] * Ynm[nm]);
+          r_temp += 2 * std::real(Mc[nms] * Ynm[nm]);
         }
       }
-      if   ((*t_begin).BC== Panel::POTENTIAL) *r_begin += r0_temp;
-      else                                    *r_begin -= r1_temp;
+      if   (c == 0) *r_begin += r_temp;
+      else          *r_begin -= r_temp;
     }
   }
 
@@ -432,8 +554,11 @@ class LaplaceSphericalBEM : public LaplaceSpherical
   void L2L(const local_type& source,
            local_type& target,
            const point_type& translation) const {
-    LaplaceSpherical::L2L(source[0],target[0],translation);
-    LaplaceSpherical::L2L(source[1],target[1],translation);
+    for (int i = 0; i < 2; ++i) {
+      if (!source.used[i]) continue;
+      use(target, i);
+      LaplaceSpherical::L2L(source[i],target[i],translation);
+    }
   }
 
   /** Kernel L2P operation
@@ -452,27 +577,79 @@ class LaplaceSphericalBEM : public LaplaceSpherical
     complex Ynm[4*P*P], YnmTheta[4*P*P];
 
     for (auto t = t_begin; t != t_end; ++t, ++r_begin) {
-      double r0_temp = 0., r1_temp = 0.;
+      // A target only sees the component of its BC
+      const int c = ((*t).BC == Panel::POTENTIAL) ? 0 : 1;
+      if (!L.used[c]) continue;
+      auto& Lc = L[c];
+
+      double r_temp = 0.;
       point_type dist = static_cast<point_type>(*t) - center;
-      point_type cartesian;
       real r, theta, phi;
       cart2sph(r,theta,phi,dist);
       evalMultipole(r,theta,phi,Ynm,YnmTheta);
       for( int n=0; n!=P; ++n ) {
         int nm  = n * n + n;
         int nms = n * (n + 1) / 2;
-        r0_temp += std::real(L[0][nms] * Ynm[nm]);
-        r1_temp += std::real(L[1][nms] * Ynm[nm]);
+        r_temp += std::real(Lc[nms] * Ynm[nm]);
         for( int m=1; m<=n; ++m ) {
           nm  = n * n + n + m;
           nms = n * (n + 1) / 2 + m;
-          r0_temp += 2 * std::real(L[0][nms] * Ynm[nm]);
-          r1_temp += 2 * std::real(L[1][nms] * Ynm[nm]);
+          r_temp += 2 * std::real(Lc[nms] * Ynm[nm]);
+        }
+      }
+      if   (c == 0) *r_begin += r_temp;
+      else          *r_begin -= r_temp;
+    }
+  }
+
+  /** Kernel L2P operation as a dense matrix
+   * The real column-major n x expansion_size() matrix B of the n targets
+   * with r += B vec(L), see EvalLeafMatrices.hpp.
+   */
+  template <typename TargetIter>
+  void L2P_matrix(const point_type& center,
+                  TargetIter t_begin, TargetIter t_end, real* B) const {
+    complex Ynm[4*P*P], YnmTheta[4*P*P];
+    unsigned n_t = 0;
+    for (auto t = t_begin; t != t_end; ++t) ++n_t;
+    const unsigned s = LaplaceSpherical::expansion_size();
+    std::fill(B, B + n_t * expansion_size(), real(0));
+
+    for (unsigned j = 0; j != n_t; ++j, ++t_begin) {
+      // A target only sees the component of its BC
+      const int c = ((*t_begin).BC == Panel::POTENTIAL) ? 0 : 1;
+      const real sign = (c == 0) ? 1 : -1;
+      // Columns of the real parts of the coefficients of component c
+      real* Bc = B + j + c * s * n_t;
+
+      point_type dist = static_cast<point_type>(*t_begin) - center;
+      real r, theta, phi;
+      cart2sph(r,theta,phi,dist);
+      evalMultipole(r,theta,phi,Ynm,YnmTheta);
+      for( int n=0; n!=P; ++n ) {
+        for( int m=0; m<=n; ++m ) {
+          const int nm  = n * n + n + m;
+          const int nms = n * (n + 1) / 2 + m;
+          // Re(L Y) = Re(L) Re(Y) - Im(L) Im(Y), twice for m > 0
+          const real f = (m == 0) ? sign : 2 * sign;
+          Bc[(2*nms  ) * n_t] =  f * std::real(Ynm[nm]);
+          Bc[(2*nms+1) * n_t] = -f * std::imag(Ynm[nm]);
         }
       }
-      if   ((*t).BC== Panel::POTENTIAL) *r_begin += r0_temp;
-      else                              *r_begin -= r1_temp;
     }
   }
+
+ private:
+
+  /** Zero component i of M on its first contribution */
+  void use(multipole_type& M, int i) const {
+    if (M.used[i]) return;
+    M[i].M.assign(P*(P+1)/2, 0);
+    M.used[i] = true;
+  }
+  /** Mark component i of L as nonzero, it is zeroed by init_local */
+  void use(local_type& L, int i) const {
+    L.used[i] = true;
+  }
 };
 
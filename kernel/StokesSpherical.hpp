@@ -33,6 +33,8 @@ class StokesSpherical : public LaplaceSpherical
   typedef std::vector<LaplaceSpherical::multipole_type> multipole_type;
   //! local type
   typedef std::vector<LaplaceSpherical::local_type> local_type;
+  //! sources of a leaf in structure-of-arrays form for the packed P2P
+  typedef SourcePack<real,3> source_pack_type;
 
   //! default (delegating) constructor
   StokesSpherical() : StokesSpherical(5) {};
@@ -45,7 +47,7 @@ class StokesSpherical : public LaplaceSpherical
 
   /** Initialize a multipole expansion */
   void init_multipole(multipole_type& M, const point_type& extents, unsigned level) const {
-    M = std::vector<LaplaceSpherical::multipole_type>(4);
+    M.resize(4);
     for (unsigned i=0; i<4; i++) {
       LaplaceSpherical::init_multipole(M[i], extents, level);
     }
@@ -58,6 +60,27 @@ class StokesSpherical : public LaplaceSpherical
     }
   }
 
+  /** Number of coefficients of the four component multipole expansion */
+  unsigned multipole_stride() const {
+    return 4*LaplaceSpherical::multipole_stride();
+  }
+  /** Number of coefficients of the four component local expansion */
+  unsigned local_stride() const {
+    return 4*LaplaceSpherical::local_stride();
+  }
+  /** Make the components of M views of consecutive coefficients at data */
+  void bind_multipole(multipole_type& M, coefficient_type* data) const {
+    M.resize(4);
+    for (unsigned i=0; i<4; i++)
+      LaplaceSpherical::bind_multipole(M[i], data + i*LaplaceSpherical::multipole_stride());
+  }
+  /** Make the components of L views of consecutive coefficients at data */
+  void bind_local(local_type& L, coefficient_type* data) const {
+    L.resize(4);
+    for (unsigned i=0; i<4; i++)
+      LaplaceSpherical::bind_local(L[i], data + i*LaplaceSpherical::local_stride());
+  }
+
 
 #ifndef STRESSLET
   /** Kernel evaluation
@@ -81,6 +104,45 @@ class StokesSpherical : public LaplaceSpherical
     // real invR = std::sqrt(invR2);
     return r;
   }
+
+  /** Kernel value transpose
+   * The Stokeslet is even in s - t and a symmetric tensor, so K(s,t) = K(t,s)
+   *
+   * @param[in] kst A kernel value that was returned from operator()(s,t)
+   * @returns The value of K(t,s)
+   */
+  kernel_value_type transpose(const kernel_value_type& kst) const {
+    return kst;
+  }
+
+  /** Packed kernel evaluation
+   * r += sum_j K(t,s_j) * f_j over a pack of sources with forces f_j
+   */
+  void operator()(const target_type& t, const source_pack_type& s,
+                  result_type& r) const {
+    const real tx = t[0], ty = t[1], tz = t[2];
+    const real* x = s.x;
+    const real* y = s.y;
+    const real* z = s.z;
+    const real* f1 = s.c[0];
+    const real* f2 = s.c[1];
+    const real* f3 = s.c[2];
+    real u1 = 0, u2 = 0, u3 = 0;
+#pragma omp simd aligned(x,y,z,f1,f2,f3:64) reduction(+:u1,u2,u3)
+    for (unsigned j = 0; j < s.size; ++j) {
+      real dx = x[j] - tx, dy = y[j] - ty, dz = z[j] - tz;
+      real r2 = dx*dx + dy*dy + dz*dz;
+      real invR2 = (r2 < 1e-8) ? 0 : 1 / r2;
+      real invR3 = invR2 * std::sqrt(invR2);
+      real df = (dx*f1[j] + dy*f2[j] + dz*f3[j]) * invR3;
+      u1 += r2 * invR3 * f1[j] + dx * df;
+      u2 += r2 * invR3 * f2[j] + dy * df;
+      u3 += r2 * invR3 * f3[j] + dz * df;
+    }
+    r[0] += u1;
+    r[1] += u2;
+    r[2] += u3;
+  }
 #else
   template <typename SourceIter, typename ChargeIter,
             typename TargetIter, typename ResultIter>
@@ -157,6 +157,27 @@ class StokesSphericalBEM : public StokesSpherical
     StokesSpherical::init_local(L[1],extents,level);
   }
 
+  /** Number of coefficients of the stokeslet and stresslet multipoles */
+  unsigned multipole_stride() const {
+    return 2*StokesSpherical::multipole_stride();
+  }
+  /** Number of coefficients of the stokeslet and stresslet locals */
+  unsigned local_stride() const {
+    return 2*StokesSpherical::local_stride();
+  }
+  /** Make all components of M views of consecutive coefficients at data */
+  void bind_multipole(multipole_type& M, coefficient_type* data) const {
+    M.resize(2);
+    StokesSpherical::bind_multipole(M[0], data);
+    StokesSpherical::bind_multipole(M[1], data + StokesSpherical::multipole_stride());
+  }
+  /** Make all components of L views of consecutive coefficients at data */
+  void bind_local(local_type& L, coefficient_type* data) const {
+    L.resize(2);
+    StokesSpherical::bind_local(L[0], data);
+    StokesSpherical::bind_local(L[1], data + StokesSpherical::local_stride());
+  }
+
   kernel_value_type eval_traction_integral(const source_type& source, const target_type& target) const
   {
     auto dist = static_cast<point_type>(target) - source.center;
@@ -9,8 +9,11 @@
 
 #include <complex>
 #include <vector>
+#include <map>
 #include <cassert>
 #include <Vec.hpp>
+#include "PlaneWave.hpp"
+#include "SourcePack.hpp"
 
 class YukawaCartesian
 {
@@ -33,6 +36,8 @@ class YukawaCartesian
   std::vector<unsigned> index;
   //! factorial cache
   std::vector<double> fact;
+  //! Plane-wave quadratures of the directional M2L, by box side
+  mutable std::map<double, PlaneWaveQuadrature> plane_waves;
 
  protected:
   //! store all possible index combinations returned from setIndex
@@ -95,6 +100,8 @@ class YukawaCartesian
   typedef Vec<4,real> kernel_value_type;
   //! The product of the kernel_value_type and the charge_type
   typedef Vec<4,real> result_type;
+  //! Sources of a leaf in structure-of-arrays form for the packed P2P
+  typedef SourcePack<real,1> source_pack_type;
 
   //! default constructor - use delegating constructor
   YukawaCartesian() : YukawaCartesian(4,0.125) {};
@@ -158,6 +165,42 @@ class YukawaCartesian
     return kernel_value_type(pot, -dist[0], -dist[1], -dist[2]);
   }
 
+  /** Packed kernel evaluation
+   * r += sum_j K(t,s_j) * c_j over a pack of sources
+   *
+   * @param[in] t The target point
+   * @param[in] s The sources and charges, see SourcePack.hpp
+   * @param[in,out] r The result to accumulate into
+   */
+  void operator()(const point_type& t, const source_pack_type& s,
+                  result_type& r) const {
+    const real tx = t[0], ty = t[1], tz = t[2];
+    const real* x = s.x;
+    const real* y = s.y;
+    const real* z = s.z;
+    const real* c = s.c[0];
+    const real kappa = Kappa;
+    real pot = 0, fx = 0, fy = 0, fz = 0;
+#pragma omp simd aligned(x,y,z,c:64) reduction(+:pot,fx,fy,fz)
+    for (unsigned j = 0; j < s.size; ++j) {
+      real dx = x[j] - tx, dy = y[j] - ty, dz = z[j] - tz;
+      real r2 = dx*dx + dy*dy + dz*dz;
+      real d  = std::sqrt(r2);
+      real invR  = (d < 1e-8) ? 0 : 1 / d;
+      real invR2 = invR * invR;
+      real p = c[j] * std::exp(-kappa * d) * invR;
+      real f = p * (kappa * d + 1) * invR2;
+      pot += p;
+      fx += dx * f;
+      fy += dy * f;
+      fz += dz * f;
+    }
+    r[0] += pot;
+    r[1] += fx;
+    r[2] += fy;
+    r[3] += fz;
+  }
+
   /** Kernel P2M operation
    * M += Op(s) * c where M is the multipole and s is the source
    *
@@ -178,6 +221,11 @@ class YukawaCartesian
                      * pow(dX[2],K[i]) / fact_term;
     }
   }
+  /** Kernel P2M operation at the full expansion order */
+  void P2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    P2M(source, charge, center, M, P);
+  }
 
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
@@ -208,6 +256,12 @@ class YukawaCartesian
       }
     }
   }
+  /** Kernel M2M operation at the full expansion order */
+  void M2M(const multipole_type& Msource,
+                 multipole_type& Mtarget,
+           const point_type& translation) const {
+    M2M(Msource, Mtarget, translation, P);
+  }
 
   /** Kernel M2P operation
    * r += Op(M, t) where M is the multipole and r is the result
@@ -237,6 +291,11 @@ class YukawaCartesian
       result[3] += az_aux[j]*M[j]*fact_term;
     }
   }
+  /** Kernel M2P operation at the full expansion order */
+  void M2P(const multipole_type& M, const point_type& center,
+           const target_type& target, result_type& result) const {
+    M2P(M, center, target, result, P);
+  }
 
   /** Kernel M2L operation
    * L += Op(M)
@@ -289,6 +348,12 @@ class YukawaCartesian
       }
     } // end outer loop
   }
+  /** Kernel M2L operation at the full expansion order */
+  void M2L(const multipole_type& Msource,
+                 local_type& Ltarget,
+           const point_type& translation) const {
+    M2L(Msource, Ltarget, translation, P);
+  }
 
   /** Kernel L2L operation
    * L_t += Op(L_s) where L_t is the target and L_s is the source
@@ -319,6 +384,12 @@ class YukawaCartesian
       }
     }
   }
+  /** Kernel L2L operation at the full expansion order */
+  void L2L(const local_type& Lsource,
+                 local_type& Ltarget,
+           const point_type& translation) const {
+    L2L(Lsource, Ltarget, translation, P);
+  }
 
   /** Kernel L2P operation
    * r += Op(L, t) where L is the local expansion and r is the result
@@ -350,6 +421,155 @@ class YukawaCartesian
       result[3] += phi * k[2] * inv[2];
     }
   }
+  /** Kernel L2P operation at the full expansion order */
+  void L2P(const local_type& L, const point_type& center,
+           const target_type& target, result_type& result) const {
+    L2P(L, center, target, result, P);
+  }
+
+  /** Directional plane-wave M2L, see EvalM2L_Exp.hpp
+   * The boxes of one side in the +z list of each other (centers at least
+   * two and at most five sides apart in z, and at most as far in x and y)
+   * interact through
+   *   d^n G(r) = int (i lambda cos alpha)^nx (i lambda sin alpha)^ny (-mu)^nz
+   *              e^{-mu z + i lambda (x cos alpha + y sin alpha)},
+   * so the M2L factors into a multipole to exponential expansion per source,
+   * a diagonal translation per pair and an exponential to local expansion
+   * per target. The other five directions are mapped onto +z by permuting
+   * and reflecting the axes.
+   */
+  typedef std::complex<real> exp_type;
+
+  /** Number of plane waves of the boxes of a side
+   * Builds the quadrature of the side on first use, so it must be called
+   * once for every side before the other operations.
+   */
+  unsigned M2L_exp_size(double side) const {
+    auto it = plane_waves.find(side);
+    if (it == plane_waves.end()) {
+      double tol = std::pow(10., -0.5 * (P + 4));
+      it = plane_waves.insert(std::make_pair(side,
+          yukawa_plane_waves(Kappa * side, 6, tol))).first;
+    }
+    return it->second.size();
+  }
+  /** The direction 0..5 (+x,-x,+y,-y,+z,-z) of a translation between boxes
+   * of a side, or -1 if they cannot interact through plane waves
+   */
+  int M2L_exp_direction(const point_type& translation, double side) const {
+    unsigned a = 0;
+    for (unsigned d = 1; d < 3; ++d)
+      if (fabs(translation[d]) > fabs(translation[a])) a = d;
+    const double z = fabs(translation[a]) / side;
+    if (z < 2 - 1e-8 || z > 5 + 1e-8)
+      return -1;
+    return 2*a + (translation[a] < 0);
+  }
+  /** Exponential expansion X of the multipole M in a direction */
+  void M2L_exp_multipole(const multipole_type& M, double side, int dir,
+                         exp_type* X) const {
+    const PlaneWaveQuadrature& pw = plane_waves.find(side)->second;
+    const unsigned a = dir/2, b = (a+1) % 3, c = (a+2) % 3;
+    const int P1 = P+1;
+
+    // M in the rotated frame and units of the side, by (nb,nc) then na
+    std::vector<real> Ms(P1*P1*P1, 0);
+    for (unsigned i = 0; i < MTERMS; ++i) {
+      const unsigned n[3] = {I[i], J[i], K[i]};
+      real m = M[i] / std::pow(side, n[0]+n[1]+n[2]);
+      if ((dir & 1) && (n[a] & 1)) m = -m;
+      Ms[(n[b]*P1 + n[c])*P1 + n[a]] = m;
+    }
+
+    std::vector<real> S(P1*P1), cb(P1), sc(P1);
+    std::vector<exp_type> il(P1);
+    for (unsigned k = 0; k < pw.mu.size(); ++k) {
+      // Sum over nz with (-mu)^nz first
+      for (int nb = 0; nb <= P; ++nb)
+        for (int nc = 0; nb+nc <= P; ++nc) {
+          real s = 0, mun = 1;
+          for (int na = 0; na+nb+nc <= P; ++na, mun *= -pw.mu[k])
+            s += Ms[(nb*P1 + nc)*P1 + na] * mun;
+          S[nb*P1 + nc] = s;
+        }
+      il[0] = 1;
+      for (int t = 1; t <= P; ++t)
+        il[t] = il[t-1] * exp_type(0, pw.lambda[k]);
+
+      // Then over nx, ny with (i lambda)^(nx+ny) cos^nx sin^ny per angle
+      for (unsigned j = pw.offset[k]; j < pw.offset[k] + pw.angles[k]; ++j) {
+        cb[0] = sc[0] = 1;
+        for (int t = 1; t <= P; ++t) {
+          cb[t] = cb[t-1] * pw.cos_alpha[j];
+          sc[t] = sc[t-1] * pw.sin_alpha[j];
+        }
+        exp_type x = 0;
+        for (int t = 0; t <= P; ++t) {
+          real q = 0;
+          for (int nb = 0; nb <= t; ++nb)
+            q += S[nb*P1 + t-nb] * cb[nb] * sc[t-nb];
+          x += il[t] * q;
+        }
+        X[j] = x;
+      }
+    }
+  }
+  /** Diagonal translation T of the exponential expansions in a direction */
+  void M2L_exp_translation(const point_type& translation, double side, int dir,
+                           exp_type* T) const {
+    const PlaneWaveQuadrature& pw = plane_waves.find(side)->second;
+    const unsigned a = dir/2, b = (a+1) % 3, c = (a+2) % 3;
+    const real z = ((dir & 1) ? -translation[a] : translation[a]) / side;
+    const real x = translation[b] / side;
+    const real y = translation[c] / side;
+    for (unsigned k = 0; k < pw.mu.size(); ++k) {
+      const real decay = std::exp(-pw.mu[k] * z);
+      for (unsigned j = pw.offset[k]; j < pw.offset[k] + pw.angles[k]; ++j) {
+        const real phase = pw.lambda[k] * (x * pw.cos_alpha[j] + y * pw.sin_alpha[j]);
+        T[j] = exp_type(decay * std::cos(phase), decay * std::sin(phase));
+      }
+    }
+  }
+  /** Accumulate the local expansion of the exponential expansion Y */
+  void M2L_exp_local(const exp_type* Y, double side, int dir,
+                     local_type& L) const {
+    const PlaneWaveQuadrature& pw = plane_waves.find(side)->second;
+    const unsigned a = dir/2, b = (a+1) % 3, c = (a+2) % 3;
+    const int P1 = P+1;
+
+    // Sum over the angles of Y cos^kx sin^ky per node, then over the nodes
+    // of the real part with (i lambda)^(kx+ky) and (-mu)^kz
+    std::vector<real> Ls(P1*P1*P1, 0), cb(P1), sc(P1);
+    std::vector<exp_type> Z(P1*P1);
+    for (unsigned k = 0; k < pw.mu.size(); ++k) {
+      std::fill(Z.begin(), Z.end(), exp_type(0));
+      for (unsigned j = pw.offset[k]; j < pw.offset[k] + pw.angles[k]; ++j) {
+        cb[0] = sc[0] = 1;
+        for (int t = 1; t <= P; ++t) {
+          cb[t] = cb[t-1] * pw.cos_alpha[j];
+          sc[t] = sc[t-1] * pw.sin_alpha[j];
+        }
+        for (int kb = 0; kb <= P; ++kb)
+          for (int kc = 0; kb+kc <= P; ++kc)
+            Z[kb*P1 + kc] += Y[j] * (cb[kb] * sc[kc]);
+      }
+      // Real part of the plane waves at alpha and alpha + pi
+      exp_type il = 2 * pw.weight[k];
+      for (int t = 0; t <= P; ++t, il *= exp_type(0, pw.lambda[k]))
+        for (int kb = 0; kb <= t; ++kb) {
+          real r = std::real(il * Z[kb*P1 + t-kb]), mun = 1;
+          for (int ka = 0; ka+t <= P; ++ka, mun *= -pw.mu[k])
+            Ls[(kb*P1 + t-kb)*P1 + ka] += r * mun;
+        }
+    }
+
+    for (unsigned i = 0; i < MTERMS; ++i) {
+      const unsigned n[3] = {I[i], J[i], K[i]};
+      real l = Ls[(n[b]*P1 + n[c])*P1 + n[a]] / std::pow(side, n[0]+n[1]+n[2]+1);
+      if ((dir & 1) && (n[a] & 1)) l = -l;
+      L[i] += l;
+    }
+  }
 
  protected:
   // get coefficients given by d^n / dx^n f(x)
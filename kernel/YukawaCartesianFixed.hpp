@@ -0,0 +1,301 @@
+#pragma once
+/** @file YukawaCartesianFixed.hpp
+ * @brief Implements the Yukawa kernel with cartesian expansions of an order
+ * fixed at compile time
+ *
+ * K(t,s) = exp(-Kappa*|t-s|) / |t-s|                           // Potential
+ * K(t,s) = -(Kappa*|t-s|+1) exp(-Kappa*|t-s|) (t-s) / |t-s|^3  // Force
+ *
+ * The expansions are those of YukawaCartesian(P), but the terms are indexed
+ * by the constexpr cart_index and the operators are unrolled by the templates
+ * of LaplaceCartesian.hpp. Only the derivatives of the kernel in the M2L and
+ * M2P are particular to Yukawa.
+ */
+
+#include "Vec.hpp"
+#include "LaplaceCartesian.hpp"
+
+#include <cmath>
+
+
+/** Accumulate w * C[n - k e_d] into s if n - k e_d is a multi-index */
+template <int nx, int ny, int nz, int d, int k,
+          bool = ((d == 0 ? nx : d == 1 ? ny : nz) >= k)>
+struct YukawaLower {
+  template <typename Lset>
+  static inline void add(real& s, const Lset& C, const real& w) {
+    s += w * C[Index<nx - k*(d == 0), ny - k*(d == 1), nz - k*(d == 2)>::I];
+  }
+};
+template <int nx, int ny, int nz, int d, int k>
+struct YukawaLower<nx,ny,nz,d,k,false> {
+  template <typename Lset>
+  static inline void add(real&, const Lset&, const real&) {}
+};
+
+/** Taylor coefficients A of exp(-kappa r)/r and B of exp(-kappa r) of the
+ * multi-index n = (nx,ny,nz) from those of lower orders:
+ *   B_n = -kappa/|n| sum_d (x_d A_{n-e_d} + A_{n-2e_d})
+ *   A_n = 1/(|n| r^2) sum_d (-kappa (x_d B_{n-e_d} + B_{n-2e_d})
+ *                            - (2|n|-1) x_d A_{n-e_d} - (|n|-1) A_{n-2e_d})
+ */
+template<int nx, int ny, int nz>
+struct YukawaTerm {
+  static constexpr int n = nx + ny + nz;
+  template <typename Lset, typename vect>
+  static inline void coef(Lset& A, Lset& B, const vect& dist,
+                          const real& invR2, const real& kappa) {
+    real a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+    YukawaLower<nx,ny,nz,0,1>::add(a1, A, dist[0]);
+    YukawaLower<nx,ny,nz,1,1>::add(a1, A, dist[1]);
+    YukawaLower<nx,ny,nz,2,1>::add(a1, A, dist[2]);
+    YukawaLower<nx,ny,nz,0,2>::add(a2, A, 1);
+    YukawaLower<nx,ny,nz,1,2>::add(a2, A, 1);
+    YukawaLower<nx,ny,nz,2,2>::add(a2, A, 1);
+    YukawaLower<nx,ny,nz,0,1>::add(b1, B, dist[0]);
+    YukawaLower<nx,ny,nz,1,1>::add(b1, B, dist[1]);
+    YukawaLower<nx,ny,nz,2,1>::add(b1, B, dist[2]);
+    YukawaLower<nx,ny,nz,0,2>::add(b2, B, 1);
+    YukawaLower<nx,ny,nz,1,2>::add(b2, B, 1);
+    YukawaLower<nx,ny,nz,2,2>::add(b2, B, 1);
+    B[Index<nx,ny,nz>::I] = -kappa / n * (a1 + a2);
+    A[Index<nx,ny,nz>::I] = invR2 / n * (-kappa * (b1 + b2)
+                                         - (2*n-1) * a1 - (n-1) * a2);
+  }
+};
+
+/** All multi-indices up to (nx,ny,nz) in the order of Terms */
+template<int nx, int ny, int nz>
+struct YukawaTerms {
+  template <typename Lset, typename vect>
+  static inline void derivative(Lset& A, Lset& B, const vect& dist,
+                                const real& invR2, const real& kappa) {
+    YukawaTerms<nx,ny+1,nz-1>::derivative(A,B,dist,invR2,kappa);
+    YukawaTerm<nx,ny,nz>::coef(A,B,dist,invR2,kappa);
+  }
+};
+template<int nx, int ny>
+struct YukawaTerms<nx,ny,0> {
+  template <typename Lset, typename vect>
+  static inline void derivative(Lset& A, Lset& B, const vect& dist,
+                                const real& invR2, const real& kappa) {
+    YukawaTerms<nx+1,0,ny-1>::derivative(A,B,dist,invR2,kappa);
+    YukawaTerm<nx,ny,0>::coef(A,B,dist,invR2,kappa);
+  }
+};
+template<int nx>
+struct YukawaTerms<nx,0,0> {
+  template <typename Lset, typename vect>
+  static inline void derivative(Lset& A, Lset& B, const vect& dist,
+                                const real& invR2, const real& kappa) {
+    YukawaTerms<0,0,nx-1>::derivative(A,B,dist,invR2,kappa);
+    YukawaTerm<nx,0,0>::coef(A,B,dist,invR2,kappa);
+  }
+};
+template<>
+struct YukawaTerms<0,0,0> {
+  template <typename Lset, typename vect>
+  static inline void derivative(Lset&, Lset&, const vect&,
+                                const real&, const real&) {}
+};
+
+/** Derivatives C of exp(-kappa r)/r up to order P at dist */
+template<int P, typename Lset, typename vect>
+inline void getYukawaCoef(Lset& C, const vect& dist, const real& kappa) {
+  const real R2 = normSq(dist);
+  const real R  = std::sqrt(R2);
+  Lset B;
+  B[0] = std::exp(-kappa * R);
+  C[0] = B[0] / R;
+  YukawaTerms<0,0,P>::derivative(C, B, dist, 1 / R2, kappa);
+  Terms<0,0,P>::scale(C);
+}
+
+
+template <unsigned P>
+class YukawaCartesianFixed
+{
+  //! Number of Cartesian terms, of orders 0 to P
+  static constexpr int MTERMS = (P+1)*(P+2)*(P+3)/6;
+
+  //! Kappa
+  real Kappa;
+
+ public:
+  //! The dimension of the Kernel
+  static constexpr unsigned dimension = 3;
+  //! Point type
+  typedef Vec<dimension,real> point_type;
+  //! Source type
+  typedef point_type source_type;
+  //! Target type
+  typedef point_type target_type;
+  //! Charge type
+  typedef real charge_type;
+  //! The return type of a kernel evaluation
+  typedef Vec<4,real> kernel_value_type;
+  //! The product of the kernel_value_type and the charge_type
+  typedef Vec<4,real> result_type;
+
+  //! Multipole expansion type
+  typedef Vec<MTERMS,real> multipole_type;
+  //! Local expansion type
+  typedef Vec<MTERMS,real> local_type;
+
+  //! Constructor
+  YukawaCartesianFixed(double kappa=0.125)
+      : Kappa(kappa) {
+  }
+
+  /** Initialize a multipole expansion to zero */
+  void init_multipole(multipole_type& M,
+                      const point_type&, unsigned) const {
+    M = multipole_type(real(0));
+  }
+  /** Initialize a local expansion to zero */
+  void init_local(local_type& L,
+                  const point_type&, unsigned) const {
+    L = local_type(real(0));
+  }
+
+  /** Kernel evaluation
+   * K(t,s)
+   *
+   * @param[in] t,s The target and source points to evaluate the kernel
+   */
+  kernel_value_type operator()(const point_type& t,
+                               const point_type& s) const {
+    point_type dist = t - s;
+    real r2 = normSq(dist);
+    real r  = std::sqrt(r2);
+    real invR2 = 1.0/r2;
+    real invR  = 1.0/r;
+    if( r < 1e-8 ) { invR = 0; invR2 = 0; };
+    real pot = exp(-Kappa*r) * invR;
+    dist *= pot * (Kappa * r + 1) * invR2;
+    return kernel_value_type(pot, -dist[0], -dist[1], -dist[2]);
+  }
+
+  /** Kernel P2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] source The source to accumulate into the multipole
+   * @param[in] charge The source's corresponding charge
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  void P2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    point_type dist = center - source;
+    multipole_type C;
+    C[0] = charge;
+    Terms<0,0,P>::power(C, dist);
+    M += C;
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    multipole_type C;
+    C[0] = 1;
+    Terms<0,0,P>::power(C, translation);
+    for (int i = 0; i < MTERMS; ++i)
+      Mtarget[i] += C[i] * Msource[0];
+    Upward<0,0,P>::M2M(Mtarget, C, Msource);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] M The multpole expansion source
+   * @param[in,out] L The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2L(const multipole_type& M,
+           local_type& L,
+           const point_type& translation) const {
+    local_type C;
+    getYukawaCoef<P>(C, translation, Kappa);
+    // The multipole has the order of the local expansion, so all of it
+    // reaches L[0]
+    for (int i = 0; i < MTERMS; ++i)
+      L[i] += M[0] * C[i];
+    for (int i = 1; i < MTERMS; ++i)
+      L[0] += M[i] * C[i];
+    Downward<P,0,0,P-1>::M2L(L, C, M);
+  }
+
+  /** Kernel M2P operation
+   * r += Op(M, t) where M is the multipole and r is the result
+   *
+   * @param[in] M The multpole expansion
+   * @param[in] center The center of the box with the multipole expansion
+   * @param[in] target The target to evaluate the multipole at
+   * @param[in,out] result The target's corresponding result to accumulate into
+   * @pre M includes the influence of all sources within its box
+   */
+  void M2P(const multipole_type& M, const point_type& center,
+           const target_type& target, result_type& result) const {
+    local_type C;
+    getYukawaCoef<P>(C, target - center, Kappa);
+    result[1] += M[0] * C[1];
+    result[2] += M[0] * C[2];
+    result[3] += M[0] * C[3];
+    for (int i = 0; i < MTERMS; ++i)
+      result[0] += M[i] * C[i];
+    Downward<P,0,0,1>::M2P(result, C, M);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    local_type C;
+    C[0] = 1;
+    Terms<0,0,P>::power(C, translation);
+    Ltarget += Lsource;
+    for (int i = 1; i < MTERMS; ++i)
+      Ltarget[0] += C[i] * Lsource[i];
+    Downward<P,0,0,P-1>::L2L(Ltarget, C, Lsource);
+  }
+
+  /** Kernel L2P operation
+   * r += Op(L, t) where L is the local expansion and r is the result
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] target The target of this L2P operation
+   * @param[in] result The result to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  void L2P(const local_type& L, const point_type& center,
+           const target_type& target, result_type& result) const {
+    local_type C;
+    C[0] = 1;
+    Terms<0,0,P>::power(C, target - center);
+    result[0] += L[0];
+    result[1] += L[1];
+    result[2] += L[2];
+    result[3] += L[3];
+    for (int i = 1; i < MTERMS; ++i)
+      result[0] += C[i] * L[i];
+    Downward<P,0,0,1>::L2P(result, C, L);
+  }
+};
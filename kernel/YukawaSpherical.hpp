@@ -10,6 +10,7 @@
 #include <complex>
 #include <vector>
 #include <map>
+#include <cmath>
 #include "Vec.hpp"
 #include <boost/multi_array.hpp>
 #include <tr1/cmath>
@@ -42,7 +43,11 @@ class YukawaSpherical
   typedef boost::multi_array_types::extent_range range;
   Mat2d sqc;
   Mat3d M2MRotPlus, M2MRotMinus;
-  mutable std::map<int,Mat3d> M2MShiftingMatrices;
+  //! M2M shifting matrices, by level and quantized length of the shift
+  mutable std::map<std::pair<unsigned,long long>,Mat3d> M2MShiftingMatrices;
+  //! Scaled modified spherical Bessel series i_n(x) / scale^n, by quantized
+  //! scale and argument, so the shifts of a level share them
+  mutable std::map<std::pair<long long,long long>,std::vector<real>> BesselI;
 
   //! square root of binomial coefficients
   std::vector<real> C;
@@ -180,7 +185,7 @@ class YukawaSpherical
            const point_type& center, multipole_type& M) const {
     real Rmax = 0;
     complex Ynm[4*P*P], YnmTheta[4*P*P];
-    double BI[P+1];
+    double BI[P+2];
 
     for ( ; p_begin != p_end; ++p_begin, ++c_begin) {
       point_type dist = *p_begin - center;
@@ -189,20 +194,20 @@ class YukawaSpherical
       real rho, alpha, beta;
       cart2sph(rho,alpha,beta,dist);
       evalLegendre<true>(rho,alpha,-beta,Ynm,YnmTheta);
+      // get the bessel functions, once per source
+#ifdef USE_FORT_IN
+      auto f = Kappa*rho;
+      auto Pp1 = P+1;
+      double scale = M.scale;
+      int calc;
+      in_(&scale, &f, &Pp1, BI, &calc);
+#else
+      In(M.scale, Kappa*rho, P+1, BI);
+#endif
       for( int n=0; n!=P; ++n ) {
         for( int m=0; m<=n; ++m ) {
           const int nm  = n * n + n + m;
           const int nms = n * (n + 1) / 2 + m;
-          // get the bessel functions
-#ifdef USE_FORT_IN
-          auto f = Kappa*rho;
-          auto Pp1 = P+1;
-          double scale = M.scale;
-          int calc;
-          in_(&scale, &f, &Pp1, BI, &calc);
-#else
-          In(M.scale, Kappa*rho, P+1, BI);
-#endif
           M[nms] += (*c_begin) * Ynm[nm] * BI[n];
         }
       }
@@ -224,7 +229,7 @@ class YukawaSpherical
     // grab some references
     auto& RD = getRotationMatrix(-translation[2]);
     auto& DC = getShiftingMatrix(Mtarget.level, std::sqrt(normSq(translation)), Msource.scale);
-    complex ephi[P+1], Marray[4*P*P];
+    complex ephi[P+2], Marray[4*P*P];
     const double arg = std::sqrt(2.)/2.;
 
     real rho, alpha, beta;
@@ -388,7 +393,7 @@ class YukawaSpherical
   void M2P(const multipole_type& M, const point_type& center,
            const target_type& target, result_type& result) const {
     complex Ynm[4*P*P], YnmTheta[4*P*P];
-    double BK[P+1];
+    double BK[P+2];
     point_type dist = target - center;
     point_type spherical(0);
     point_type cartesian(0);
@@ -552,7 +557,7 @@ class YukawaSpherical
 
   /** Cartesian to spherical coordinates
   */
-  void cart2sph(real& r, real& theta, real& phi, point_type dist=0) const {
+  void cart2sph(real& r, real& theta, real& phi, point_type dist=point_type(real(0))) const {
     r = norm(dist) + EPS;                                       // r = sqrt(x^2 + y^2 + z^2) + eps
     theta = acos(dist[2] / r);                                  // theta = acos(z / r)
     if( fabs(dist[0]) + fabs(dist[1]) < EPS ) {                 // If |x| < eps & |y| < eps
@@ -745,14 +750,7 @@ class YukawaSpherical
     }
 
     auto r0k = r0*Kappa;
-    double BJ[2*P+2];
-#ifdef USE_FORT_IN
-    int len = 2*P+2;
-    int calc;
-    in_(&r0k,&r0k,&len,BJ,&calc);
-#else
-    In(r0k,r0k,2*P+2,BJ);
-#endif
+    const std::vector<real>& BJ = getBesselI(r0k, r0k, 2*P+2);
 
     for (int mnew = 0; mnew <= P; mnew++) {
       for (int lnew = mnew; lnew <= P; lnew++) {
@@ -771,22 +769,48 @@ class YukawaSpherical
   }
 
   // Memoize getting / setting of the shifting matrices
-  Mat3d& getShiftingMatrix(int level, double r0, double scale) const
+  // The scale is Kappa over the size of the level and P and Kappa are
+  // fixed, so the level and the length of the shift identify a matrix
+  const Mat3d& getShiftingMatrix(int level, double r0, double scale) const
   {
-    auto it = M2MShiftingMatrices.find(level);
-    if (it != M2MShiftingMatrices.end()) {
-      return it->second;
-    } else {
-      //double diff = 1./pow(2.,level+1) - 1./pow(2.,level);
-      //double r0 = std::sqrt(3. * diff*diff);
-      //double scale = Kappa/pow(2.,level+1);
-      printf("Shifting matrix for level %d, r0 : %.5lg, scale: %.5lg\n",level,r0,scale);
-      M2MShiftingMatrices[level].resize(boost::extents[P+1][P+1][P+1]);
-      M2MShiftingMatrices[level] = Mat3d(genShiftingMatrix<Mat3d>(scale,r0));
+    const auto key = std::make_pair(unsigned(level), std::llround(std::ldexp(r0*Kappa, 40)));
+    const Mat3d* C0;
+#pragma omp critical(YukawaSphericalShift)
+    {
+      auto it = M2MShiftingMatrices.find(key);
+      if (it == M2MShiftingMatrices.end()) {
+        printf("Shifting matrix for level %d, r0 : %.5lg, scale: %.5lg\n",level,r0,scale);
+        it = M2MShiftingMatrices.insert(std::make_pair(key, Mat3d())).first;
+        it->second.resize(boost::extents[P+1][P+1][P+1]);
+        it->second = genShiftingMatrix<Mat3d>(scale,r0);
+      }
+      C0 = &it->second;
     }
+    return *C0;
+  }
 
-    // if we get here, know shifting matrix has been created
-    return M2MShiftingMatrices[level];
+  // Memoize the scaled Bessel series i_0 .. i_nb of the shifts
+  const std::vector<real>& getBesselI(real scale, real x, unsigned nb) const
+  {
+    const auto key = std::make_pair(std::llround(std::ldexp(scale, 40)),
+                                    std::llround(std::ldexp(x, 40)));
+    const std::vector<real>* b;
+#pragma omp critical(YukawaSphericalBessel)
+    {
+      std::vector<real>& bk = BesselI[key];
+      if (bk.size() < nb+1) {
+        bk.resize(nb+1);
+#ifdef USE_FORT_IN
+        int len = nb;
+        int calc;
+        in_(&scale,&x,&len,bk.data(),&calc);
+#else
+        In(scale,x,nb,bk.data());
+#endif
+      }
+      b = &bk;
+    }
+    return *b;
   }
 
   // Modified Spherical Bessel functions
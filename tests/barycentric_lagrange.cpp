@@ -0,0 +1,142 @@
+/** @file barycentric_lagrange.cpp
+ * @brief Test the treecode of BarycentricLagrange.hpp with a kernel that
+ * only has a pointwise operator(), on a dual tree of many sources and few
+ * targets: the relative error against the direct sum for degrees 2..8, and
+ * results independent of the number of threads
+ */
+
+#include "FMM_plan.hpp"
+#include "BarycentricLagrange.hpp"
+#include "timing.hpp"
+
+#include <omp.h>
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+/** The Laplace potential and force, without expansions */
+class LaplacePointwise
+{
+ public:
+  static constexpr unsigned dimension = 3;
+  typedef Vec<dimension,double> point_type;
+  typedef point_type source_type;
+  typedef point_type target_type;
+  typedef double charge_type;
+  typedef Vec<4,double> kernel_value_type;
+  typedef Vec<4,double> result_type;
+
+  kernel_value_type operator()(const point_type& t,
+                               const point_type& s) const {
+    point_type dist = s - t;
+    double r2 = normSq(dist);
+    if (r2 == 0)
+      return kernel_value_type(0);
+    double invR = 1 / std::sqrt(r2);
+    dist *= invR * invR * invR;
+    return kernel_value_type(invR, dist[0], dist[1], dist[2]);
+  }
+};
+
+// Relative 2-norm error of the potential and force
+double error(const std::vector<Vec<4,double>>& exact,
+             const std::vector<Vec<4,double>>& result) {
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += normSq(exact[k] - result[k]);
+    r2 += normSq(exact[k]);
+  }
+  return std::sqrt(e2 / r2);
+}
+
+
+int main(int argc, char **argv)
+{
+  int numSources = 20000;
+  int numTargets = 500;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numSources = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-M") == 0) {
+      i++;
+      numTargets = atoi(argv[i]);
+    }
+  }
+
+  FMMOptions opts = get_options(argc, argv);
+  opts.evaluator = FMMOptions::TREECODE;
+  typedef LaplacePointwise kernel_type;
+  typedef BarycentricLagrange<kernel_type> treecode_type;
+  kernel_type K;
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::target_type target_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  std::vector<source_type> sources(numSources);
+  for (int k = 0; k < numSources; ++k)
+    sources[k] = source_type(drand(), drand(), drand());
+  std::vector<target_type> targets(numTargets);
+  for (int k = 0; k < numTargets; ++k)
+    targets[k] = target_type(drand(), drand(), drand());
+  std::vector<charge_type> charges(numSources);
+  for (int k = 0; k < numSources; ++k)
+    charges[k] = drand(-1, 1);
+
+  std::vector<result_type> exact(numTargets);
+  double tic = get_time();
+  Direct::matvec(K, sources, charges, targets, exact);
+  printf("Direct: %.3fs\n", get_time() - tic);
+
+  // The dual tree executor of the sources and targets
+  auto evaluate = [&](const treecode_type& T) {
+    ExecutorBase<treecode_type>* executor =
+        make_executor(T, sources.begin(), sources.end(),
+                      targets.begin(), targets.end(), opts);
+    std::vector<result_type> result(numTargets, result_type(0));
+    executor->execute(charges, result);
+    delete executor;
+    return result;
+  };
+
+  // Expected error for degrees 2..8
+  const double tolerance[] = {2e-3, 3e-4, 6e-5, 1e-5, 2e-6, 4e-7, 7e-8};
+  int wrong_results = 0;
+  printf("%3s %11s %9s\n", "n", "error", "time");
+  for (unsigned n = 2; n <= 8; ++n) {
+    tic = get_time();
+    std::vector<result_type> result = evaluate(treecode_type(K, n));
+    const double err = error(exact, result);
+    printf("%3u %11.3e %8.3fs\n", n, err, get_time() - tic);
+
+    if (!(err < tolerance[n-2]))
+      ++wrong_results;
+  }
+
+  // Every target is summed by one thread, in the same order
+  const int threads = omp_get_max_threads();
+  const treecode_type T(K, 6);
+  omp_set_num_threads(1);
+  const std::vector<result_type> serial = evaluate(T);
+  omp_set_num_threads(std::max(threads, 4));
+  const std::vector<result_type> parallel = evaluate(T);
+  omp_set_num_threads(threads);
+  for (int k = 0; k < numTargets; ++k)
+    if (!(serial[k] == parallel[k]))
+      ++wrong_results;
+  printf("Same results with 1 and %d threads: %s\n",
+         std::max(threads, 4), serial == parallel ? "yes" : "no");
+
+  printf("Wrong counts: %d\n", wrong_results);
+}
@@ -0,0 +1,123 @@
+/** @file kifmm.cpp
+ * @brief Test the kernel-independent expansions of KIFMM.hpp with a kernel
+ * that only has a pointwise operator(): the relative error of the FMM
+ * against the direct sum for surfaces of 4..8 points per edge, the time of
+ * the plan and its first execution, which builds the operators, and the time
+ * of a second execution
+ */
+
+#include "FMM_plan.hpp"
+#include "timing.hpp"
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+/** The Yukawa potential and force, without expansions */
+class YukawaPointwise
+{
+  double Kappa;
+ public:
+  static constexpr unsigned dimension = 3;
+  typedef Vec<dimension,double> point_type;
+  typedef point_type source_type;
+  typedef point_type target_type;
+  typedef double charge_type;
+  typedef Vec<4,double> kernel_value_type;
+  typedef Vec<4,double> result_type;
+
+  YukawaPointwise(double kappa = 0.5)
+      : Kappa(kappa) {
+  }
+
+  kernel_value_type operator()(const point_type& t,
+                               const point_type& s) const {
+    point_type dist = t - s;
+    double r2 = normSq(dist);
+    if (r2 == 0)
+      return kernel_value_type(0);
+    double r = std::sqrt(r2);
+    double pot = std::exp(-Kappa * r) / r;
+    dist *= pot * (Kappa * r + 1) / r2;
+    return kernel_value_type(pot, -dist[0], -dist[1], -dist[2]);
+  }
+};
+
+// Relative 2-norm error of the potential and force
+double error(const std::vector<Vec<4,double>>& exact,
+             const std::vector<Vec<4,double>>& result) {
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += normSq(exact[k] - result[k]);
+    r2 += normSq(exact[k]);
+  }
+  return std::sqrt(e2 / r2);
+}
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 4000;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    }
+  }
+
+  FMMOptions opts = get_options(argc, argv);
+  typedef YukawaPointwise kernel_type;
+  kernel_type K;
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  std::vector<source_type> points(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    points[k] = source_type(drand(), drand(), drand());
+
+  std::vector<charge_type> charges(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    charges[k] = drand(-1, 1);
+
+  std::vector<result_type> exact(numBodies);
+  double tic = get_time();
+  Direct::matvec(K, points, charges, exact);
+  printf("Direct: %.3fs\n", get_time() - tic);
+
+  // Expected error for 4..8 points per edge
+  const double tolerance[] = {4e-3, 5e-4, 1e-4, 3e-5, 5e-6};
+  int wrong_results = 0;
+  printf("%3s %11s %9s %9s\n", "n", "error", "first", "again");
+  for (unsigned n = 4; n <= 8; ++n) {
+    tic = get_time();
+    FMM_plan<KIFMM<kernel_type>> plan(KIFMM<kernel_type>(K, n), points, opts);
+    std::vector<result_type> result = plan.execute(charges);
+    const double err = error(exact, result);
+    const double time_first = get_time() - tic;
+    tic = get_time();
+    plan.execute(charges);
+    printf("%3u %11.3e %8.3fs %8.3fs\n", n, err, time_first, get_time() - tic);
+
+    if (!(err < tolerance[n-4]))
+      ++wrong_results;
+  }
+
+  // The pointwise kernel alone gets the expansions of KIFMM<kernel_type>
+  // with 6 points per edge
+  FMM_plan<kernel_type> plan(K, points, opts);
+  const double err = error(exact, plan.execute(charges));
+  printf("%3s %11.3e\n", "-", err);
+  if (!(err < tolerance[6-4]))
+    ++wrong_results;
+  printf("Wrong counts: %d\n", wrong_results);
+}
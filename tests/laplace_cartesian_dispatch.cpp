@@ -0,0 +1,106 @@
+/** @file laplace_cartesian_dispatch.cpp
+ * @brief Compare LaplaceCartesianDispatch<8>, switching its order with set_p
+ * on one plan, with LaplaceCartesian<p> for p = 1..8: the relative error of
+ * the FMM against the direct sum and the time per execution
+ */
+
+#include "FMM_plan.hpp"
+#include "LaplaceCartesian.hpp"
+#include "LaplaceCartesianDispatch.hpp"
+#include "timing.hpp"
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+typedef Vec<3,double> point_type;
+typedef Vec<4,double> result_type;
+
+// Relative 2-norm error of the potential and force
+double error(const std::vector<result_type>& exact,
+             const std::vector<result_type>& result) {
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += normSq(exact[k] - result[k]);
+    r2 += normSq(exact[k]);
+  }
+  return std::sqrt(e2 / r2);
+}
+
+static const unsigned MaxP = 8;
+typedef LaplaceCartesianDispatch<MaxP> dispatch_type;
+static int wrong_results = 0;
+
+template <unsigned P>
+struct Compare {
+  static void run(FMM_plan<dispatch_type>& dispatch,
+                  const std::vector<point_type>& points,
+                  const std::vector<double>& charges,
+                  const std::vector<result_type>& exact,
+                  FMMOptions& opts) {
+    LaplaceCartesian<P> K;
+    FMM_plan<LaplaceCartesian<P>> plan(K, points, opts);
+    double tic = get_time();
+    const double err_fixed = error(exact, plan.execute(charges));
+    const double time_fixed = get_time() - tic;
+
+    dispatch.kernel().set_p(P);
+    tic = get_time();
+    const double err = error(exact, dispatch.execute(charges));
+    const double time = get_time() - tic;
+    printf("%3u %11.3e %11.3e %8.3fs %8.3fs\n",
+           P, err_fixed, err, time_fixed, time);
+
+    // The same operators on the same tree
+    if (!(std::abs(err - err_fixed) <= 1e-6 * err_fixed))
+      ++wrong_results;
+
+    Compare<P+1>::run(dispatch, points, charges, exact, opts);
+  }
+};
+template <>
+struct Compare<MaxP+1> {
+  static void run(FMM_plan<dispatch_type>&, const std::vector<point_type>&,
+                  const std::vector<double>&, const std::vector<result_type>&,
+                  FMMOptions&) {}
+};
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 10000;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    }
+  }
+
+  FMMOptions opts = get_options(argc, argv);
+
+  std::vector<point_type> points(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    points[k] = point_type(drand(), drand(), drand());
+
+  std::vector<double> charges(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    charges[k] = drand(-1, 1);
+
+  dispatch_type K;
+  std::vector<result_type> exact(numBodies);
+  Direct::matvec(K, points, charges, exact);
+
+  FMM_plan<dispatch_type> dispatch(K, points, opts);
+
+  printf("%3s %11s %11s %9s %9s\n", "p", "fixed", "dispatch", "fixed", "dispatch");
+  Compare<1>::run(dispatch, points, charges, exact, opts);
+  printf("Wrong counts: %d\n", wrong_results);
+}
@@ -0,0 +1,98 @@
+/** @file mixed_precision.cpp
+ * @brief Compare the accuracy of the FMM in double and in single precision
+ * (P2P and the near-field operator in float) against a direct
+ * matrix-vector product in double precision, for a range of expansion orders
+ */
+
+#include "FMM_plan.hpp"
+#include "LaplaceSpherical.hpp"
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+// Relative 2-norm error of the potential
+template <typename Vector>
+double potential_error(const Vector& exact, const Vector& result) {
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += (exact[k][0] - result[k][0]) * (exact[k][0] - result[k][0]);
+    r2 += exact[k][0] * exact[k][0];
+  }
+  return std::sqrt(e2 / r2);
+}
+
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 1000;
+  int minP = 2, maxP = 12;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-minp") == 0) {
+      i++;
+      minP = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-maxp") == 0) {
+      i++;
+      maxP = atoi(argv[i]);
+    }
+  }
+
+  // Init the FMM Kernel and options
+  FMMOptions opts = get_options(argc, argv);
+  typedef LaplaceSpherical kernel_type;
+  kernel_type K(maxP);
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  // Init points and charges
+  std::vector<source_type> points(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    points[k] = source_type(drand(), drand(), drand());
+
+  std::vector<charge_type> charges(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    charges[k] = drand(-1, 1);
+
+  // Compute the result with a direct matrix-vector multiplication
+  std::vector<result_type> exact(numBodies);
+  Direct::matvec(K, points, charges, exact);
+
+  // Build the FMM
+  FMM_plan<kernel_type> plan = FMM_plan<kernel_type>(K, points, opts);
+
+  printf("%4s %14s %14s\n", "p", "double", "single");
+  int wrong_results = 0;
+  for (int p = minP; p <= maxP; ++p) {
+    plan.kernel().set_p(p);
+
+    plan.kernel().set_single_precision(false);
+    std::vector<result_type> result = plan.execute(charges);
+    double double_error = potential_error(exact, result);
+
+    plan.kernel().set_single_precision(true);
+    result = plan.execute(charges);
+    double single_error = potential_error(exact, result);
+
+    printf("%4d %14.4e %14.4e\n", p, double_error, single_error);
+
+    // The single precision error should be the truncation error,
+    // until it reaches the float roundoff
+    if (single_error > std::max(10 * double_error, 1e-5))
+      ++wrong_results;
+  }
+  printf("Wrong counts: %d\n", wrong_results);
+}
@@ -0,0 +1,157 @@
+/** @file moving_targets.cpp
+ * @brief Test the evaluation at targets other than the sources: the
+ * streaming evaluate in chunks, and track_targets followed by move_targets
+ * with the targets moved within their leaves, out of their leaves, and out
+ * of the target tree, against the direct sum, with the FMM and the treecode
+ */
+
+#include "FMM_plan.hpp"
+#include "LaplaceSpherical.hpp"
+#include "timing.hpp"
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+typedef LaplaceSpherical kernel_type;
+typedef kernel_type::point_type point_type;
+typedef kernel_type::result_type result_type;
+
+// Relative 2-norm error of the potential and force
+double error(const std::vector<result_type>& exact,
+             const std::vector<result_type>& result) {
+  if (exact.size() != result.size())
+    return 1;
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += normSq(exact[k] - result[k]);
+    r2 += normSq(exact[k]);
+  }
+  return std::sqrt(e2 / r2);
+}
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 10000;
+  int numTargets = 5000;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-T") == 0) {
+      i++;
+      numTargets = atoi(argv[i]);
+    }
+  }
+
+  FMMOptions opts = get_options(argc, argv);
+  kernel_type K(5);
+
+  std::vector<point_type> points(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    points[k] = point_type(drand(), drand(), drand());
+
+  std::vector<double> charges(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    charges[k] = drand(-1, 1);
+
+  std::vector<point_type> targets(numTargets);
+  for (int k = 0; k < numTargets; ++k)
+    targets[k] = point_type(drand(), drand(), drand());
+
+  std::vector<result_type> exact(numBodies);
+  double tic = get_time();
+  Direct::matvec(K, points, charges, exact);
+  const double time_direct = get_time() - tic;
+  int wrong_results = 0;
+
+  // The treecode evaluates its M2P on the target leaves, the FMM its M2L on
+  // every target box, so both are checked
+  const FMMOptions::EvalType evaluators[] = {FMMOptions::FMM,
+                                             FMMOptions::TREECODE};
+  for (FMMOptions::EvalType evaluator : evaluators) {
+    opts.evaluator = evaluator;
+    FMM_plan<kernel_type> plan(K, points, opts);
+
+    printf("%-32s %11s %9s %9s\n",
+           evaluator == FMMOptions::FMM ? "targets, fmm" : "targets, treecode",
+           "error", "fmm", "direct");
+
+    // The error at the sources, which other targets should be near
+    tic = get_time();
+    const double source_error = error(exact, plan.execute(charges));
+    printf("%-32s %11.3e %8.3fs %8.3fs\n", "sources", source_error,
+           get_time() - tic, time_direct);
+    const double tolerance = 3 * source_error;
+
+    auto check = [&](const char* name, const std::vector<point_type>& t,
+                     const std::vector<result_type>& result, double time) {
+      std::vector<result_type> exact(t.size());
+      double tic = get_time();
+      Direct::matvec(K, points.begin(), points.end(), charges.begin(),
+                     t.begin(), t.end(), exact.begin());
+      const double time_direct = get_time() - tic;
+      const double err = error(exact, result);
+      printf("%-32s %11.3e %8.3fs %8.3fs\n", name, err, time, time_direct);
+      if (!(err < tolerance))
+        ++wrong_results;
+    };
+
+    // Streamed in one chunk and in chunks of 1000
+    const unsigned chunks[] = {1u << 20, 1000u};
+    for (unsigned chunk : chunks) {
+      std::vector<result_type> result(numTargets);
+      double tic = get_time();
+      plan.evaluate(charges, targets.begin(), targets.end(), result.begin(),
+                    chunk);
+      char name[64];
+      sprintf(name, "evaluate, chunks of %u", chunk);
+      check(name, targets, result, get_time() - tic);
+    }
+
+    tic = get_time();
+    std::vector<result_type> result =
+        plan.track_targets(charges, targets.begin(), targets.end());
+    check("track_targets", targets, result, get_time() - tic);
+
+    // Moved by a tenth of a leaf: most stay in their leaf
+    std::vector<point_type> moved(targets);
+    for (point_type& t : moved)
+      t += point_type(drand(-1, 1), drand(-1, 1), drand(-1, 1)) * 2e-3;
+    tic = get_time();
+    result = plan.move_targets(moved.begin(), moved.end());
+    check("move_targets, within leaves", moved, result, get_time() - tic);
+
+    // Moved by about a leaf: most are re-binned
+    for (point_type& t : moved)
+      t += point_type(drand(-1, 1), drand(-1, 1), drand(-1, 1)) * 5e-2;
+    tic = get_time();
+    result = plan.move_targets(moved.begin(), moved.end());
+    check("move_targets, across leaves", moved, result, get_time() - tic);
+
+    // A few out of the target tree, summed directly
+    for (unsigned k = 0; k < 10; ++k)
+      moved[k] += point_type(1, 1, 1);
+    tic = get_time();
+    result = plan.move_targets(moved.begin(), moved.end());
+    check("move_targets, 10 orphans", moved, result, get_time() - tic);
+
+    // A quarter out of the target tree, binned into a tree of their own
+    for (unsigned k = 0; k < moved.size(); k += 4)
+      moved[k] += point_type(1, 0, 0);
+    tic = get_time();
+    result = plan.move_targets(moved.begin(), moved.end());
+    check("move_targets, quarter orphans", moved, result, get_time() - tic);
+  }
+
+  printf("Wrong counts: %d\n", wrong_results);
+}
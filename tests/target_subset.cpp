@@ -0,0 +1,115 @@
+/** @file target_subset.cpp
+ * @brief Test the evaluation of a subset of the targets by running an
+ * instance of the UnitKernel with random points, charges and target subset:
+ * the requested targets are exact, and only their leaves are evaluated
+ */
+
+#include "FMM_plan.hpp"
+#include "UnitKernel.hpp"
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 1000;
+  int numTargets = 10;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-T") == 0) {
+      i++;
+      numTargets = atoi(argv[i]);
+    }
+  }
+
+  // Init the FMM Kernel and options
+  FMMOptions opts = get_options(argc, argv);
+  typedef UnitKernel kernel_type;
+  kernel_type K;
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  // Init points and charges
+  std::vector<source_type> points(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    points[k] = source_type(drand(), drand(), drand());
+
+  std::vector<charge_type> charges(numBodies);
+  for (int k = 0; k < numBodies; ++k)
+    charges[k] = drand();
+
+  // Pick the requested targets
+  std::vector<unsigned> target_ids(numTargets);
+  std::vector<bool> requested(numBodies, false);
+  for (int k = 0; k < numTargets; ++k) {
+    target_ids[k] = ::lrand48() % numBodies;
+    requested[target_ids[k]] = true;
+  }
+
+  // Build the FMM
+  FMM_plan<kernel_type> plan = FMM_plan<kernel_type>(K, points, opts);
+
+  // Execute the FMM for the subset, twice to check the cached lists
+  std::vector<result_type> result = plan.execute(charges, target_ids);
+  result = plan.execute(charges, target_ids);
+
+  // Check the result
+  std::vector<result_type> exact(numBodies);
+
+  // Compute the result with a direct matrix-vector multiplication
+  Direct::matvec(K, points, charges, exact);
+
+  int wrong_results = 0;
+  for (unsigned k = 0; k < target_ids.size(); ++k) {
+    unsigned i = target_ids[k];
+    printf("[%03d] exact: %lg, FMM: %lg\n", i, exact[i], result[i]);
+
+    if ((exact[i] - result[i]) / exact[i] > 1e-13)
+      ++wrong_results;
+  }
+
+  // A leaf holding a requested target is evaluated, all others are not.
+  // The tree of the plan is built again with the same points and options.
+  Octree<source_type> tree(points.begin(), points.end(), opts);
+  int evaluated = 0;
+  for (auto bit = tree.box_begin(); bit != tree.box_end(); ++bit) {
+    auto b = *bit;
+    if (!b.is_leaf()) continue;
+
+    bool is_requested = false;
+    for (auto it = b.body_begin(); it != b.body_end(); ++it)
+      is_requested |= requested[(*it).number()];
+    for (auto it = b.body_begin(); it != b.body_end(); ++it) {
+      const bool is_evaluated = (result[(*it).number()] != 0);
+      evaluated += is_evaluated;
+      if (is_evaluated != is_requested)
+        ++wrong_results;
+    }
+  }
+
+  // Masks and ids that do not match the targets are rejected
+  if (!plan.execute(charges, std::vector<bool>(numBodies + 1, true)).empty())
+    ++wrong_results;
+  if (!plan.execute(charges, std::vector<unsigned>(1, numBodies)).empty())
+    ++wrong_results;
+
+  printf("Wrong counts: %d\n", wrong_results);
+  printf("Evaluated targets: %d of %d (%d requested)\n",
+         evaluated, numBodies, (int)std::count(requested.begin(),
+                                               requested.end(), true));
+}
@@ -0,0 +1,193 @@
+/** @file yukawa_cartesian_fixed.cpp
+ * @brief Compare the operators of YukawaCartesianFixed<P> with those of
+ * YukawaCartesian(P) for P = 4..10: the potential and force of a
+ * P2M-M2M-M2L-L2L-L2P chain and of a M2P against the direct sum, and the
+ * time per operator
+ */
+
+#include "YukawaCartesian.hpp"
+#include "YukawaCartesianFixed.hpp"
+#include "timing.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+typedef Vec<3,double> point_type;
+typedef Vec<4,double> result_type;
+
+// Random number in [0,1)
+inline double drand() {
+  return ::drand48();
+}
+
+// Random number in [A,B)
+inline double drand(double A, double B) {
+  return (B-A) * drand() + A;
+}
+
+// Relative 2-norm error of the potential and force
+double error(const std::vector<result_type>& exact,
+             const std::vector<result_type>& result) {
+  double e2 = 0, r2 = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    e2 += normSq(exact[k] - result[k]);
+    r2 += normSq(exact[k]);
+  }
+  return std::sqrt(e2 / r2);
+}
+
+// Sources in a child of a box of side 1 at the origin, and targets in a
+// well separated box of side 1, with their centers
+struct Problem {
+  std::vector<point_type> sources, targets;
+  std::vector<double> charges;
+  point_type child, source_center, target_center, target_child;
+  std::vector<result_type> exact;
+};
+
+template <typename Kernel>
+void direct(const Kernel& K, Problem& p) {
+  p.exact.assign(p.targets.size(), result_type(0));
+  for (unsigned i = 0; i < p.targets.size(); ++i)
+    for (unsigned j = 0; j < p.sources.size(); ++j)
+      p.exact[i] += K(p.targets[i], p.sources[j]) * p.charges[j];
+}
+
+// The chain P2M-M2M-M2L-L2L-L2P and the M2P of the source box, timing
+// every operator over reps repetitions
+template <typename Kernel>
+void evaluate(const Kernel& K, const Problem& p, int reps,
+              std::vector<result_type>& chain, std::vector<result_type>& m2p,
+              double* times) {
+  typename Kernel::multipole_type Mc, M;
+  typename Kernel::local_type L, Lc;
+  const point_type extents(1);
+  double tic;
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    K.init_multipole(Mc, extents, 2);
+    for (unsigned j = 0; j < p.sources.size(); ++j)
+      K.P2M(p.sources[j], p.charges[j], p.child, Mc);
+  }
+  times[0] = (get_time() - tic) / (reps * p.sources.size());
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    K.init_multipole(M, extents, 1);
+    K.M2M(Mc, M, p.source_center - p.child);
+  }
+  times[1] = (get_time() - tic) / reps;
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    K.init_local(L, extents, 1);
+    K.M2L(M, L, p.target_center - p.source_center);
+  }
+  times[2] = (get_time() - tic) / reps;
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    K.init_local(Lc, extents, 2);
+    K.L2L(L, Lc, p.target_child - p.target_center);
+  }
+  times[3] = (get_time() - tic) / reps;
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    chain.assign(p.targets.size(), result_type(0));
+    for (unsigned i = 0; i < p.targets.size(); ++i)
+      K.L2P(Lc, p.target_child, p.targets[i], chain[i]);
+  }
+  times[4] = (get_time() - tic) / (reps * p.targets.size());
+
+  tic = get_time();
+  for (int r = 0; r < reps; ++r) {
+    m2p.assign(p.targets.size(), result_type(0));
+    for (unsigned i = 0; i < p.targets.size(); ++i)
+      K.M2P(M, p.source_center, p.targets[i], m2p[i]);
+  }
+  times[5] = (get_time() - tic) / (reps * p.targets.size());
+}
+
+static const char* names[] = {"P2M", "M2M", "M2L", "L2L", "L2P", "M2P"};
+static int wrong_results = 0;
+
+template <unsigned P, unsigned MaxP>
+struct Compare {
+  static void run(Problem& p, double kappa, int reps) {
+    YukawaCartesian Kr(P, kappa);
+    YukawaCartesianFixed<P> Kf(kappa);
+
+    std::vector<result_type> chain_r, m2p_r, chain_f, m2p_f;
+    double tr[6], tf[6];
+    evaluate(Kr, p, reps, chain_r, m2p_r, tr);
+    evaluate(Kf, p, reps, chain_f, m2p_f, tf);
+
+    const double err[4] = {error(p.exact, chain_r), error(p.exact, chain_f),
+                           error(p.exact, m2p_r), error(p.exact, m2p_f)};
+    printf("%3u %11.3e %11.3e %11.3e %11.3e", P, err[0], err[1], err[2], err[3]);
+    for (int op = 0; op < 6; ++op)
+      printf(" %7.1f", tr[op] / tf[op]);
+    printf("\n");
+
+    // Both expand to the same order, so they should be as accurate
+    if (err[1] > 2 * err[0] + 1e-12 || err[3] > 2 * err[2] + 1e-12)
+      ++wrong_results;
+
+    Compare<P+1,MaxP>::run(p, kappa, reps);
+  }
+};
+template <unsigned MaxP>
+struct Compare<MaxP,MaxP> {
+  static void run(Problem&, double, int) {}
+};
+
+
+
+int main(int argc, char **argv)
+{
+  int numBodies = 100;
+  int reps = 100;
+  double kappa = 0.5;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      i++;
+      numBodies = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-reps") == 0) {
+      i++;
+      reps = atoi(argv[i]);
+    } else if (strcmp(argv[i],"-kappa") == 0) {
+      i++;
+      kappa = atof(argv[i]);
+    }
+  }
+
+  Problem p;
+  p.source_center = point_type(0, 0, 0);
+  p.child = point_type(0.25, -0.25, 0.25);
+  p.target_center = point_type(2, 1, -1);
+  p.target_child = p.target_center + point_type(-0.25, 0.25, 0.25);
+  for (int k = 0; k < numBodies; ++k) {
+    p.sources.push_back(p.child + point_type(drand(-.25,.25), drand(-.25,.25),
+                                             drand(-.25,.25)));
+    p.charges.push_back(drand(-1, 1));
+    p.targets.push_back(p.target_child + point_type(drand(-.25,.25),
+                                                    drand(-.25,.25),
+                                                    drand(-.25,.25)));
+  }
+  direct(YukawaCartesian(4, kappa), p);
+
+  printf("Relative error of the chain P2M-M2M-M2L-L2L-L2P and of the M2P,\n"
+         "and the speedup of YukawaCartesianFixed<P> per operator\n");
+  printf("%3s %11s %11s %11s %11s", "p", "chain", "fixed", "M2P", "fixed");
+  for (int op = 0; op < 6; ++op)
+    printf(" %7s", names[op]);
+  printf("\n");
+  Compare<4,11>::run(p, kappa, reps);
+  printf("Wrong counts: %d\n", wrong_results);
+}